@@ -1,10 +1,16 @@
 ﻿#pragma once
 
+#include <assert.h>
+#include <stdint.h>
 #include <string.h>
+#include <algorithm>
 #include <vector>
 
 #include <glm/glm.hpp>
 
+#include "BitmapPacking.h"
+#include "BitmapStorage.h"
+
 enum eBitmapType
 {
 	eBitmapType_2D,
@@ -15,6 +21,83 @@ enum eBitmapFormat
 {
 	eBitmapFormat_UnsignedByte,
 	eBitmapFormat_Float,
+	eBitmapFormat_HalfFloat,
+	eBitmapFormat_UnsignedShort, // normalized 16-bit
+	eBitmapFormat_RGB9E5,        // packed RGB with a shared exponent, comp_ is 3
+	eBitmapFormat_R11G11B10F,    // packed unsigned floats, comp_ is 3
+};
+
+enum eBitmapLayout
+{
+	eBitmapLayout_Linear, // row-major
+	eBitmapLayout_Tiled,  // 8x8 tiles in row-major order, row-major inside a tile
+	eBitmapLayout_Morton, // Z-order curve inside square power-of-two blocks
+};
+
+inline uint32_t mortonPart1By1(uint32_t x)
+{
+	x &= 0x0000FFFF;
+	x = (x | (x << 8)) & 0x00FF00FF;
+	x = (x | (x << 4)) & 0x0F0F0F0F;
+	x = (x | (x << 2)) & 0x33333333;
+	x = (x | (x << 1)) & 0x55555555;
+	return x;
+}
+
+/// Maps 2D pixel coordinates to the index of the pixel in storage order.
+/// Tiled and Morton storage is padded to whole tiles/blocks.
+struct BitmapAddressing
+{
+	BitmapAddressing() = default;
+	BitmapAddressing(eBitmapLayout layout, int w, int h)
+	: layout_(layout), w_(w)
+	{
+		switch (layout)
+		{
+		case eBitmapLayout_Linear:
+			numPixels_ = (size_t)w * h;
+			break;
+		case eBitmapLayout_Tiled:
+			tilesX_ = (w + 7) / 8;
+			numPixels_ = (size_t)tilesX_ * ((h + 7) / 8) * 64;
+			break;
+		case eBitmapLayout_Morton:
+		{
+			int shiftW = 0;
+			int shiftH = 0;
+			while ((1 << shiftW) < w) shiftW++;
+			while ((1 << shiftH) < h) shiftH++;
+			blockShift_ = std::min(shiftW, shiftH);
+			blocksX_ = 1 << (shiftW - blockShift_);
+			numPixels_ = (size_t)1 << (shiftW + shiftH);
+			break;
+		}
+		}
+	}
+
+	/// Layout is a compile-time constant equal to layout_, the unused branches fold away
+	template <eBitmapLayout Layout>
+	size_t index(int x, int y) const
+	{
+		if (Layout == eBitmapLayout_Tiled)
+			return (((size_t)(y >> 3) * tilesX_ + (x >> 3)) << 6) + ((y & 7) << 3) + (x & 7);
+
+		if (Layout == eBitmapLayout_Morton)
+		{
+			const int mask = (1 << blockShift_) - 1;
+			const size_t block = (size_t)(y >> blockShift_) * blocksX_ + (x >> blockShift_);
+			return (block << (2 * blockShift_)) + (mortonPart1By1(x & mask) | (mortonPart1By1(y & mask) << 1));
+		}
+
+		return (size_t)y * w_ + x;
+	}
+
+	eBitmapLayout layout_ = eBitmapLayout_Linear;
+	int w_ = 0;
+	size_t numPixels_ = 0;
+	int tilesX_ = 0;
+	int blockShift_ = 0;
+	int blocksX_ = 0;
 };
 
 /// R/RG/RGB/RGBA bitmaps
@@ -22,35 +105,71 @@ struct Bitmap
 {
 	Bitmap() = default;
 	Bitmap(int w, int h, int comp, eBitmapFormat fmt)
-	:w_(w), h_(h), comp_(comp), fmt_(fmt), data_(w * h * comp * getBytesPerComponent(fmt))
+	:w_(w), h_(h), comp_(comp), fmt_(fmt), addressing_(eBitmapLayout_Linear, w, h), data_((size_t)w * h * getBytesPerPixel(fmt, comp))
 	{
 		initGetSetFuncs();
 	}
 	Bitmap(int w, int h, int d, int comp, eBitmapFormat fmt)
-	:w_(w), h_(h), d_(d), comp_(comp), fmt_(fmt), data_(w * h * d * comp * getBytesPerComponent(fmt))
+	:w_(w), h_(h), d_(d), comp_(comp), fmt_(fmt), addressing_(eBitmapLayout_Linear, w, h), data_((size_t)w * h * d * getBytesPerPixel(fmt, comp))
 	{
 		initGetSetFuncs();
 	}
 	Bitmap(int w, int h, int comp, eBitmapFormat fmt, const void* ptr)
-	:w_(w), h_(h), comp_(comp), fmt_(fmt), data_(w * h * comp * getBytesPerComponent(fmt))
+	:w_(w), h_(h), comp_(comp), fmt_(fmt), addressing_(eBitmapLayout_Linear, w, h), data_((size_t)w * h * getBytesPerPixel(fmt, comp))
 	{
 		initGetSetFuncs();
 		memcpy(data_.data(), ptr, data_.size());
 	}
+	/// takes the pixels without a copy: a BitmapStorage::adopt()ed decoder buffer or a borrow()ed view
+	Bitmap(int w, int h, int comp, eBitmapFormat fmt, BitmapStorage&& storage)
+	:w_(w), h_(h), comp_(comp), fmt_(fmt), addressing_(eBitmapLayout_Linear, w, h), data_(std::move(storage))
+	{
+		assert(data_.size() >= (size_t)w * h * getBytesPerPixel(fmt, comp));
+		initGetSetFuncs();
+	}
+	Bitmap(int w, int h, int d, int comp, eBitmapFormat fmt, BitmapStorage&& storage)
+	:w_(w), h_(h), d_(d), comp_(comp), fmt_(fmt), addressing_(eBitmapLayout_Linear, w, h), data_(std::move(storage))
+	{
+		assert(data_.size() >= (size_t)w * h * d * getBytesPerPixel(fmt, comp));
+		initGetSetFuncs();
+	}
+	Bitmap(int w, int h, int comp, eBitmapFormat fmt, eBitmapLayout layout)
+	:w_(w), h_(h), comp_(comp), fmt_(fmt), addressing_(layout, w, h)
+	{
+		data_.resize(addressing_.numPixels_ * getBytesPerPixel(fmt, comp));
+		initGetSetFuncs();
+	}
 	int w_ = 0;
 	int h_ = 0;
 	int d_ = 1;
 	int comp_ = 3;
 	eBitmapFormat fmt_ = eBitmapFormat_UnsignedByte;
 	eBitmapType type_ = eBitmapType_2D;
-	std::vector<uint8_t> data_;
+	BitmapAddressing addressing_;
+	BitmapStorage data_;
+
+	eBitmapLayout getLayout() const { return addressing_.layout_; }
 
+	/// access pattern hint for the upcoming pass over the pixels, only mapped storage uses it
+	void adviseAccess(eBitmapAccess access) const { data_.advise(access); }
+
+	static bool isPackedFormat(eBitmapFormat fmt)
+	{
+		return fmt == eBitmapFormat_RGB9E5 || fmt == eBitmapFormat_R11G11B10F;
+	}
+	/// 0 for packed formats, their components do not occupy whole bytes
 	static int getBytesPerComponent(eBitmapFormat fmt)
 	{
 		if (fmt == eBitmapFormat_UnsignedByte) return 1;
 		if (fmt == eBitmapFormat_Float) return 4;
+		if (fmt == eBitmapFormat_HalfFloat) return 2;
+		if (fmt == eBitmapFormat_UnsignedShort) return 2;
 		return 0;
 	}
+	static int getBytesPerPixel(eBitmapFormat fmt, int comp)
+	{
+		return isPackedFormat(fmt) ? 4 : comp * getBytesPerComponent(fmt);
+	}
 
 	void setPixel(int x, int y, const glm::vec4& c)
 	{
@@ -60,39 +179,97 @@ struct Bitmap
 	{
 		return ((*this.*getPixelFunc)(x, y));
 	}
+
+	/// linear copy of a w x h region starting at (x, y), coordinates outside the bitmap are clamped to the edge
+	Bitmap getRegion(int x, int y, int w, int h) const
+	{
+		Bitmap result(w, h, comp_, fmt_);
+		switch (getLayout())
+		{
+		case eBitmapLayout_Linear: copyRegion<eBitmapLayout_Linear>(result, x, y); break;
+		case eBitmapLayout_Tiled: copyRegion<eBitmapLayout_Tiled>(result, x, y); break;
+		case eBitmapLayout_Morton: copyRegion<eBitmapLayout_Morton>(result, x, y); break;
+		}
+		return result;
+	}
 private:
 	using setPixel_t = void(Bitmap::*)(int, int, const glm::vec4&);
 	using getPixel_t = glm::vec4(Bitmap::*)(int, int) const;
-	setPixel_t setPixelFunc = &Bitmap::setPixelUnsignedByte;
-	getPixel_t getPixelFunc = &Bitmap::getPixelUnsignedByte;
+	setPixel_t setPixelFunc = &Bitmap::setPixelUnsignedByte<eBitmapLayout_Linear>;
+	getPixel_t getPixelFunc = &Bitmap::getPixelUnsignedByte<eBitmapLayout_Linear>;
 
+	template <eBitmapLayout Layout>
+	void copyRegion(Bitmap& result, int x, int y) const
+	{
+		const int pixelSize = getBytesPerPixel(fmt_, comp_);
+		for (int j = 0; j != result.h_; j++)
+		{
+			const int sy = std::min(std::max(y + j, 0), h_ - 1);
+			for (int i = 0; i != result.w_; i++)
+			{
+				const int sx = std::min(std::max(x + i, 0), w_ - 1);
+				memcpy(&result.data_[((size_t)j * result.w_ + i) * pixelSize], &data_[addressing_.index<Layout>(sx, sy) * pixelSize], pixelSize);
+			}
+		}
+	}
+
+	/// one accessor pair per format and layout, so getPixel()/setPixel() do not branch on either per pixel
+	void initGetSetFuncs()
+	{
+		switch (getLayout())
+		{
+		case eBitmapLayout_Linear: initGetSetFuncs<eBitmapLayout_Linear>(); break;
+		case eBitmapLayout_Tiled: initGetSetFuncs<eBitmapLayout_Tiled>(); break;
+		case eBitmapLayout_Morton: initGetSetFuncs<eBitmapLayout_Morton>(); break;
+		}
+	}
+
+	template <eBitmapLayout Layout>
 	void initGetSetFuncs()
 	{
 		switch (fmt_)
 		{
 		case eBitmapFormat_UnsignedByte:
-			setPixelFunc = &Bitmap::setPixelUnsignedByte;
-			getPixelFunc = &Bitmap::getPixelUnsignedByte;
+			setPixelFunc = &Bitmap::setPixelUnsignedByte<Layout>;
+			getPixelFunc = &Bitmap::getPixelUnsignedByte<Layout>;
 			break;
 		case eBitmapFormat_Float:
-			setPixelFunc = &Bitmap::setPixelFloat;
-			getPixelFunc = &Bitmap::getPixelFloat;
+			setPixelFunc = &Bitmap::setPixelFloat<Layout>;
+			getPixelFunc = &Bitmap::getPixelFloat<Layout>;
+			break;
+		case eBitmapFormat_HalfFloat:
+			setPixelFunc = &Bitmap::setPixelHalfFloat<Layout>;
+			getPixelFunc = &Bitmap::getPixelHalfFloat<Layout>;
+			break;
+		case eBitmapFormat_UnsignedShort:
+			setPixelFunc = &Bitmap::setPixelUnsignedShort<Layout>;
+			getPixelFunc = &Bitmap::getPixelUnsignedShort<Layout>;
+			break;
+		case eBitmapFormat_RGB9E5:
+			setPixelFunc = &Bitmap::setPixelRGB9E5<Layout>;
+			getPixelFunc = &Bitmap::getPixelRGB9E5<Layout>;
+			break;
+		case eBitmapFormat_R11G11B10F:
+			setPixelFunc = &Bitmap::setPixelR11G11B10F<Layout>;
+			getPixelFunc = &Bitmap::getPixelR11G11B10F<Layout>;
 			break;
 		}
 	}
 
+	template <eBitmapLayout Layout>
 	void setPixelFloat(int x, int y, const glm::vec4& c)
 	{
-		const int ofs = comp_ * (y * w_ + x);
+		const size_t ofs = comp_ * addressing_.index<Layout>(x, y);
 		float* data = reinterpret_cast<float*>(data_.data());
 		if (comp_ > 0) data[ofs + 0] = c.x;
 		if (comp_ > 1) data[ofs + 1] = c.y;
 		if (comp_ > 2) data[ofs + 2] = c.z;
 		if (comp_ > 3) data[ofs + 3] = c.w;
 	}
+	template <eBitmapLayout Layout>
 	glm::vec4 getPixelFloat(int x, int y) const
 	{
-		const int ofs = comp_ * (y * w_ + x);
+		const size_t ofs = comp_ * addressing_.index<Layout>(x, y);
 		const float* data = reinterpret_cast<const float*>(data_.data());
 		return glm::vec4(
 			comp_ > 0 ? data[ofs + 0] : 0.0f,
@@ -101,21 +278,97 @@ private:
 			comp_ > 3 ? data[ofs + 3] : 0.0f);
 	}
 
+	template <eBitmapLayout Layout>
 	void setPixelUnsignedByte(int x, int y, const glm::vec4& c)
 	{
-		const int ofs = comp_ * (y * w_ + x);
+		const size_t ofs = comp_ * addressing_.index<Layout>(x, y);
 		if (comp_ > 0) data_[ofs + 0] = uint8_t(c.x * 255.0f);
 		if (comp_ > 1) data_[ofs + 1] = uint8_t(c.y * 255.0f);
 		if (comp_ > 2) data_[ofs + 2] = uint8_t(c.z * 255.0f);
 		if (comp_ > 3) data_[ofs + 3] = uint8_t(c.w * 255.0f);
 	}
+	template <eBitmapLayout Layout>
 	glm::vec4 getPixelUnsignedByte(int x, int y) const
 	{
-		const int ofs = comp_ * (y * w_ + x);
+		const size_t ofs = comp_ * addressing_.index<Layout>(x, y);
 		return glm::vec4(
 			comp_ > 0 ? float(data_[ofs + 0]) / 255.0f : 0.0f,
 			comp_ > 1 ? float(data_[ofs + 1]) / 255.0f : 0.0f,
 			comp_ > 2 ? float(data_[ofs + 2]) / 255.0f : 0.0f,
 			comp_ > 3 ? float(data_[ofs + 3]) / 255.0f : 0.0f);
 	}
+
+	template <eBitmapLayout Layout>
+	void setPixelHalfFloat(int x, int y, const glm::vec4& c)
+	{
+		const size_t ofs = comp_ * addressing_.index<Layout>(x, y);
+		uint16_t* data = reinterpret_cast<uint16_t*>(data_.data());
+		if (comp_ > 0) data[ofs + 0] = floatToHalf(c.x);
+		if (comp_ > 1) data[ofs + 1] = floatToHalf(c.y);
+		if (comp_ > 2) data[ofs + 2] = floatToHalf(c.z);
+		if (comp_ > 3) data[ofs + 3] = floatToHalf(c.w);
+	}
+	template <eBitmapLayout Layout>
+	glm::vec4 getPixelHalfFloat(int x, int y) const
+	{
+		const size_t ofs = comp_ * addressing_.index<Layout>(x, y);
+		const uint16_t* data = reinterpret_cast<const uint16_t*>(data_.data());
+		return glm::vec4(
+			comp_ > 0 ? halfToFloat(data[ofs + 0]) : 0.0f,
+			comp_ > 1 ? halfToFloat(data[ofs + 1]) : 0.0f,
+			comp_ > 2 ? halfToFloat(data[ofs + 2]) : 0.0f,
+			comp_ > 3 ? halfToFloat(data[ofs + 3]) : 0.0f);
+	}
+
+	template <eBitmapLayout Layout>
+	void setPixelUnsignedShort(int x, int y, const glm::vec4& c)
+	{
+		const size_t ofs = comp_ * addressing_.index<Layout>(x, y);
+		uint16_t* data = reinterpret_cast<uint16_t*>(data_.data());
+		if (comp_ > 0) data[ofs + 0] = floatToUnorm16(c.x);
+		if (comp_ > 1) data[ofs + 1] = floatToUnorm16(c.y);
+		if (comp_ > 2) data[ofs + 2] = floatToUnorm16(c.z);
+		if (comp_ > 3) data[ofs + 3] = floatToUnorm16(c.w);
+	}
+	template <eBitmapLayout Layout>
+	glm::vec4 getPixelUnsignedShort(int x, int y) const
+	{
+		const size_t ofs = comp_ * addressing_.index<Layout>(x, y);
+		const uint16_t* data = reinterpret_cast<const uint16_t*>(data_.data());
+		return glm::vec4(
+			comp_ > 0 ? unorm16ToFloat(data[ofs + 0]) : 0.0f,
+			comp_ > 1 ? unorm16ToFloat(data[ofs + 1]) : 0.0f,
+			comp_ > 2 ? unorm16ToFloat(data[ofs + 2]) : 0.0f,
+			comp_ > 3 ? unorm16ToFloat(data[ofs + 3]) : 0.0f);
+	}
+
+	template <eBitmapLayout Layout>
+	void setPixelRGB9E5(int x, int y, const glm::vec4& c)
+	{
+		uint32_t* data = reinterpret_cast<uint32_t*>(data_.data());
+		data[addressing_.index<Layout>(x, y)] = packRGB9E5(c.x, c.y, c.z);
+	}
+	template <eBitmapLayout Layout>
+	glm::vec4 getPixelRGB9E5(int x, int y) const
+	{
+		const uint32_t* data = reinterpret_cast<const uint32_t*>(data_.data());
+		glm::vec4 c(0.0f);
+		unpackRGB9E5(data[addressing_.index<Layout>(x, y)], c.x, c.y, c.z);
+		return c;
+	}
+
+	template <eBitmapLayout Layout>
+	void setPixelR11G11B10F(int x, int y, const glm::vec4& c)
+	{
+		uint32_t* data = reinterpret_cast<uint32_t*>(data_.data());
+		data[addressing_.index<Layout>(x, y)] = packR11G11B10F(c.x, c.y, c.z);
+	}
+	template <eBitmapLayout Layout>
+	glm::vec4 getPixelR11G11B10F(int x, int y) const
+	{
+		const uint32_t* data = reinterpret_cast<const uint32_t*>(data_.data());
+		glm::vec4 c(0.0f);
+		unpackR11G11B10F(data[addressing_.index<Layout>(x, y)], c.x, c.y, c.z);
+		return c;
+	}
 };
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+/// Scalar encoders/decoders of the 16-bit and packed Bitmap formats.
+/// The bulk converters in UtilsPixelFormat.cpp produce bit-identical results with SIMD,
+/// NaN payloads included (tests/PixelFormatTest.cpp).
+
+inline uint32_t floatBits(float f)
+{
+	uint32_t u;
+	memcpy(&u, &f, sizeof(u));
+	return u;
+}
+
+inline float bitsToFloat(uint32_t u)
+{
+	float f;
+	memcpy(&f, &u, sizeof(f));
+	return f;
+}
+
+/// IEEE half with round-to-nearest-even, same as F16C's _MM_FROUND_TO_NEAREST_INT
+inline uint16_t floatToHalf(float f)
+{
+	uint32_t x = floatBits(f);
+	const uint32_t sign = (x >> 16) & 0x8000;
+	x &= 0x7FFFFFFF;
+
+	uint32_t h;
+
+	if (x >= 0x47800000)
+	{
+		// overflow to infinity; NaN is quieted and keeps the top 10 payload bits, like F16C
+		h = x > 0x7F800000 ? 0x7E00 | ((x >> 13) & 0x3FF) : 0x7C00;
+	}
+	else if (x < 0x38800000)
+	{
+		// subnormal half: let the FPU round by aligning the mantissa with a magic exponent
+		const uint32_t kDenormMagic = ((127 - 15) + (23 - 10) + 1) << 23;
+		h = floatBits(bitsToFloat(x) + bitsToFloat(kDenormMagic)) - kDenormMagic;
+	}
+	else
+	{
+		const uint32_t mantissaOdd = (x >> 13) & 1;
+		x += ((uint32_t)(15 - 127) << 23) + 0xFFF;
+		x += mantissaOdd;
+		h = x >> 13;
+	}
+
+	return (uint16_t)(h | sign);
+}
+
+inline float halfToFloat(uint16_t h)
+{
+	const uint32_t kShiftedExp = 0x7C00 << 13;
+
+	uint32_t o = (uint32_t)(h & 0x7FFF) << 13;
+	const uint32_t exp = o & kShiftedExp;
+	o += (127 - 15) << 23;
+
+	if (exp == kShiftedExp)
+	{
+		// infinity or NaN, a signaling NaN is quieted like F16C does
+		o += (128 - 16) << 23;
+		if (h & 0x3FF)
+			o |= 0x400000;
+	}
+	else if (exp == 0)
+	{
+		// zero or subnormal: renormalize through the FPU
+		o += 1 << 23;
+		o = floatBits(bitsToFloat(o) - bitsToFloat(113 << 23));
+	}
+
+	return bitsToFloat(o | ((uint32_t)(h & 0x8000) << 16));
+}
+
+/// clamps to [0, maxValue], NaN becomes 0
+inline float clampPositive(float v, float maxValue)
+{
+	v = v > 0.0f ? v : 0.0f;
+	return v < maxValue ? v : maxValue;
+}
+
+inline uint8_t floatToUnorm8(float v)
+{
+	return (uint8_t)(clampPositive(v, 1.0f) * 255.0f + 0.5f);
+}
+
+inline float unorm8ToFloat(uint8_t v)
+{
+	return float(v) * (1.0f / 255.0f);
+}
+
+inline uint16_t floatToUnorm16(float v)
+{
+	return (uint16_t)(clampPositive(v, 1.0f) * 65535.0f + 0.5f);
+}
+
+inline float unorm16ToFloat(uint16_t v)
+{
+	return float(v) * (1.0f / 65535.0f);
+}
+
+/// GL_RGB9_E5 with GL_UNSIGNED_INT_5_9_9_9_REV layout: R in the low 9 bits, the shared exponent in the top 5 bits
+inline uint32_t packRGB9E5(float r, float g, float b)
+{
+	// (2^9 - 1) / 2^9 * 2^16
+	const float kMaxValue = 65408.0f;
+
+	r = clampPositive(r, kMaxValue);
+	g = clampPositive(g, kMaxValue);
+	b = clampPositive(b, kMaxValue);
+
+	const float maxc = r > g ? (r > b ? r : b) : (g > b ? g : b);
+
+	// floor(log2(maxc)) straight from the exponent bits, the bias is 15 and the mantissa has 9 bits
+	int exp = (int)(floatBits(maxc) >> 23) - 127;
+	exp = (exp > -16 ? exp : -16) + 16;
+
+	// 2^(24 - exp) is exact, so all the rounding happens in the + 0.5f
+	float scale = bitsToFloat((uint32_t)(151 - exp) << 23);
+
+	if ((uint32_t)(maxc * scale + 0.5f) == 512)
+	{
+		exp++;
+		scale *= 0.5f;
+	}
+
+	const uint32_t rm = (uint32_t)(r * scale + 0.5f);
+	const uint32_t gm = (uint32_t)(g * scale + 0.5f);
+	const uint32_t bm = (uint32_t)(b * scale + 0.5f);
+
+	return rm | (gm << 9) | (bm << 18) | ((uint32_t)exp << 27);
+}
+
+inline void unpackRGB9E5(uint32_t v, float& r, float& g, float& b)
+{
+	const float scale = bitsToFloat(((v >> 27) + 103) << 23);
+	r = float(v & 0x1FF) * scale;
+	g = float((v >> 9) & 0x1FF) * scale;
+	b = float((v >> 18) & 0x1FF) * scale;
+}
+
+/// GL_R11F_G11F_B10F with GL_UNSIGNED_INT_10F_11F_11F_REV layout: unsigned floats with a 5-bit exponent,
+/// i.e. a positive half with the low 4 (R, G) or 5 (B) mantissa bits dropped
+inline uint32_t packR11G11B10F(float r, float g, float b)
+{
+	const float kInf = bitsToFloat(0x7F800000);
+	const uint32_t rh = floatToHalf(clampPositive(r, kInf));
+	const uint32_t gh = floatToHalf(clampPositive(g, kInf));
+	const uint32_t bh = floatToHalf(clampPositive(b, kInf));
+	return (rh >> 4) | ((gh >> 4) << 11) | ((bh >> 5) << 22);
+}
+
+inline void unpackR11G11B10F(uint32_t v, float& r, float& g, float& b)
+{
+	r = halfToFloat((uint16_t)((v & 0x7FF) << 4));
+	g = halfToFloat((uint16_t)(((v >> 11) & 0x7FF) << 4));
+	b = halfToFloat((uint16_t)(((v >> 22) & 0x3FF) << 5));
+}
+
+/// Radiance RGBE: three 8-bit mantissas sharing an exponent biased by 128, decoded like stb_image
+inline void unpackRGBE(const uint8_t* rgbe, float& r, float& g, float& b)
+{
+	const float scale = rgbe[3] ? ldexpf(1.0f, rgbe[3] - 136) : 0.0f;
+	r = rgbe[0] * scale;
+	g = rgbe[1] * scale;
+	b = rgbe[2] * scale;
+}
@@ -0,0 +1,366 @@
+#pragma once
+
+#include <limits.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+#include "BitmapView.h"
+#include "UtilsSIMD.h"
+
+enum eBitmapFilter
+{
+	eBitmapFilter_Nearest,
+	eBitmapFilter_Bilinear,
+	eBitmapFilter_Bicubic, // Catmull-Rom, 4x4 taps
+};
+
+enum eBitmapWrap
+{
+	eBitmapWrap_Clamp,
+	eBitmapWrap_Repeat,
+	eBitmapWrap_Mirror,
+};
+
+inline int wrapBitmapCoord(int i, int size, eBitmapWrap wrap)
+{
+	switch (wrap)
+	{
+	case eBitmapWrap_Repeat:
+		i %= size;
+		return i < 0 ? i + size : i;
+	case eBitmapWrap_Mirror:
+		i %= 2 * size;
+		if (i < 0) i += 2 * size;
+		return i < size ? i : 2 * size - 1 - i;
+	default:
+		return i < 0 ? 0 : (i < size ? i : size - 1);
+	}
+}
+
+inline glm::vec4 getBicubicWeights(float t)
+{
+	const float t2 = t * t;
+	const float t3 = t2 * t;
+	return glm::vec4(
+		0.5f * (-t3 + 2.0f * t2 - t),
+		0.5f * (3.0f * t3 - 5.0f * t2 + 2.0f),
+		0.5f * (-3.0f * t3 + 4.0f * t2 + t),
+		0.5f * (t3 - t2));
+}
+
+/// Filtered reads from a Bitmap of a compile-time format, see dispatchBitmapFormat().
+/// Coordinates are in texels and integer coordinates hit texel centers.
+/// The batched calls gather 8 samples at once with AVX2 when the CPU has it; both paths
+/// evaluate the same operations in the same order, so their results are bit-identical.
+template <eBitmapFormat Format, int Comp, eBitmapLayout Layout = eBitmapLayout_Linear>
+class BitmapSampler
+{
+public:
+	explicit BitmapSampler(const Bitmap& b, eBitmapFilter filter = eBitmapFilter_Bilinear, eBitmapWrap wrapU = eBitmapWrap_Clamp, eBitmapWrap wrapV = eBitmapWrap_Clamp)
+	: view_(b), filter_(filter), wrapU_(wrapU), wrapV_(wrapV), useSIMD_(hasAVX2F16C() && b.data_.size() <= (size_t)INT_MAX - 3)
+	{
+	}
+
+	glm::vec4 sample(float x, float y) const
+	{
+		switch (filter_)
+		{
+		case eBitmapFilter_Nearest:
+			return fetch((int)floorf(x + 0.5f), (int)floorf(y + 0.5f));
+		case eBitmapFilter_Bilinear:
+		{
+			const float fx = floorf(x);
+			const float fy = floorf(y);
+			const float s = x - fx;
+			const float t = y - fy;
+			const int x0 = (int)fx;
+			const int y0 = (int)fy;
+			const glm::vec4 A = fetch(x0, y0);
+			const glm::vec4 B = fetch(x0 + 1, y0);
+			const glm::vec4 C = fetch(x0, y0 + 1);
+			const glm::vec4 D = fetch(x0 + 1, y0 + 1);
+			return A * (1 - s) * (1 - t) + B * s * (1 - t) + C * (1 - s) * t + D * s * t;
+		}
+		case eBitmapFilter_Bicubic:
+		{
+			const float fx = floorf(x);
+			const float fy = floorf(y);
+			const glm::vec4 wx = getBicubicWeights(x - fx);
+			const glm::vec4 wy = getBicubicWeights(y - fy);
+			const int x0 = (int)fx - 1;
+			const int y0 = (int)fy - 1;
+			glm::vec4 color(0.0f);
+			for (int j = 0; j != 4; j++)
+			{
+				glm::vec4 row(0.0f);
+				for (int i = 0; i != 4; i++)
+					row += fetch(x0 + i, y0 + j) * wx[i];
+				color += row * wy[j];
+			}
+			return color;
+		}
+		}
+		return glm::vec4(0.0f);
+	}
+
+	void sample4(const float* x, const float* y, glm::vec4* out) const
+	{
+#if defined(UTILS_SIMD_X86)
+		if (useSIMD_)
+		{
+			// the upper half of the batch repeats the lower half
+			const float x8[8] = { x[0], x[1], x[2], x[3], x[0], x[1], x[2], x[3] };
+			const float y8[8] = { y[0], y[1], y[2], y[3], y[0], y[1], y[2], y[3] };
+			glm::vec4 out8[8];
+			sample8AVX2(x8, y8, out8);
+			for (int i = 0; i != 4; i++)
+				out[i] = out8[i];
+			return;
+		}
+#endif
+		for (int i = 0; i != 4; i++)
+			out[i] = sample(x[i], y[i]);
+	}
+
+	void sample8(const float* x, const float* y, glm::vec4* out) const
+	{
+#if defined(UTILS_SIMD_X86)
+		if (useSIMD_)
+		{
+			sample8AVX2(x, y, out);
+			return;
+		}
+#endif
+		for (int i = 0; i != 8; i++)
+			out[i] = sample(x[i], y[i]);
+	}
+
+	/// any number of samples, in batches of 8
+	void sample(const float* x, const float* y, glm::vec4* out, size_t count) const
+	{
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8)
+			sample8(x + i, y + i, out + i);
+		for (; i != count; i++)
+			out[i] = sample(x[i], y[i]);
+	}
+
+private:
+	glm::vec4 fetch(int x, int y) const
+	{
+		return view_.getPixel(wrapBitmapCoord(x, view_.w_, wrapU_), wrapBitmapCoord(y, view_.h_, wrapV_));
+	}
+
+#if defined(UTILS_SIMD_X86)
+	struct Texels8
+	{
+		__m256 c[4];
+	};
+
+	UTILS_SIMD_TARGET_AVX2 static __m256i wrap8(__m256i i, int size, eBitmapWrap wrap)
+	{
+		const __m256i zero = _mm256_setzero_si256();
+
+		if (wrap == eBitmapWrap_Clamp)
+			return _mm256_min_epi32(_mm256_max_epi32(i, zero), _mm256_set1_epi32(size - 1));
+
+		// there is no integer division: estimate the quotient in float and fix the remainder up
+		const int period = wrap == eBitmapWrap_Repeat ? size : 2 * size;
+		const __m256i p = _mm256_set1_epi32(period);
+		const __m256 q = _mm256_floor_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(i), _mm256_set1_ps(1.0f / period)));
+		__m256i r = _mm256_sub_epi32(i, _mm256_mullo_epi32(_mm256_cvttps_epi32(q), p));
+		r = _mm256_add_epi32(r, _mm256_and_si256(_mm256_cmpgt_epi32(zero, r), p));
+		r = _mm256_sub_epi32(r, _mm256_andnot_si256(_mm256_cmpgt_epi32(p, r), p));
+
+		if (wrap == eBitmapWrap_Repeat)
+			return r;
+
+		const __m256i s = _mm256_set1_epi32(size);
+		const __m256i mirrored = _mm256_sub_epi32(_mm256_set1_epi32(2 * size - 1), r);
+		return _mm256_blendv_epi8(mirrored, r, _mm256_cmpgt_epi32(s, r));
+	}
+
+	UTILS_SIMD_TARGET_AVX2 static __m256i mortonPart1By1x8(__m256i x)
+	{
+		x = _mm256_and_si256(x, _mm256_set1_epi32(0x0000FFFF));
+		x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi32(x, 8)), _mm256_set1_epi32(0x00FF00FF));
+		x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi32(x, 4)), _mm256_set1_epi32(0x0F0F0F0F));
+		x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi32(x, 2)), _mm256_set1_epi32(0x33333333));
+		x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi32(x, 1)), _mm256_set1_epi32(0x55555555));
+		return x;
+	}
+
+	/// vector version of BitmapAddressing::index<Layout>()
+	UTILS_SIMD_TARGET_AVX2 __m256i index8(__m256i x, __m256i y) const
+	{
+		const BitmapAddressing& a = view_.addressing_;
+
+		if (Layout == eBitmapLayout_Tiled)
+		{
+			const __m256i seven = _mm256_set1_epi32(7);
+			const __m256i tile = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(y, 3), _mm256_set1_epi32(a.tilesX_)), _mm256_srli_epi32(x, 3));
+			const __m256i inner = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(y, seven), 3), _mm256_and_si256(x, seven));
+			return _mm256_add_epi32(_mm256_slli_epi32(tile, 6), inner);
+		}
+
+		if (Layout == eBitmapLayout_Morton)
+		{
+			const __m128i shift = _mm_cvtsi32_si128(a.blockShift_);
+			const __m256i mask = _mm256_set1_epi32((1 << a.blockShift_) - 1);
+			const __m256i block = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srl_epi32(y, shift), _mm256_set1_epi32(a.blocksX_)), _mm256_srl_epi32(x, shift));
+			const __m256i inner = _mm256_or_si256(mortonPart1By1x8(_mm256_and_si256(x, mask)), _mm256_slli_epi32(mortonPart1By1x8(_mm256_and_si256(y, mask)), 1));
+			return _mm256_add_epi32(_mm256_sll_epi32(block, _mm_cvtsi32_si128(2 * a.blockShift_)), inner);
+		}
+
+		return _mm256_add_epi32(_mm256_mullo_epi32(y, _mm256_set1_epi32(a.w_)), x);
+	}
+
+	/// gathers and decodes 8 texels at wrapped coordinates, the same conversions as BitmapFormatTraits
+	UTILS_SIMD_TARGET_AVX2 Texels8 fetch8(__m256i x, __m256i y) const
+	{
+		const __m256i index = _mm256_mullo_epi32(index8(wrap8(x, view_.w_, wrapU_), wrap8(y, view_.h_, wrapV_)), _mm256_set1_epi32(Comp));
+
+		Texels8 t;
+		for (int k = 0; k != 4; k++)
+			t.c[k] = _mm256_setzero_ps();
+
+		if (Format == eBitmapFormat_Float)
+		{
+			const float* data = reinterpret_cast<const float*>(view_.data_);
+			for (int k = 0; k != Comp; k++)
+				t.c[k] = _mm256_i32gather_ps(data, _mm256_add_epi32(index, _mm256_set1_epi32(k)), 4);
+			return t;
+		}
+
+		// 8- and 16-bit components: gather the aligned 32-bit word holding each one, so no read crosses the end of the buffer
+		const int bytesPerComponent = Format == eBitmapFormat_UnsignedByte ? 1 : 2;
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(view_.data_);
+		const int misalignment = (int)(reinterpret_cast<uintptr_t>(bytes) & 3);
+		const int* words = reinterpret_cast<const int*>(bytes - misalignment);
+
+		for (int k = 0; k != Comp; k++)
+		{
+			const __m256i element = _mm256_add_epi32(index, _mm256_set1_epi32(k));
+			const __m256i offset = _mm256_add_epi32(_mm256_mullo_epi32(element, _mm256_set1_epi32(bytesPerComponent)), _mm256_set1_epi32(misalignment));
+			const __m256i word = _mm256_i32gather_epi32(words, _mm256_srli_epi32(offset, 2), 4);
+			const __m256i shifted = _mm256_srlv_epi32(word, _mm256_slli_epi32(_mm256_and_si256(offset, _mm256_set1_epi32(3)), 3));
+
+			if (Format == eBitmapFormat_UnsignedByte)
+			{
+				const __m256i v = _mm256_and_si256(shifted, _mm256_set1_epi32(0xFF));
+				t.c[k] = _mm256_div_ps(_mm256_cvtepi32_ps(v), _mm256_set1_ps(255.0f));
+			}
+			else
+			{
+				const __m256i v = _mm256_and_si256(shifted, _mm256_set1_epi32(0xFFFF));
+				if (Format == eBitmapFormat_HalfFloat)
+					t.c[k] = _mm256_cvtph_ps(_mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+				else
+					t.c[k] = _mm256_mul_ps(_mm256_cvtepi32_ps(v), _mm256_set1_ps(1.0f / 65535.0f));
+			}
+		}
+		return t;
+	}
+
+	UTILS_SIMD_TARGET_AVX2 void sample8AVX2(const float* px, const float* py, glm::vec4* out) const
+	{
+		const __m256 x = _mm256_loadu_ps(px);
+		const __m256 y = _mm256_loadu_ps(py);
+		const __m256 one = _mm256_set1_ps(1.0f);
+		const __m256i ione = _mm256_set1_epi32(1);
+
+		__m256 color[4];
+
+		if (filter_ == eBitmapFilter_Nearest)
+		{
+			const __m256 half = _mm256_set1_ps(0.5f);
+			const Texels8 t = fetch8(
+				_mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(x, half))),
+				_mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(y, half))));
+			for (int k = 0; k != 4; k++)
+				color[k] = t.c[k];
+		}
+		else if (filter_ == eBitmapFilter_Bilinear)
+		{
+			const __m256 fx = _mm256_floor_ps(x);
+			const __m256 fy = _mm256_floor_ps(y);
+			const __m256 s = _mm256_sub_ps(x, fx);
+			const __m256 t = _mm256_sub_ps(y, fy);
+			const __m256 s1 = _mm256_sub_ps(one, s);
+			const __m256 t1 = _mm256_sub_ps(one, t);
+			const __m256i x0 = _mm256_cvttps_epi32(fx);
+			const __m256i y0 = _mm256_cvttps_epi32(fy);
+			const __m256i x1 = _mm256_add_epi32(x0, ione);
+			const __m256i y1 = _mm256_add_epi32(y0, ione);
+			const Texels8 A = fetch8(x0, y0);
+			const Texels8 B = fetch8(x1, y0);
+			const Texels8 C = fetch8(x0, y1);
+			const Texels8 D = fetch8(x1, y1);
+			for (int k = 0; k != 4; k++)
+			{
+				__m256 c = _mm256_mul_ps(_mm256_mul_ps(A.c[k], s1), t1);
+				c = _mm256_add_ps(c, _mm256_mul_ps(_mm256_mul_ps(B.c[k], s), t1));
+				c = _mm256_add_ps(c, _mm256_mul_ps(_mm256_mul_ps(C.c[k], s1), t));
+				c = _mm256_add_ps(c, _mm256_mul_ps(_mm256_mul_ps(D.c[k], s), t));
+				color[k] = c;
+			}
+		}
+		else
+		{
+			const __m256 fx = _mm256_floor_ps(x);
+			const __m256 fy = _mm256_floor_ps(y);
+			__m256 wx[4], wy[4];
+			getBicubicWeights8(_mm256_sub_ps(x, fx), wx);
+			getBicubicWeights8(_mm256_sub_ps(y, fy), wy);
+			const __m256i x0 = _mm256_sub_epi32(_mm256_cvttps_epi32(fx), ione);
+			const __m256i y0 = _mm256_sub_epi32(_mm256_cvttps_epi32(fy), ione);
+
+			for (int k = 0; k != 4; k++)
+				color[k] = _mm256_setzero_ps();
+
+			for (int j = 0; j != 4; j++)
+			{
+				__m256 row[4] = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() };
+				const __m256i yj = _mm256_add_epi32(y0, _mm256_set1_epi32(j));
+				for (int i = 0; i != 4; i++)
+				{
+					const Texels8 tap = fetch8(_mm256_add_epi32(x0, _mm256_set1_epi32(i)), yj);
+					for (int k = 0; k != 4; k++)
+						row[k] = _mm256_add_ps(row[k], _mm256_mul_ps(tap.c[k], wx[i]));
+				}
+				for (int k = 0; k != 4; k++)
+					color[k] = _mm256_add_ps(color[k], _mm256_mul_ps(row[k], wy[j]));
+			}
+		}
+
+		float c[4][8];
+		for (int k = 0; k != 4; k++)
+			_mm256_storeu_ps(c[k], color[k]);
+		for (int i = 0; i != 8; i++)
+			out[i] = glm::vec4(c[0][i], c[1][i], c[2][i], c[3][i]);
+	}
+
+	/// same operation order as getBicubicWeights()
+	UTILS_SIMD_TARGET_AVX2 static void getBicubicWeights8(__m256 t, __m256* w)
+	{
+		const __m256 half = _mm256_set1_ps(0.5f);
+		const __m256 t2 = _mm256_mul_ps(t, t);
+		const __m256 t3 = _mm256_mul_ps(t2, t);
+		const __m256 negT3 = _mm256_sub_ps(_mm256_setzero_ps(), t3);
+		w[0] = _mm256_mul_ps(half, _mm256_sub_ps(_mm256_add_ps(negT3, _mm256_mul_ps(_mm256_set1_ps(2.0f), t2)), t));
+		w[1] = _mm256_mul_ps(half, _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(3.0f), t3), _mm256_mul_ps(_mm256_set1_ps(5.0f), t2)), _mm256_set1_ps(2.0f)));
+		w[2] = _mm256_mul_ps(half, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(-3.0f), t3), _mm256_mul_ps(_mm256_set1_ps(4.0f), t2)), t));
+		w[3] = _mm256_mul_ps(half, _mm256_sub_ps(t3, t2));
+	}
+#endif
+
+	ConstBitmapView<Format, Comp, Layout> view_;
+	eBitmapFilter filter_;
+	eBitmapWrap wrapU_;
+	eBitmapWrap wrapV_;
+	// the gathers take 32-bit offsets, bigger bitmaps are sampled by the scalar path
+	bool useSIMD_;
+};
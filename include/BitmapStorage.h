@@ -0,0 +1,492 @@
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#	define BITMAP_STORAGE_MMAP 1
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
+
+enum eBitmapStorage
+{
+	eBitmapStorage_Heap,
+	eBitmapStorage_Anonymous, // private anonymous mapping, backed by transparent huge pages where the kernel allows
+	eBitmapStorage_File,      // shared mapping of an unlinked temporary file, the kernel writes cold pages back to it instead of keeping them resident
+	eBitmapStorage_External,  // memory owned by someone else: a borrowed or adopted buffer or a BitmapArena block
+};
+
+enum eBitmapAccess
+{
+	eBitmapAccess_Normal,
+	eBitmapAccess_Sequential,
+	eBitmapAccess_Random,
+	eBitmapAccess_WillNeed,
+};
+
+/// Decides where BitmapStorage allocations without an explicit type go
+struct BitmapStoragePolicy
+{
+	/// allocations of at least this many bytes are mapped instead of taken from the heap
+	size_t mappingThreshold = 32u << 20;
+	eBitmapStorage largeStorage = eBitmapStorage_Anonymous;
+	/// directory of the eBitmapStorage_File backing files, empty means $TMPDIR or /tmp
+	std::string tempDirectory;
+};
+
+class BitmapArena;
+
+/// Zero-initialized byte buffer of Bitmap::data_ with the part of the std::vector interface the
+/// code base uses. Large buffers are mmapped so they are populated lazily, can use huge pages
+/// (fewer TLB misses in the scattered cube map fetches) and can be paged out to a file.
+/// Platforms without mmap always use the heap.
+/// Inside the scope of a BitmapArena default allocations are served by the arena instead.
+class BitmapStorage
+{
+public:
+	BitmapStorage() = default;
+	explicit BitmapStorage(size_t size);
+	BitmapStorage(size_t size, eBitmapStorage type)
+	{
+		allocate(size, type);
+	}
+	/// copies of external memory are owned by the copy
+	BitmapStorage(const BitmapStorage& other);
+	BitmapStorage(BitmapStorage&& other) noexcept
+	{
+		swap(other);
+	}
+	~BitmapStorage()
+	{
+		release();
+	}
+
+	BitmapStorage& operator=(const BitmapStorage& other)
+	{
+		if (this != &other)
+		{
+			BitmapStorage tmp(other);
+			swap(tmp);
+		}
+		return *this;
+	}
+	BitmapStorage& operator=(BitmapStorage&& other) noexcept
+	{
+		BitmapStorage tmp(std::move(other));
+		swap(tmp);
+		return *this;
+	}
+
+	void swap(BitmapStorage& other) noexcept
+	{
+		std::swap(data_, other.data_);
+		std::swap(size_, other.size_);
+		std::swap(mappedSize_, other.mappedSize_);
+		std::swap(type_, other.type_);
+		std::swap(external_, other.external_);
+	}
+
+	/// non-owning view of memory which has to outlive the storage
+	static BitmapStorage borrow(void* ptr, size_t size)
+	{
+		BitmapStorage storage;
+		storage.data_ = static_cast<uint8_t*>(ptr);
+		storage.size_ = size;
+		storage.type_ = eBitmapStorage_External;
+		return storage;
+	}
+
+	/// takes ownership of a buffer which is released with deleter(ptr), e.g. stbi_image_free
+	static BitmapStorage adopt(void* ptr, size_t size, void (*deleter)(void*))
+	{
+		BitmapStorage storage = borrow(ptr, size);
+		storage.external_ = std::shared_ptr<void>(ptr, deleter);
+		return storage;
+	}
+
+	/// Read-only view of a whole file: a private mapping where mmap is available, else a heap copy.
+	/// Pages are read on first access, so mapping a cache file costs next to nothing. Empty if the file cannot be read.
+	static BitmapStorage mapFile(const char* fileName)
+	{
+#if defined(BITMAP_STORAGE_MMAP)
+		const int fd = open(fileName, O_RDONLY);
+		if (fd < 0)
+			return BitmapStorage();
+
+		struct stat st;
+		void* ptr = MAP_FAILED;
+		const size_t size = fstat(fd, &st) == 0 ? (size_t)st.st_size : 0;
+		if (size)
+			ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+
+		if (ptr == MAP_FAILED)
+			return BitmapStorage();
+
+		BitmapStorage storage = borrow(ptr, size);
+		storage.external_ = std::shared_ptr<void>(ptr, [size](void* p) { munmap(p, size); });
+		return storage;
+#else
+		FILE* f = fopen(fileName, "rb");
+		if (!f)
+			return BitmapStorage();
+
+		fseek(f, 0, SEEK_END);
+		const long size = ftell(f);
+		fseek(f, 0, SEEK_SET);
+
+		void* ptr = size > 0 ? malloc((size_t)size) : nullptr;
+		BitmapStorage storage = ptr ? adopt(ptr, (size_t)size, free) : BitmapStorage();
+		if (ptr && fread(storage.data(), 1, storage.size(), f) != storage.size())
+			storage = BitmapStorage();
+		fclose(f);
+
+		return storage;
+#endif
+	}
+
+	/// Read-only window into mapped or adopted memory which keeps the whole buffer alive, e.g. the pixels behind the header of a mapFile()
+	BitmapStorage view(size_t offset, size_t size) const
+	{
+		assert(type_ == eBitmapStorage_External && external_ && offset + size <= size_);
+
+		BitmapStorage storage = borrow(data_ + offset, size);
+		storage.external_ = external_;
+		return storage;
+	}
+
+	uint8_t* data() { return data_; }
+	const uint8_t* data() const { return data_; }
+	size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+	eBitmapStorage getType() const { return type_; }
+
+	uint8_t& operator[](size_t i) { return data_[i]; }
+	const uint8_t& operator[](size_t i) const { return data_[i]; }
+
+	/// keeps the contents up to the new size, new bytes are zero
+	void resize(size_t size)
+	{
+		if (size == size_)
+			return;
+
+		BitmapStorage tmp(size, size_ && type_ != eBitmapStorage_External ? type_ : getDefaultStorage(size));
+		if (size_ && size) memcpy(tmp.data_, data_, std::min(size, size_));
+		swap(tmp);
+	}
+
+	/// madvise() hint for the whole buffer, a no-op for heap storage
+	void advise(eBitmapAccess access) const
+	{
+#if defined(BITMAP_STORAGE_MMAP)
+		if (!mappedSize_)
+			return;
+
+		int advice = MADV_NORMAL;
+		switch (access)
+		{
+		case eBitmapAccess_Normal: advice = MADV_NORMAL; break;
+		case eBitmapAccess_Sequential: advice = MADV_SEQUENTIAL; break;
+		case eBitmapAccess_Random: advice = MADV_RANDOM; break;
+		case eBitmapAccess_WillNeed: advice = MADV_WILLNEED; break;
+		}
+		madvise(data_, mappedSize_, advice);
+#else
+		(void)access;
+#endif
+	}
+
+	/// set once at startup, before images are created on other threads
+	static BitmapStoragePolicy& getPolicy()
+	{
+		static BitmapStoragePolicy policy;
+		return policy;
+	}
+
+	static eBitmapStorage getDefaultStorage(size_t size)
+	{
+		const BitmapStoragePolicy& policy = getPolicy();
+		return size >= policy.mappingThreshold ? policy.largeStorage : eBitmapStorage_Heap;
+	}
+
+private:
+	void allocate(size_t size, eBitmapStorage type)
+	{
+		size_ = size;
+		type_ = type;
+
+		if (!size)
+			return;
+
+		assert(type != eBitmapStorage_External);
+
+#if defined(BITMAP_STORAGE_MMAP)
+		if (type == eBitmapStorage_Anonymous && mapAnonymous(size))
+			return;
+		if (type == eBitmapStorage_File && mapTempFile(size))
+			return;
+#endif
+
+		// calloc() of a large block is lazily zeroed by the OS as well
+		type_ = eBitmapStorage_Heap;
+		data_ = static_cast<uint8_t*>(calloc(size, 1));
+		if (!data_)
+			throw std::bad_alloc();
+	}
+
+	void release()
+	{
+		if (type_ == eBitmapStorage_External)
+			external_.reset();
+#if defined(BITMAP_STORAGE_MMAP)
+		else if (mappedSize_)
+			munmap(data_, mappedSize_);
+#endif
+		else
+			free(data_);
+
+		data_ = nullptr;
+		size_ = 0;
+		mappedSize_ = 0;
+	}
+
+#if defined(BITMAP_STORAGE_MMAP)
+	bool mapAnonymous(size_t size)
+	{
+		const size_t kHugePageSize = 2u << 20;
+		const size_t mappedSize = (size + kHugePageSize - 1) & ~(kHugePageSize - 1);
+
+		// over-allocate to place the buffer on a huge page boundary and trim the rest
+		void* ptr = mmap(nullptr, mappedSize + kHugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ptr == MAP_FAILED)
+			return false;
+
+		uint8_t* base = static_cast<uint8_t*>(ptr);
+		uint8_t* aligned = reinterpret_cast<uint8_t*>((reinterpret_cast<uintptr_t>(base) + kHugePageSize - 1) & ~(uintptr_t)(kHugePageSize - 1));
+		if (aligned != base)
+			munmap(base, aligned - base);
+		const size_t tail = (base + mappedSize + kHugePageSize) - (aligned + mappedSize);
+		if (tail)
+			munmap(aligned + mappedSize, tail);
+
+#if defined(MADV_HUGEPAGE)
+		madvise(aligned, mappedSize, MADV_HUGEPAGE);
+#endif
+
+		data_ = aligned;
+		mappedSize_ = mappedSize;
+		return true;
+	}
+
+	bool mapTempFile(size_t size)
+	{
+		std::string path = getPolicy().tempDirectory;
+		if (path.empty())
+		{
+			const char* tmp = getenv("TMPDIR");
+			path = tmp && *tmp ? tmp : "/tmp";
+		}
+		path += "/bitmapXXXXXX";
+
+		const int fd = mkstemp(&path[0]);
+		if (fd < 0)
+			return false;
+
+		// the file disappears with the mapping
+		unlink(path.c_str());
+
+		void* ptr = MAP_FAILED;
+		if (ftruncate(fd, (off_t)size) == 0)
+			ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+
+		if (ptr == MAP_FAILED)
+			return false;
+
+		data_ = static_cast<uint8_t*>(ptr);
+		mappedSize_ = size;
+		return true;
+	}
+#endif
+
+	uint8_t* data_ = nullptr;
+	size_t size_ = 0;
+	size_t mappedSize_ = 0; // 0 for heap memory
+	eBitmapStorage type_ = eBitmapStorage_Heap;
+	// releases external memory, empty for borrowed buffers
+	std::shared_ptr<void> external_;
+
+	friend class BitmapArena;
+};
+
+/// Scoped recycler of Bitmap memory. While an arena is alive, default allocations on its thread
+/// take the best-fitting block released by an earlier Bitmap, so a chain of conversion stages
+/// (or a batch of jobs) peaks at the working set of one stage instead of the sum of all of them.
+/// Bitmaps may outlive the arena, their blocks are freed instead of recycled then.
+class BitmapArena
+{
+public:
+	BitmapArena()
+	: state_(std::make_shared<State>()), previous_(current())
+	{
+		current() = this;
+	}
+	~BitmapArena()
+	{
+		assert(current() == this);
+		current() = previous_;
+
+		// blocks still in use are freed by their last Bitmap from now on
+		std::vector<BitmapStorage> blocks;
+		std::lock_guard<std::mutex> lock(state_->mutex);
+		state_->alive = false;
+		blocks.swap(state_->freeBlocks);
+		for (const BitmapStorage& b : blocks)
+			state_->reservedBytes -= b.size();
+	}
+
+	BitmapArena(const BitmapArena&) = delete;
+	BitmapArena& operator=(const BitmapArena&) = delete;
+
+	/// zero-initialized like any other BitmapStorage
+	BitmapStorage allocate(size_t size)
+	{
+		BitmapStorage block;
+		{
+			std::lock_guard<std::mutex> lock(state_->mutex);
+
+			size_t best = state_->freeBlocks.size();
+			for (size_t i = 0; i != state_->freeBlocks.size(); i++)
+			{
+				const size_t capacity = state_->freeBlocks[i].size();
+				if (capacity >= size && (best == state_->freeBlocks.size() || capacity < state_->freeBlocks[best].size()))
+					best = i;
+			}
+
+			if (best != state_->freeBlocks.size())
+			{
+				block.swap(state_->freeBlocks[best]);
+				state_->freeBlocks.erase(state_->freeBlocks.begin() + best);
+				state_->usedBytes += block.size();
+			}
+		}
+
+		if (block.empty())
+		{
+			block = BitmapStorage(size, BitmapStorage::getDefaultStorage(size));
+			std::lock_guard<std::mutex> lock(state_->mutex);
+			state_->usedBytes += block.size();
+			state_->reservedBytes += block.size();
+		}
+		else
+		{
+			memset(block.data(), 0, size);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(state_->mutex);
+			state_->peakBytes = std::max(state_->peakBytes, state_->usedBytes);
+		}
+
+		// the block goes back to the free list when the Bitmap releases it, or is freed once the arena is gone
+		BitmapStorage* owned = new BitmapStorage(std::move(block));
+		const std::shared_ptr<State> state = state_;
+		BitmapStorage storage = BitmapStorage::borrow(owned->data(), size);
+		storage.external_ = std::shared_ptr<void>(owned, [state](void* p)
+		{
+			BitmapStorage* b = static_cast<BitmapStorage*>(p);
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				state->usedBytes -= b->size();
+				if (state->alive)
+				{
+					state->freeBlocks.push_back(std::move(*b));
+				}
+				else
+				{
+					state->reservedBytes -= b->size();
+				}
+			}
+			delete b;
+		});
+		return storage;
+	}
+
+	/// frees all blocks which are not in use
+	void trim()
+	{
+		std::vector<BitmapStorage> blocks;
+		std::lock_guard<std::mutex> lock(state_->mutex);
+		blocks.swap(state_->freeBlocks);
+		for (const BitmapStorage& b : blocks)
+			state_->reservedBytes -= b.size();
+	}
+
+	/// bytes held by the arena, in use or free
+	size_t getReservedBytes() const
+	{
+		std::lock_guard<std::mutex> lock(state_->mutex);
+		return state_->reservedBytes;
+	}
+	/// the largest amount of memory in use at the same time
+	size_t getPeakBytes() const
+	{
+		std::lock_guard<std::mutex> lock(state_->mutex);
+		return state_->peakBytes;
+	}
+
+	/// innermost arena of the calling thread, nullptr outside of any arena scope
+	static BitmapArena*& current()
+	{
+		static thread_local BitmapArena* arena = nullptr;
+		return arena;
+	}
+
+private:
+	// shared with the outstanding blocks, which can outlive the arena
+	struct State
+	{
+		mutable std::mutex mutex;
+		std::vector<BitmapStorage> freeBlocks;
+		size_t usedBytes = 0;
+		size_t reservedBytes = 0;
+		size_t peakBytes = 0;
+		bool alive = true;
+	};
+
+	std::shared_ptr<State> state_;
+	BitmapArena* previous_;
+};
+
+inline BitmapStorage::BitmapStorage(size_t size)
+{
+	if (size && BitmapArena::current())
+		*this = BitmapArena::current()->allocate(size);
+	else
+		allocate(size, getDefaultStorage(size));
+}
+
+inline BitmapStorage::BitmapStorage(const BitmapStorage& other)
+{
+	if (other.type_ == eBitmapStorage_External || BitmapArena::current())
+		*this = BitmapStorage(other.size_);
+	else
+		allocate(other.size_, other.type_);
+
+	if (size_) memcpy(data_, other.data_, size_);
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+#include "Bitmap.h"
+
+/// Compile-time pixel access for Bitmap.
+/// Bitmap::getPixel()/setPixel() dispatch through member-function pointers and test comp_ for
+/// every component. Kernels templated on <Format, Comp> use the views below instead and are
+/// selected once per image with dispatchBitmapFormat(), so their inner loops are branch-free.
+/// Views of tiled or Morton bitmaps carry the layout as a template parameter as well.
+
+template <eBitmapFormat Format> struct BitmapFormatTraits;
+
+template <> struct BitmapFormatTraits<eBitmapFormat_UnsignedByte>
+{
+	using Component = uint8_t;
+	static float toFloat(uint8_t v) { return float(v) / 255.0f; }
+	static uint8_t fromFloat(float v) { return uint8_t(v * 255.0f); }
+};
+
+template <> struct BitmapFormatTraits<eBitmapFormat_Float>
+{
+	using Component = float;
+	static float toFloat(float v) { return v; }
+	static float fromFloat(float v) { return v; }
+};
+
+template <> struct BitmapFormatTraits<eBitmapFormat_HalfFloat>
+{
+	using Component = uint16_t;
+	static float toFloat(uint16_t v) { return halfToFloat(v); }
+	static uint16_t fromFloat(float v) { return floatToHalf(v); }
+};
+
+template <> struct BitmapFormatTraits<eBitmapFormat_UnsignedShort>
+{
+	using Component = uint16_t;
+	static float toFloat(uint16_t v) { return unorm16ToFloat(v); }
+	static uint16_t fromFloat(float v) { return floatToUnorm16(v); }
+};
+
+// Packed formats have no per-component traits: convert them with convertBitmapFormat() first.
+
+template <eBitmapFormat Format, int Comp, eBitmapLayout Layout = eBitmapLayout_Linear>
+struct BitmapView
+{
+	using Traits = BitmapFormatTraits<Format>;
+	using Component = typename Traits::Component;
+
+	BitmapView(Component* data, int w, int h) : data_(data), w_(w), h_(h), addressing_(Layout, w, h) {}
+	explicit BitmapView(Bitmap& b)
+	: BitmapView(reinterpret_cast<Component*>(b.data_.data()), b.w_, b.h_)
+	{
+		assert(b.fmt_ == Format && b.comp_ == Comp && b.getLayout() == Layout);
+	}
+
+	/// w_ * Comp components of row y, only linear bitmaps have contiguous rows
+	Component* row(int y) const
+	{
+		static_assert(Layout == eBitmapLayout_Linear, "row() requires a linear layout");
+		return data_ + (size_t)y * w_ * Comp;
+	}
+
+	glm::vec4 getPixel(int x, int y) const
+	{
+		const Component* p = data_ + Comp * addressing_.index<Layout>(x, y);
+		return glm::vec4(
+			Comp > 0 ? Traits::toFloat(p[0]) : 0.0f,
+			Comp > 1 ? Traits::toFloat(p[1]) : 0.0f,
+			Comp > 2 ? Traits::toFloat(p[2]) : 0.0f,
+			Comp > 3 ? Traits::toFloat(p[3]) : 0.0f);
+	}
+	void setPixel(int x, int y, const glm::vec4& c) const
+	{
+		Component* p = data_ + Comp * addressing_.index<Layout>(x, y);
+		if (Comp > 0) p[0] = Traits::fromFloat(c.x);
+		if (Comp > 1) p[1] = Traits::fromFloat(c.y);
+		if (Comp > 2) p[2] = Traits::fromFloat(c.z);
+		if (Comp > 3) p[3] = Traits::fromFloat(c.w);
+	}
+
+	Component* data_;
+	int w_;
+	int h_;
+	BitmapAddressing addressing_;
+};
+
+template <eBitmapFormat Format, int Comp, eBitmapLayout Layout = eBitmapLayout_Linear>
+struct ConstBitmapView
+{
+	using Traits = BitmapFormatTraits<Format>;
+	using Component = typename Traits::Component;
+
+	ConstBitmapView(const Component* data, int w, int h) : data_(data), w_(w), h_(h), addressing_(Layout, w, h) {}
+	explicit ConstBitmapView(const Bitmap& b)
+	: ConstBitmapView(reinterpret_cast<const Component*>(b.data_.data()), b.w_, b.h_)
+	{
+		assert(b.fmt_ == Format && b.comp_ == Comp && b.getLayout() == Layout);
+	}
+
+	const Component* row(int y) const
+	{
+		static_assert(Layout == eBitmapLayout_Linear, "row() requires a linear layout");
+		return data_ + (size_t)y * w_ * Comp;
+	}
+
+	glm::vec4 getPixel(int x, int y) const
+	{
+		const Component* p = data_ + Comp * addressing_.index<Layout>(x, y);
+		return glm::vec4(
+			Comp > 0 ? Traits::toFloat(p[0]) : 0.0f,
+			Comp > 1 ? Traits::toFloat(p[1]) : 0.0f,
+			Comp > 2 ? Traits::toFloat(p[2]) : 0.0f,
+			Comp > 3 ? Traits::toFloat(p[3]) : 0.0f);
+	}
+
+	const Component* data_;
+	int w_;
+	int h_;
+	BitmapAddressing addressing_;
+};
+
+template <eBitmapFormat Format, int Comp, eBitmapLayout Layout = eBitmapLayout_Linear>
+struct BitmapFormatTag {};
+
+template <eBitmapLayout Layout, typename Func>
+void dispatchBitmapFormatForLayout(eBitmapFormat fmt, int comp, const Func& f)
+{
+	switch (fmt)
+	{
+	case eBitmapFormat_UnsignedByte:
+		switch (comp)
+		{
+		case 1: f(BitmapFormatTag<eBitmapFormat_UnsignedByte, 1, Layout>()); return;
+		case 2: f(BitmapFormatTag<eBitmapFormat_UnsignedByte, 2, Layout>()); return;
+		case 3: f(BitmapFormatTag<eBitmapFormat_UnsignedByte, 3, Layout>()); return;
+		case 4: f(BitmapFormatTag<eBitmapFormat_UnsignedByte, 4, Layout>()); return;
+		}
+		break;
+	case eBitmapFormat_Float:
+		switch (comp)
+		{
+		case 1: f(BitmapFormatTag<eBitmapFormat_Float, 1, Layout>()); return;
+		case 2: f(BitmapFormatTag<eBitmapFormat_Float, 2, Layout>()); return;
+		case 3: f(BitmapFormatTag<eBitmapFormat_Float, 3, Layout>()); return;
+		case 4: f(BitmapFormatTag<eBitmapFormat_Float, 4, Layout>()); return;
+		}
+		break;
+	case eBitmapFormat_HalfFloat:
+		switch (comp)
+		{
+		case 1: f(BitmapFormatTag<eBitmapFormat_HalfFloat, 1, Layout>()); return;
+		case 2: f(BitmapFormatTag<eBitmapFormat_HalfFloat, 2, Layout>()); return;
+		case 3: f(BitmapFormatTag<eBitmapFormat_HalfFloat, 3, Layout>()); return;
+		case 4: f(BitmapFormatTag<eBitmapFormat_HalfFloat, 4, Layout>()); return;
+		}
+		break;
+	case eBitmapFormat_UnsignedShort:
+		switch (comp)
+		{
+		case 1: f(BitmapFormatTag<eBitmapFormat_UnsignedShort, 1, Layout>()); return;
+		case 2: f(BitmapFormatTag<eBitmapFormat_UnsignedShort, 2, Layout>()); return;
+		case 3: f(BitmapFormatTag<eBitmapFormat_UnsignedShort, 3, Layout>()); return;
+		case 4: f(BitmapFormatTag<eBitmapFormat_UnsignedShort, 4, Layout>()); return;
+		}
+		break;
+	default:
+		break;
+	}
+
+	assert(false);
+}
+
+/// Calls f(BitmapFormatTag<Format, Comp>()) for the runtime format of a linear bitmap.
+/// f is a functor with a templated operator() which instantiates the actual kernel.
+template <typename Func>
+void dispatchBitmapFormat(eBitmapFormat fmt, int comp, const Func& f)
+{
+	dispatchBitmapFormatForLayout<eBitmapLayout_Linear>(fmt, comp, f);
+}
+
+/// Same as above for kernels which accept any storage layout: f(BitmapFormatTag<Format, Comp, Layout>())
+template <typename Func>
+void dispatchBitmapFormat(const Bitmap& b, const Func& f)
+{
+	switch (b.getLayout())
+	{
+	case eBitmapLayout_Linear: dispatchBitmapFormatForLayout<eBitmapLayout_Linear>(b.fmt_, b.comp_, f); return;
+	case eBitmapLayout_Tiled: dispatchBitmapFormatForLayout<eBitmapLayout_Tiled>(b.fmt_, b.comp_, f); return;
+	case eBitmapLayout_Morton: dispatchBitmapFormatForLayout<eBitmapLayout_Morton>(b.fmt_, b.comp_, f); return;
+	}
+}
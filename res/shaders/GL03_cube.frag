@@ -9,5 +9,6 @@ layout (binding=1) uniform samplerCube texture1;
 
 void main()
 {
-	out_FragColor = texture(texture1, dir);
+	// the mip levels are prefiltered for rough reflections, the sky itself is the unfiltered base level
+	out_FragColor = textureLod(texture1, dir, 0.0);
 };
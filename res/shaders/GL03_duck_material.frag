@@ -0,0 +1,33 @@
+//
+#version 460 core
+
+layout(std140, binding = 0) uniform PerFrameData
+{
+	uniform mat4 model;
+	uniform mat4 MVP;
+	uniform vec4 cameraPos;
+};
+
+struct PerVertex
+{
+	vec2 uv;
+	vec3 normal;
+	vec3 worldPos;
+};
+
+layout (location=0) in PerVertex vtx;
+// written by GL03_duck_material.vert from gl_BaseInstance
+layout (location=3) flat in uint materialIndex;
+
+layout (location=0) out vec4 out_FragColor;
+
+#include <../res/shaders/Materials.sp>
+#include <../res/shaders/DuckLighting.sp>
+
+void main()
+{
+	vec3 n = normalize(vtx.normal);
+	vec3 v = normalize(cameraPos.xyz - vtx.worldPos);
+
+	out_FragColor = shadeDuck(sampleMaterialAlbedo(materialIndex, vtx.uv), n, v);
+};
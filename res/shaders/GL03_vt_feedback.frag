@@ -0,0 +1,29 @@
+//
+#version 460 core
+
+// only fragments which survive the depth test request pages
+layout(early_fragment_tests) in;
+
+#include <../res/shaders/VirtualTexture.sp>
+
+struct PerVertex
+{
+	vec2 uv;
+	vec3 normal;
+	vec3 worldPos;
+};
+
+layout (location=0) in PerVertex vtx;
+
+layout(std430, binding = 2) restrict writeonly buffer PageRequests
+{
+	uint requests[];
+};
+
+void main()
+{
+	// the level comes from the unwrapped coordinates, see vtSample()
+	int level = vtClampLevel(vtComputeLod(vtx.uv) + vtFeedback.x);
+	vec2 uv = fract(vtx.uv);
+	requests[vtPageIndex(vtPageCoord(uv, level), level)] = 1u;
+}
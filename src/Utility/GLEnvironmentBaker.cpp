@@ -0,0 +1,211 @@
+#include "GLEnvironmentBaker.h"
+#include "GLTextureFormat.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+std::unique_ptr<GLProgram> createComputeProgram(const std::string& fileName)
+{
+	const GLShader shader(fileName.c_str());
+
+	return std::unique_ptr<GLProgram>(new GLProgram(shader));
+}
+
+/// Cube map or 2D texture with linear filtering and immutable RGBA16F storage
+GLuint createEnvironmentTexture(GLenum target, int w, int h, int numLevels)
+{
+	GLuint texture;
+	glCreateTextures(target, 1, &texture);
+	glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(texture, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(texture, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+	glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, numLevels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTextureStorage2D(texture, numLevels, GL_RGBA16F, w, h);
+
+	return texture;
+}
+
+int getTextureWidth(GLuint texture)
+{
+	GLint w = 0;
+	glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_WIDTH, &w);
+
+	return w;
+}
+
+int getNumMipLevels(int size)
+{
+	int numLevels = 1;
+	while (size >> numLevels)
+		numLevels++;
+
+	return numLevels;
+}
+
+/// Copy of level 0 of an RGBA16F cube map with a box filtered mip chain
+GLuint createCubeMapMipChain(GLuint cubeMapTexture, int faceSize)
+{
+	const GLuint chain = createEnvironmentTexture(GL_TEXTURE_CUBE_MAP, faceSize, faceSize, getNumMipLevels(faceSize));
+	glCopyImageSubData(cubeMapTexture, GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0, chain, GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0, faceSize, faceSize, 6);
+	glGenerateTextureMipmap(chain);
+
+	return chain;
+}
+
+/// image stores of a dispatch become visible to texture fetches, mipmap generation and copies
+void waitForImageStores()
+{
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
+GLEnvironmentBaker::GLEnvironmentBaker(const char* shaderDirectory)
+	: equirectToCube_(createComputeProgram(std::string(shaderDirectory) + "GL03_equirect_to_cube.comp"))
+	, irradiance_(createComputeProgram(std::string(shaderDirectory) + "GL03_irradiance.comp"))
+	, prefilterGGX_(createComputeProgram(std::string(shaderDirectory) + "GL03_prefilter_ggx.comp"))
+{}
+
+bool GLEnvironmentBaker::isSupported()
+{
+	return GLAD_GL_VERSION_4_3 || GLAD_GL_ARB_compute_shader;
+}
+
+GLuint GLEnvironmentBaker::convertEquirectangularMapToCubeMap(GLuint equirectangularTexture, int faceSize) const
+{
+	if (!faceSize)
+		faceSize = getTextureWidth(equirectangularTexture) / 4;
+
+	const GLuint cubeMap = createEnvironmentTexture(GL_TEXTURE_CUBE_MAP, faceSize, faceSize, 1);
+
+	// longitude wraps around the seam, latitude clamps at the poles
+	GLuint sampler;
+	glCreateSamplers(1, &sampler);
+	glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	glBindTextureUnit(0, equirectangularTexture);
+	glBindSampler(0, sampler);
+	glBindImageTexture(0, cubeMap, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+	equirectToCube_->dispatchCompute(faceSize, faceSize, 6);
+	waitForImageStores();
+
+	glBindSampler(0, 0);
+	glDeleteSamplers(1, &sampler);
+
+	return cubeMap;
+}
+
+GLuint GLEnvironmentBaker::convolveDiffuse(GLuint cubeMapTexture, int dstW, int dstH, int numMonteCarloSamples) const
+{
+	const GLuint irradianceMap = createEnvironmentTexture(GL_TEXTURE_2D, dstW, dstH, 1);
+
+	// the CPU version resizes the faces to about as many texels as the output has
+	const int faceSize = getTextureWidth(cubeMapTexture);
+	const float filteredFaceSize = std::max(1.0f, sqrtf(dstW * dstH / 6.0f));
+	const float sourceLod = std::max(0.0f, log2f(faceSize / filteredFaceSize));
+
+	const GLuint source = createCubeMapMipChain(cubeMapTexture, faceSize);
+
+	glProgramUniform1i(irradiance_->getHandle(), 0, numMonteCarloSamples);
+	glProgramUniform1f(irradiance_->getHandle(), 1, sourceLod);
+
+	glBindTextureUnit(1, source);
+	glBindImageTexture(0, irradianceMap, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+	irradiance_->dispatchCompute(dstW, dstH);
+	waitForImageStores();
+
+	glDeleteTextures(1, &source);
+
+	return irradianceMap;
+}
+
+GLuint GLEnvironmentBaker::prefilterEnvironmentGGX(GLuint cubeMapTexture, int numSamples, int numLevels) const
+{
+	const int faceSize = getTextureWidth(cubeMapTexture);
+	const int maxLevels = getNumMipLevels(faceSize);
+
+	if (numLevels <= 0 || numLevels > maxLevels)
+		numLevels = maxLevels;
+
+	// the samples read a box filtered chain of the source, the input may not have the levels for it
+	const GLuint source = createCubeMapMipChain(cubeMapTexture, faceSize);
+
+	// roughness 0 is a mirror, level 0 is the environment itself
+	const GLuint prefiltered = createEnvironmentTexture(GL_TEXTURE_CUBE_MAP, faceSize, faceSize, numLevels);
+	glCopyImageSubData(source, GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0, prefiltered, GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0, faceSize, faceSize, 6);
+
+	glProgramUniform1i(prefilterGGX_->getHandle(), 1, numSamples);
+	glBindTextureUnit(1, source);
+
+	for (int level = 1; level < numLevels; level++)
+	{
+		const int size = std::max(1, faceSize >> level);
+
+		glProgramUniform1f(prefilterGGX_->getHandle(), 0, float(level) / float(numLevels - 1));
+		glBindImageTexture(0, prefiltered, level, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+		prefilterGGX_->dispatchCompute(size, size, 6);
+	}
+
+	waitForImageStores();
+
+	glDeleteTextures(1, &source);
+
+	return prefiltered;
+}
+
+GLuint createCubeMapTexture(const std::vector<Bitmap>& levels)
+{
+	const Bitmap& base = levels.front();
+	const GLsizei numLevels = (GLsizei)levels.size();
+
+	GLuint texture;
+	glCreateTextures(GL_TEXTURE_CUBE_MAP, 1, &texture);
+	glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(texture, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(texture, GL_TEXTURE_BASE_LEVEL, 0);
+	glTextureParameteri(texture, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+	glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, numLevels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	GLenum internalFormat, format, type;
+	getGLTextureFormat(base, internalFormat, format, type);
+	glTextureStorage2D(texture, numLevels, internalFormat, base.w_, base.h_);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	// the faces are consecutive, so every level is a single 6-layer upload
+	for (GLsizei level = 0; level != numLevels; level++)
+		glTextureSubImage3D(texture, level, 0, 0, 0, levels[level].w_, levels[level].h_, 6, format, type, levels[level].data_.data());
+
+	return texture;
+}
+
+std::vector<Bitmap> readCubeMapTexture(GLuint texture)
+{
+	GLint numLevels = 0;
+	glGetTextureParameteriv(texture, GL_TEXTURE_IMMUTABLE_LEVELS, &numLevels);
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+	std::vector<Bitmap> levels;
+	for (GLint level = 0; level < std::max(1, numLevels); level++)
+	{
+		GLint size = 0;
+		glGetTextureLevelParameteriv(texture, level, GL_TEXTURE_WIDTH, &size);
+
+		Bitmap faces(size, size, 6, 3, eBitmapFormat_HalfFloat);
+		faces.type_ = eBitmapType_Cube;
+		glGetTextureImage(texture, level, GL_RGB, GL_HALF_FLOAT, (GLsizei)faces.data_.size(), faces.data_.data());
+
+		levels.push_back(std::move(faces));
+	}
+
+	return levels;
+}
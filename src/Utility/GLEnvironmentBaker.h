@@ -0,0 +1,49 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Bitmap.h"
+#include "GLShader.h"
+
+/// Compute shader versions of the environment conversions in UtilsCubemap, so an environment swap never
+/// round-trips through the CPU. Each one ports its CPU fallback: convertEquirectangularMapToCubeMapFaces()
+/// (same texels up to half float rounding), convolveDiffuse() and prefilterEnvironmentGGX() (same samples,
+/// the source levels come from glGenerateTextureMipmap()).
+/// Results are new RGBA16F textures owned by the caller. Input cube maps must be RGBA16F as well (they are copied
+/// into a box filtered mip chain first) and are left untouched.
+/// Shaders: res/shaders/GL03_equirect_to_cube.comp, GL03_irradiance.comp and GL03_prefilter_ggx.comp.
+class GLEnvironmentBaker
+{
+public:
+	explicit GLEnvironmentBaker(const char* shaderDirectory = "../res/shaders/");
+
+	GLEnvironmentBaker(const GLEnvironmentBaker&) = delete;
+	GLEnvironmentBaker& operator=(const GLEnvironmentBaker&) = delete;
+
+	/// compute shaders need GL 4.3
+	static bool isSupported();
+
+	/// faceSize 0 keeps the resolution of the input (a quarter of its width)
+	GLuint convertEquirectangularMapToCubeMap(GLuint equirectangularTexture, int faceSize = 0) const;
+
+	/// dstW x dstH equirectangular irradiance map
+	GLuint convolveDiffuse(GLuint cubeMapTexture, int dstW, int dstH, int numMonteCarloSamples) const;
+
+	/// Mipmapped cube map, level i is prefiltered for GGX roughness i / (numLevels - 1); numLevels 0 makes the full chain
+	GLuint prefilterEnvironmentGGX(GLuint cubeMapTexture, int numSamples = 64, int numLevels = 0) const;
+
+private:
+	std::unique_ptr<GLProgram> equirectToCube_;
+	std::unique_ptr<GLProgram> irradiance_;
+	std::unique_ptr<GLProgram> prefilterGGX_;
+};
+
+/// Immutable mipmapped cube texture from linear cube map bitmaps, level 0 first (e.g. prefilterEnvironmentGGX() levels)
+GLuint createCubeMapTexture(const std::vector<Bitmap>& levels);
+
+/// Reads all levels of a cube texture back as half float RGB cube maps
+std::vector<Bitmap> readCubeMapTexture(GLuint texture);
@@ -0,0 +1,140 @@
+#include "GLMaterialSystem.h"
+#include "GLTextureFormat.h"
+#include "UtilsBitmap.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+
+GLMaterialSystem::~GLMaterialSystem()
+{
+	for (auto& p : pools_)
+		glDeleteTextures(1, &p.texture);
+
+	glDeleteBuffers(1, &materialBuffer_);
+}
+
+int GLMaterialSystem::addTexture(const Bitmap& image)
+{
+	assert(!finalized_);
+
+	GLenum internalFormat, format, type;
+	getGLTextureFormat(image, internalFormat, format, type);
+
+	GLint maxLayers = 256;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+	uint32_t pool = kInvalidPool;
+
+	for (size_t i = 0; i != pools_.size(); i++)
+	{
+		const Pool& p = pools_[i];
+		if (p.w == image.w_ && p.h == image.h_ && p.internalFormat == internalFormat && (GLint)p.layers.size() < maxLayers)
+		{
+			pool = (uint32_t)i;
+			break;
+		}
+	}
+
+	if (pool == kInvalidPool)
+	{
+		if ((int)pools_.size() == kMaxPools)
+		{
+			printf("Too many texture pools: increase GLMaterialSystem::kMaxPools and materialPools[] in Materials.sp\n");
+			assert(false);
+			return -1;
+		}
+
+		Pool p;
+		p.w = image.w_;
+		p.h = image.h_;
+		p.internalFormat = internalFormat;
+		pools_.push_back(p);
+		pool = (uint32_t)pools_.size() - 1;
+	}
+
+	TextureRef ref;
+	ref.pool = pool;
+	ref.layer = (uint32_t)pools_[pool].layers.size();
+
+	// glTextureSubImage3D() expects rows of texels
+	pools_[pool].layers.push_back(image.addressing_.layout_ == eBitmapLayout_Linear ? image : convertBitmapLayout(image, eBitmapLayout_Linear));
+	textures_.push_back(ref);
+
+	return (int)textures_.size() - 1;
+}
+
+uint32_t GLMaterialSystem::addMaterial(const MaterialDescription& material)
+{
+	assert(!finalized_);
+
+	MaterialData m = {};
+	m.baseColorFactor = material.baseColorFactor;
+	m.albedoPool = kInvalidPool;
+
+	if (material.albedoTexture >= 0)
+	{
+		m.albedoPool = textures_[material.albedoTexture].pool;
+		m.albedoLayer = textures_[material.albedoTexture].layer;
+	}
+
+	materials_.push_back(m);
+
+	return (uint32_t)materials_.size() - 1;
+}
+
+void GLMaterialSystem::finalize()
+{
+	assert(!finalized_);
+
+	for (auto& p : pools_)
+	{
+		const int numLayers = (int)p.layers.size();
+		const int numLevels = 1 + (int)floor(log2(std::max(p.w, p.h)));
+
+		glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &p.texture);
+		glTextureParameteri(p.texture, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+		glTextureParameteri(p.texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTextureParameteri(p.texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTextureStorage3D(p.texture, numLevels, p.internalFormat, p.w, p.h, numLayers);
+
+		for (int i = 0; i != numLayers; i++)
+		{
+			GLenum internalFormat, format, type;
+			getGLTextureFormat(p.layers[i], internalFormat, format, type);
+			assert(p.layers[i].addressing_.layout_ == eBitmapLayout_Linear);
+			glTextureSubImage3D(p.texture, 0, 0, 0, i, p.w, p.h, 1, format, type, p.layers[i].data_.data());
+		}
+
+		glGenerateTextureMipmap(p.texture);
+
+		// the pixels live on the GPU from now on
+		std::vector<Bitmap>().swap(p.layers);
+	}
+
+	// an empty SSBO cannot be created
+	if (materials_.empty())
+		addMaterial(MaterialDescription());
+
+	glCreateBuffers(1, &materialBuffer_);
+	glNamedBufferStorage(materialBuffer_, materials_.size() * sizeof(MaterialData), materials_.data(), 0);
+
+	finalized_ = true;
+}
+
+void GLMaterialSystem::bind() const
+{
+	assert(finalized_);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, materialBuffer_);
+
+	GLuint textures[kMaxPools] = {};
+
+	for (size_t i = 0; i != pools_.size(); i++)
+		textures[i] = pools_[i].texture;
+
+	// matches the binding of materialPools[] in Materials.sp
+	glBindTextures(4, kMaxPools, textures);
+}
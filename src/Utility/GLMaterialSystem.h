@@ -0,0 +1,76 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <stdint.h>
+#include <vector>
+
+#include "Bitmap.h"
+
+struct MaterialDescription
+{
+	glm::vec4 baseColorFactor = glm::vec4(1.0f);
+	int albedoTexture = -1; // index returned by GLMaterialSystem::addTexture()
+};
+
+/// Packs textures of the same size and format into GL_TEXTURE_2D_ARRAY pools and keeps all
+/// materials in one SSBO, so a whole scene is drawn without rebinding textures between draws.
+/// Draws select their material through the base instance: GL03_duck_material.vert writes gl_BaseInstance
+/// to materialIndex (location 3) for GL03_duck_material.frag, which samples through res/shaders/Materials.sp.
+/// The demo draws the duck through it with --materials; unverified on a GPU.
+class GLMaterialSystem
+{
+public:
+	/// must match the size of materialPools[] in Materials.sp
+	static constexpr int kMaxPools = 8;
+	static constexpr uint32_t kInvalidPool = 0xFFFFFFFF;
+
+	GLMaterialSystem() = default;
+	~GLMaterialSystem();
+
+	GLMaterialSystem(const GLMaterialSystem&) = delete;
+	GLMaterialSystem& operator=(const GLMaterialSystem&) = delete;
+
+	int addTexture(const Bitmap& image);
+	uint32_t addMaterial(const MaterialDescription& material);
+
+	/// Creates the texture arrays and the material buffer. Nothing can be added afterwards.
+	void finalize();
+
+	/// binds the material SSBO and all texture pools once for the whole scene
+	void bind() const;
+
+	size_t getNumPools() const { return pools_.size(); }
+
+private:
+	struct Pool
+	{
+		int w = 0;
+		int h = 0;
+		GLenum internalFormat = 0;
+		std::vector<Bitmap> layers;
+		GLuint texture = 0;
+	};
+
+	struct TextureRef
+	{
+		uint32_t pool = kInvalidPool;
+		uint32_t layer = 0;
+	};
+
+	// matches MaterialData in Materials.sp (std430)
+	struct MaterialData
+	{
+		glm::vec4 baseColorFactor;
+		uint32_t albedoPool;
+		uint32_t albedoLayer;
+		uint32_t padding[2];
+	};
+
+	std::vector<Pool> pools_;
+	std::vector<TextureRef> textures_;
+	std::vector<MaterialData> materials_;
+	GLuint materialBuffer_ = 0;
+	bool finalized_ = false;
+};
@@ -52,6 +52,9 @@ GLProgram::GLProgram(const GLShader& a)
 	glAttachShader(handle_, a.getHandle());
 	glLinkProgram(handle_);
 	printProgramInfoLog(handle_);
+
+	if (a.getType() == GL_COMPUTE_SHADER)
+		glGetProgramiv(handle_, GL_COMPUTE_WORK_GROUP_SIZE, workGroupSize_);
 }
 
 GLProgram::GLProgram(const GLShader& a, const GLShader& b)
@@ -95,6 +98,15 @@ void GLProgram::useProgram() const
 	glUseProgram(handle_);
 }
 
+void GLProgram::dispatchCompute(GLuint sizeX, GLuint sizeY, GLuint sizeZ) const
+{
+	glUseProgram(handle_);
+	glDispatchCompute(
+		(sizeX + workGroupSize_[0] - 1) / workGroupSize_[0],
+		(sizeY + workGroupSize_[1] - 1) / workGroupSize_[1],
+		(sizeZ + workGroupSize_[2] - 1) / workGroupSize_[2]);
+}
+
 GLenum GLShaderTypeFromFileName(const char* fileName)
 {
 	if (endsWith(fileName, ".vert"))
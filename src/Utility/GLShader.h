@@ -28,8 +28,12 @@ public:
 	void useProgram() const;
 	GLuint getHandle() const { return handle_; }
 
+	/// Compute programs: binds the program and launches enough work groups to cover sizeX x sizeY x sizeZ invocations
+	void dispatchCompute(GLuint sizeX, GLuint sizeY = 1, GLuint sizeZ = 1) const;
+
 private:
 	GLuint handle_;
+	GLint workGroupSize_[3] = { 1, 1, 1 };
 };
 
 GLenum GLShaderTypeFromFileName(const char* fileName);
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <assert.h>
+
+#include "Bitmap.h"
+
+/// GL upload formats matching the memory layout of a Bitmap
+inline void getGLTextureFormat(const Bitmap& b, GLenum& internalFormat, GLenum& format, GLenum& type)
+{
+	static const GLenum kFormats[] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+	static const GLenum kInternalFormats8[] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+	static const GLenum kInternalFormats16[] = { GL_R16, GL_RG16, GL_RGB16, GL_RGBA16 };
+	static const GLenum kInternalFormats16F[] = { GL_R16F, GL_RG16F, GL_RGB16F, GL_RGBA16F };
+	static const GLenum kInternalFormats32F[] = { GL_R32F, GL_RG32F, GL_RGB32F, GL_RGBA32F };
+
+	assert(b.comp_ >= 1 && b.comp_ <= 4);
+
+	format = kFormats[b.comp_ - 1];
+
+	switch (b.fmt_)
+	{
+	case eBitmapFormat_UnsignedByte:
+		type = GL_UNSIGNED_BYTE;
+		internalFormat = kInternalFormats8[b.comp_ - 1];
+		break;
+	case eBitmapFormat_Float:
+		type = GL_FLOAT;
+		internalFormat = kInternalFormats32F[b.comp_ - 1];
+		break;
+	case eBitmapFormat_HalfFloat:
+		type = GL_HALF_FLOAT;
+		internalFormat = kInternalFormats16F[b.comp_ - 1];
+		break;
+	case eBitmapFormat_UnsignedShort:
+		type = GL_UNSIGNED_SHORT;
+		internalFormat = kInternalFormats16[b.comp_ - 1];
+		break;
+	case eBitmapFormat_RGB9E5:
+		assert(b.comp_ == 3);
+		type = GL_UNSIGNED_INT_5_9_9_9_REV;
+		internalFormat = GL_RGB9_E5;
+		break;
+	case eBitmapFormat_R11G11B10F:
+		assert(b.comp_ == 3);
+		type = GL_UNSIGNED_INT_10F_11F_11F_REV;
+		internalFormat = GL_R11F_G11F_B10F;
+		break;
+	}
+}
@@ -0,0 +1,303 @@
+#include "GLTextureLoader.h"
+
+#include <stb/stb_image.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+GLAsyncTextureLoader::GLAsyncTextureLoader(GLFWwindow* sharedWindow, unsigned numDecodeThreads, GLsizeiptr ringSlotSize, int numRingSlots)
+	: stop_(false)
+	, slotSize_(ringSlotSize)
+	, slots_(numRingSlots)
+	, decodePool_(numDecodeThreads)
+{
+	// GLFW windows can only be created on the main thread; the context is made current on the upload thread
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	uploadWindow_ = glfwCreateWindow(1, 1, "Texture upload", nullptr, sharedWindow);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+
+	if (!uploadWindow_)
+	{
+		printf("Unable to create the texture upload context, textures are loaded synchronously\n");
+		return;
+	}
+
+	for (int i = 0; i != numRingSlots; i++)
+		slots_[i].offset = i * slotSize_;
+
+	uploadThread_ = std::thread(&GLAsyncTextureLoader::uploadThreadLoop, this);
+}
+
+GLAsyncTextureLoader::~GLAsyncTextureLoader()
+{
+	{
+		std::lock_guard<std::mutex> lock(uploadMutex_);
+		stop_ = true;
+	}
+
+	// decode jobs which have not started yet bail out immediately
+	decodePool_.waitIdle();
+
+	uploadAvailable_.notify_all();
+	if (uploadThread_.joinable())
+		uploadThread_.join();
+
+	for (auto& r : uploadQueue_)
+		stbi_image_free(r->pixels);
+
+	for (auto& i : requests_)
+	{
+		GLsync fence = i.second->fence;
+		if (fence)
+			glDeleteSync(fence);
+		glDeleteTextures(1, &i.second->texture);
+	}
+
+	if (uploadWindow_)
+		glfwDestroyWindow(uploadWindow_);
+}
+
+GLuint GLAsyncTextureLoader::loadTexture2D(const char* fileName, bool generateMips)
+{
+	int w, h, comp;
+	if (!stbi_info(fileName, &w, &h, &comp))
+	{
+		printf("Unable to load %s\n", fileName);
+		return 0;
+	}
+
+	std::unique_ptr<Request> r(new Request());
+	r->fileName = fileName;
+	r->w = w;
+	r->h = h;
+	r->comp = (comp == 2 || comp == 4) ? 4 : 3;
+	r->fmt = stbi_is_hdr(fileName) ? eBitmapFormat_Float : eBitmapFormat_UnsignedByte;
+	r->levels = generateMips ? 1 + (int)floor(log2(std::max(w, h))) : 1;
+
+	GLenum internalFormat = 0;
+	if (r->fmt == eBitmapFormat_Float)
+		internalFormat = r->comp == 4 ? GL_RGBA32F : GL_RGB32F;
+	else
+		internalFormat = r->comp == 4 ? GL_RGBA8 : GL_RGB8;
+
+	glCreateTextures(GL_TEXTURE_2D, 1, &r->texture);
+	glTextureParameteri(r->texture, GL_TEXTURE_MAX_LEVEL, r->levels - 1);
+	glTextureParameteri(r->texture, GL_TEXTURE_MIN_FILTER, generateMips ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTextureParameteri(r->texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTextureStorage2D(r->texture, r->levels, internalFormat, w, h);
+
+	const GLuint texture = r->texture;
+	Request* req = r.get();
+
+	if (!uploadWindow_)
+	{
+		// without an upload context the calling thread does everything
+		decodePixels(req);
+		uploadNow(req);
+		requests_[texture] = std::move(r);
+		return texture;
+	}
+
+	requests_[texture] = std::move(r);
+	numPending_++;
+
+	decodePool_.submit([this, req]() { decode(req); });
+
+	return texture;
+}
+
+void GLAsyncTextureLoader::update()
+{
+	if (!numPending_)
+		return;
+
+	for (auto& i : requests_)
+	{
+		Request* r = i.second.get();
+		GLsync fence = r->fence;
+
+		if (r->ready || !fence)
+			continue;
+
+		const GLenum result = glClientWaitSync(fence, 0, 0);
+
+		if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED)
+		{
+			glDeleteSync(fence);
+			r->fence = nullptr;
+			r->ready = !r->failed;
+			numPending_--;
+		}
+	}
+}
+
+bool GLAsyncTextureLoader::isReady(GLuint texture) const
+{
+	auto i = requests_.find(texture);
+
+	return i != requests_.end() && i->second->ready;
+}
+
+void GLAsyncTextureLoader::decode(Request* r)
+{
+	if (stop_)
+		return;
+
+	decodePixels(r);
+
+	{
+		std::lock_guard<std::mutex> lock(uploadMutex_);
+		uploadQueue_.push_back(r);
+	}
+	uploadAvailable_.notify_one();
+}
+
+void GLAsyncTextureLoader::decodePixels(Request* r)
+{
+	if (r->fmt == eBitmapFormat_Float)
+		r->pixels = stbi_loadf(r->fileName.c_str(), &r->w, &r->h, nullptr, r->comp);
+	else
+		r->pixels = stbi_load(r->fileName.c_str(), &r->w, &r->h, nullptr, r->comp);
+
+	if (!r->pixels)
+	{
+		printf("Unable to decode %s: %s\n", r->fileName.c_str(), stbi_failure_reason());
+		r->failed = true;
+	}
+}
+
+void GLAsyncTextureLoader::uploadNow(Request* r)
+{
+	if (r->pixels)
+	{
+		const GLenum format = r->comp == 4 ? GL_RGBA : GL_RGB;
+		const GLenum type = r->fmt == eBitmapFormat_Float ? GL_FLOAT : GL_UNSIGNED_BYTE;
+
+		// the main context keeps its own pixel store state
+		GLint alignment = 4;
+		glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTextureSubImage2D(r->texture, 0, 0, 0, r->w, r->h, format, type, r->pixels);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+
+		if (r->levels > 1)
+			glGenerateTextureMipmap(r->texture);
+
+		stbi_image_free(r->pixels);
+		r->pixels = nullptr;
+	}
+
+	r->ready = !r->failed;
+}
+
+void GLAsyncTextureLoader::uploadThreadLoop()
+{
+	glfwMakeContextCurrent(uploadWindow_);
+
+	const GLsizeiptr ringSize = slotSize_ * (GLsizeiptr)slots_.size();
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+	glCreateBuffers(1, &pbo_);
+	glNamedBufferStorage(pbo_, ringSize, nullptr, flags);
+	pboPtr_ = (uint8_t*)glMapNamedBufferRange(pbo_, 0, ringSize, flags);
+
+	// pixel store state is per-context
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo_);
+
+	for (;;)
+	{
+		Request* r = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(uploadMutex_);
+			uploadAvailable_.wait(lock, [this]() { return stop_ || !uploadQueue_.empty(); });
+
+			if (stop_)
+				break;
+
+			r = uploadQueue_.front();
+			uploadQueue_.pop_front();
+		}
+
+		upload(r);
+	}
+
+	for (auto& s : slots_)
+	{
+		if (s.fence)
+		{
+			glClientWaitSync(s.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+			glDeleteSync(s.fence);
+		}
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glUnmapNamedBuffer(pbo_);
+	glDeleteBuffers(1, &pbo_);
+	glFinish();
+
+	glfwMakeContextCurrent(nullptr);
+}
+
+GLAsyncTextureLoader::RingSlot& GLAsyncTextureLoader::acquireSlot()
+{
+	RingSlot& s = slots_[nextSlot_];
+	nextSlot_ = (nextSlot_ + 1) % slots_.size();
+
+	// wait until the GPU has consumed the previous contents of this slot
+	if (s.fence)
+	{
+		while (glClientWaitSync(s.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {}
+		glDeleteSync(s.fence);
+		s.fence = nullptr;
+	}
+
+	return s;
+}
+
+void GLAsyncTextureLoader::upload(Request* r)
+{
+	if (r->pixels)
+	{
+		const GLenum format = r->comp == 4 ? GL_RGBA : GL_RGB;
+		const GLenum type = r->fmt == eBitmapFormat_Float ? GL_FLOAT : GL_UNSIGNED_BYTE;
+		const size_t rowSize = (size_t)r->w * Bitmap::getBytesPerPixel(r->fmt, r->comp);
+		const uint8_t* src = (const uint8_t*)r->pixels;
+
+		if (rowSize <= (size_t)slotSize_)
+		{
+			const int rowsPerSlot = (int)(slotSize_ / rowSize);
+
+			for (int y = 0; y < r->h; y += rowsPerSlot)
+			{
+				const int numRows = std::min(rowsPerSlot, r->h - y);
+				RingSlot& s = acquireSlot();
+				memcpy(pboPtr_ + s.offset, src + y * rowSize, numRows * rowSize);
+				glTextureSubImage2D(r->texture, 0, 0, y, r->w, numRows, format, type, (const void*)(uintptr_t)s.offset);
+				s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			}
+		}
+		else
+		{
+			// a single row does not fit into a ring slot: upload straight from client memory
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			glTextureSubImage2D(r->texture, 0, 0, 0, r->w, r->h, format, type, src);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo_);
+		}
+
+		if (r->levels > 1)
+			glGenerateTextureMipmap(r->texture);
+
+		stbi_image_free(r->pixels);
+		r->pixels = nullptr;
+	}
+
+	GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	// make sure the fence reaches the GPU so the render thread can observe it
+	glFlush();
+
+	r->fence = fence;
+}
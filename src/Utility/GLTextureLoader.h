@@ -0,0 +1,98 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Bitmap.h"
+#include "ThreadPool.h"
+
+/// Loads 2D textures in the background: image files are decoded on a pool of worker threads
+/// and streamed into the textures through a ring of persistently mapped pixel-unpack buffers
+/// by a dedicated upload thread which owns a GL context shared with the main window.
+/// Every texture gets a fence once its last row is uploaded; update() polls these fences on
+/// the render thread so the renderer can swap in textures as soon as they become ready.
+/// If the shared context cannot be created, loadTexture2D() decodes and uploads synchronously.
+class GLAsyncTextureLoader
+{
+public:
+	GLAsyncTextureLoader(GLFWwindow* sharedWindow, unsigned numDecodeThreads = 0,
+		GLsizeiptr ringSlotSize = 4 * 1024 * 1024, int numRingSlots = 4);
+	~GLAsyncTextureLoader();
+
+	GLAsyncTextureLoader(const GLAsyncTextureLoader&) = delete;
+	GLAsyncTextureLoader& operator=(const GLAsyncTextureLoader&) = delete;
+
+	/// Reads only the image header, allocates immutable texture storage and queues the decode.
+	/// Must be called on the thread owning the main context. Returns 0 if the file cannot be read.
+	GLuint loadTexture2D(const char* fileName, bool generateMips = false);
+
+	/// Polls the upload fences; call once per frame on the render thread
+	void update();
+
+	bool isReady(GLuint texture) const;
+	size_t getNumPending() const { return numPending_; }
+
+private:
+	struct Request
+	{
+		std::string fileName;
+		GLuint texture = 0;
+		int w = 0;
+		int h = 0;
+		int comp = 0;
+		int levels = 1;
+		eBitmapFormat fmt = eBitmapFormat_UnsignedByte;
+		void* pixels = nullptr;
+		bool failed = false;
+		std::atomic<GLsync> fence;
+		bool ready = false;
+
+		Request() : fence(nullptr) {}
+	};
+
+	struct RingSlot
+	{
+		GLintptr offset = 0;
+		GLsync fence = nullptr;
+	};
+
+	void decode(Request* r);
+	void decodePixels(Request* r);
+	/// synchronous upload on the calling thread, used without an upload context
+	void uploadNow(Request* r);
+	void uploadThreadLoop();
+	void upload(Request* r);
+	RingSlot& acquireSlot();
+
+	GLFWwindow* uploadWindow_ = nullptr;
+	std::thread uploadThread_;
+
+	std::deque<Request*> uploadQueue_;
+	std::mutex uploadMutex_;
+	std::condition_variable uploadAvailable_;
+	std::atomic<bool> stop_;
+
+	// owned by the upload thread
+	GLuint pbo_ = 0;
+	uint8_t* pboPtr_ = nullptr;
+	const GLsizeiptr slotSize_;
+	std::vector<RingSlot> slots_;
+	size_t nextSlot_ = 0;
+
+	// owned by the render thread
+	std::unordered_map<GLuint, std::unique_ptr<Request>> requests_;
+	size_t numPending_ = 0;
+
+	// declared last so the workers are joined before anything they touch is destroyed
+	ThreadPool decodePool_;
+};
@@ -0,0 +1,217 @@
+#include "GLTextureStreamer.h"
+#include "GLTextureFormat.h"
+#include "UtilsBitmap.h"
+#include "UtilsMath.h"
+
+#include <assert.h>
+#include <math.h>
+
+#include <algorithm>
+
+GLTextureStreamer::GLTextureStreamer(size_t budgetBytes, int tailSize, size_t maxUploadBytesPerUpdate)
+	: budgetBytes_(budgetBytes)
+	, tailSize_(tailSize)
+	, maxUploadBytesPerUpdate_(maxUploadBytesPerUpdate)
+	, frame_(1)
+{}
+
+GLTextureStreamer::~GLTextureStreamer()
+{
+	for (auto& t : textures_)
+		glDeleteTextures(1, &t.texture);
+}
+
+uint32_t GLTextureStreamer::addTexture(const Bitmap& image)
+{
+	textures_.emplace_back();
+	StreamedTexture& t = textures_.back();
+
+	t.mips = generateBitmapMipChain(image);
+
+	// glTextureSubImage2D() expects rows of texels
+	for (Bitmap& m : t.mips)
+		if (m.addressing_.layout_ != eBitmapLayout_Linear)
+			m = convertBitmapLayout(m, eBitmapLayout_Linear);
+
+	t.tailLevel = (int)t.mips.size() - 1;
+	for (int l = 0; l != (int)t.mips.size(); l++)
+	{
+		if (std::max(t.mips[l].w_, t.mips[l].h_) <= tailSize_)
+		{
+			t.tailLevel = l;
+			break;
+		}
+	}
+
+	// the mip tail is always resident, even if it does not fit into the budget
+	t.residentLevel = (int)t.mips.size();
+	t.desiredLevel = t.tailLevel;
+	setResidentLevel(t, t.tailLevel);
+
+	return (uint32_t)textures_.size() - 1;
+}
+
+void GLTextureStreamer::requestFootprint(uint32_t id, float screenSize)
+{
+	StreamedTexture& t = textures_[id];
+
+	// several objects can share a texture: keep the largest footprint of this frame
+	t.footprint = (t.lastUsedFrame == frame_) ? std::max(t.footprint, screenSize) : screenSize;
+	t.lastUsedFrame = frame_;
+
+	const float texSize = (float)std::max(t.mips[0].w_, t.mips[0].h_);
+	const int level = (int)floor(log2(texSize / std::max(t.footprint, 1.0f)));
+
+	t.desiredLevel = clamp(level, 0, t.tailLevel);
+}
+
+void GLTextureStreamer::update()
+{
+	for (auto& t : textures_)
+	{
+		if (t.minLod > 0.0f)
+		{
+			t.minLod = std::max(0.0f, t.minLod - 0.125f);
+			glTextureParameterf(t.texture, GL_TEXTURE_MIN_LOD, t.minLod);
+		}
+	}
+
+	std::vector<StreamedTexture*> requests;
+	for (auto& t : textures_)
+	{
+		if (t.lastUsedFrame == frame_ && t.desiredLevel < t.residentLevel)
+			requests.push_back(&t);
+	}
+
+	// objects covering more of the screen get their detail first
+	std::sort(requests.begin(), requests.end(),
+		[](const StreamedTexture* a, const StreamedTexture* b) { return a->footprint > b->footprint; });
+
+	size_t uploadedBytes = 0;
+
+	for (StreamedTexture* t : requests)
+	{
+		// stream one level per frame so that all visible textures refine evenly
+		const int level = t->residentLevel - 1;
+		const size_t levelSize = t->mips[level].data_.size();
+
+		if (uploadedBytes && uploadedBytes + levelSize > maxUploadBytesPerUpdate_)
+			break;
+
+		if (residentBytes_ + levelSize > budgetBytes_ && !evictFor(residentBytes_ + levelSize - budgetBytes_, t))
+			continue;
+
+		setResidentLevel(*t, level);
+		uploadedBytes += levelSize;
+	}
+
+	frame_++;
+}
+
+size_t GLTextureStreamer::getLevelsSize(const StreamedTexture& t, int firstLevel) const
+{
+	size_t size = 0;
+
+	for (int l = firstLevel; l < (int)t.mips.size(); l++)
+		size += t.mips[l].data_.size();
+
+	return size;
+}
+
+bool GLTextureStreamer::evictFor(size_t bytesNeeded, const StreamedTexture* requester)
+{
+	// textures not used this frame, or holding more detail than they currently need
+	auto canEvict = [this, requester](const StreamedTexture& t)
+	{
+		return &t != requester && t.residentLevel < t.tailLevel &&
+			(t.lastUsedFrame < frame_ || t.residentLevel < t.desiredLevel);
+	};
+	auto evictableLevels = [this](const StreamedTexture& t)
+	{
+		return t.lastUsedFrame < frame_ ? t.tailLevel : t.desiredLevel;
+	};
+
+	std::vector<StreamedTexture*> candidates;
+	size_t evictableBytes = 0;
+
+	for (auto& t : textures_)
+	{
+		if (!canEvict(t))
+			continue;
+		candidates.push_back(&t);
+		evictableBytes += getLevelsSize(t, t.residentLevel) - getLevelsSize(t, evictableLevels(t));
+	}
+
+	if (evictableBytes < bytesNeeded)
+		return false;
+
+	// least recently used first
+	std::sort(candidates.begin(), candidates.end(),
+		[](const StreamedTexture* a, const StreamedTexture* b) { return a->lastUsedFrame < b->lastUsedFrame; });
+
+	size_t freedBytes = 0;
+
+	for (StreamedTexture* t : candidates)
+	{
+		int level = t->residentLevel;
+		const int maxLevel = evictableLevels(*t);
+
+		while (level < maxLevel && freedBytes < bytesNeeded)
+			freedBytes += t->mips[level++].data_.size();
+
+		setResidentLevel(*t, level);
+
+		if (freedBytes >= bytesNeeded)
+			break;
+	}
+
+	return true;
+}
+
+void GLTextureStreamer::setResidentLevel(StreamedTexture& t, int level)
+{
+	if (level == t.residentLevel)
+		return;
+
+	const int numLevels = (int)t.mips.size() - level;
+	const Bitmap& top = t.mips[level];
+
+	GLenum internalFormat, format, type;
+	getGLTextureFormat(top, internalFormat, format, type);
+
+	GLuint texture;
+	glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+	glTextureParameteri(texture, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+	glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTextureStorage2D(texture, numLevels, internalFormat, top.w_, top.h_);
+
+	for (int l = level; l != (int)t.mips.size(); l++)
+	{
+		const Bitmap& m = t.mips[l];
+
+		// levels which are already resident are copied on the GPU
+		if (t.texture && l >= t.residentLevel)
+			glCopyImageSubData(t.texture, GL_TEXTURE_2D, l - t.residentLevel, 0, 0, 0, texture, GL_TEXTURE_2D, l - level, 0, 0, 0, m.w_, m.h_, 1);
+		else
+		{
+			assert(m.addressing_.layout_ == eBitmapLayout_Linear);
+			glTextureSubImage2D(texture, l - level, 0, 0, m.w_, m.h_, format, type, m.data_.data());
+		}
+	}
+
+	if (t.texture)
+	{
+		residentBytes_ -= getLevelsSize(t, t.residentLevel);
+		glDeleteTextures(1, &t.texture);
+
+		// keep sampling the previously finest level and fade the new ones in
+		t.minLod = std::max(0.0f, t.minLod + float(t.residentLevel - level));
+	}
+
+	glTextureParameterf(texture, GL_TEXTURE_MIN_LOD, t.minLod);
+
+	t.texture = texture;
+	t.residentLevel = level;
+	residentBytes_ += getLevelsSize(t, level);
+}
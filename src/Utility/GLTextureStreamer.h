@@ -0,0 +1,66 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <stdint.h>
+#include <vector>
+
+#include "Bitmap.h"
+
+/// Mip-level texture streaming under a global GPU memory budget.
+/// Every texture keeps a full CPU mip chain but only its coarse mip tail is always resident.
+/// The renderer reports a screen-space footprint per texture and frame; update() streams in
+/// finer levels on demand and evicts the finest levels of the least recently used textures
+/// when the budget would be exceeded.
+/// Immutable storage commits every level up front, so a texture is re-created with only its
+/// resident levels whenever residency changes. GL handles therefore change: always query
+/// getTexture() after update(). Newly arrived levels are faded in with GL_TEXTURE_MIN_LOD.
+/// The demo streams the duck's base color through it with --stream-textures; unverified on a GPU.
+class GLTextureStreamer
+{
+public:
+	explicit GLTextureStreamer(size_t budgetBytes, int tailSize = 64, size_t maxUploadBytesPerUpdate = 8 * 1024 * 1024);
+	~GLTextureStreamer();
+
+	GLTextureStreamer(const GLTextureStreamer&) = delete;
+	GLTextureStreamer& operator=(const GLTextureStreamer&) = delete;
+
+	/// Builds the CPU mip chain and uploads the mip tail. Returns the texture id.
+	uint32_t addTexture(const Bitmap& image);
+
+	GLuint getTexture(uint32_t id) const { return textures_[id].texture; }
+
+	/// screenSize is the projected size of the textured object in pixels, see estimateScreenSize()
+	void requestFootprint(uint32_t id, float screenSize);
+
+	/// Applies residency changes for the current frame; call once per frame
+	void update();
+
+	size_t getResidentBytes() const { return residentBytes_; }
+	size_t getBudgetBytes() const { return budgetBytes_; }
+	int getResidentLevel(uint32_t id) const { return textures_[id].residentLevel; }
+
+private:
+	struct StreamedTexture
+	{
+		std::vector<Bitmap> mips;
+		GLuint texture = 0;
+		int residentLevel = 0;
+		int tailLevel = 0;
+		int desiredLevel = 0;
+		float footprint = 0.0f;
+		uint64_t lastUsedFrame = 0;
+		float minLod = 0.0f;
+	};
+
+	size_t getLevelsSize(const StreamedTexture& t, int firstLevel) const;
+	void setResidentLevel(StreamedTexture& t, int level);
+	bool evictFor(size_t bytesNeeded, const StreamedTexture* requester);
+
+	std::vector<StreamedTexture> textures_;
+	const size_t budgetBytes_;
+	const int tailSize_;
+	const size_t maxUploadBytesPerUpdate_;
+	size_t residentBytes_ = 0;
+	uint64_t frame_ = 0;
+};
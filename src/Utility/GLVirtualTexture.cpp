@@ -0,0 +1,453 @@
+#include "GLVirtualTexture.h"
+#include "UtilsBitmap.h"
+#include "Utils.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+bool writeVirtualTextureFile(const char* fileName, const Bitmap& image, int pageSize, int border)
+{
+	const bool isPowerOfTwo = image.w_ > 0 && (image.w_ & (image.w_ - 1)) == 0;
+
+	if (image.w_ != image.h_ || !isPowerOfTwo || image.w_ < pageSize)
+	{
+		printf("Virtual textures must be square power-of-two images of at least one page (%s)\n", fileName);
+		return false;
+	}
+
+	FILE* f = fopen(fileName, "wb");
+
+	if (!f)
+	{
+		printf("I/O error. Cannot write virtual texture '%s'\n", fileName);
+		return false;
+	}
+
+	VirtualTextureHeader header;
+	header.width = image.w_;
+	header.height = image.h_;
+	header.comp = image.comp_;
+	header.pageSize = pageSize;
+	header.border = border;
+	header.numLevels = 1 + (uint32_t)log2(image.w_ / pageSize);
+
+	fwrite(&header, sizeof(header), 1, f);
+
+	const std::vector<Bitmap> mips = generateBitmapMipChain(image);
+	const int paddedPageSize = pageSize + 2 * border;
+
+	Bitmap page(paddedPageSize, paddedPageSize, image.comp_, eBitmapFormat_UnsignedByte);
+
+	for (uint32_t level = 0; level != header.numLevels; level++)
+	{
+		const int numPages = (image.w_ / pageSize) >> level;
+		for (int y = 0; y != numPages; y++)
+		{
+			for (int x = 0; x != numPages; x++)
+			{
+				const Bitmap region = mips[level].getRegion(x * pageSize - border, y * pageSize - border, paddedPageSize, paddedPageSize);
+
+				if (region.fmt_ == eBitmapFormat_UnsignedByte)
+				{
+					fwrite(region.data_.data(), region.data_.size(), 1, f);
+					continue;
+				}
+
+				for (int j = 0; j != paddedPageSize; j++)
+					for (int i = 0; i != paddedPageSize; i++)
+						page.setPixel(i, j, glm::clamp(region.getPixel(i, j), glm::vec4(0.0f), glm::vec4(1.0f)));
+
+				fwrite(page.data_.data(), page.data_.size(), 1, f);
+			}
+		}
+	}
+
+	fclose(f);
+
+	return true;
+}
+
+GLVirtualTexture::GLVirtualTexture(const char* fileName, int cacheSizeInPages, int feedbackScale)
+	: fileName_(fileName)
+	, cacheSizeInPages_(cacheSizeInPages)
+	, slots_(cacheSizeInPages * cacheSizeInPages)
+	, feedbackScale_(feedbackScale)
+	, loaderPool_(2)
+{
+	FILE* f = fopen(fileName, "rb");
+
+	if (!f)
+	{
+		printf("I/O error. Cannot open virtual texture '%s'\n", fileName);
+		return;
+	}
+
+	const size_t numRead = fread(&header_, sizeof(header_), 1, f);
+	fclose(f);
+
+	if (numRead != 1 || header_.magic != VirtualTextureHeader().magic)
+	{
+		printf("Invalid virtual texture file '%s'\n", fileName);
+		return;
+	}
+
+	for (uint32_t l = 0; l != header_.numLevels; l++)
+	{
+		levelOffsets_.push_back(numPages_);
+		numPages_ += getNumPages(l) * getNumPages(l);
+	}
+
+	paddedPageSize_ = header_.pageSize + 2 * header_.border;
+	pageFileSize_ = (size_t)paddedPageSize_ * paddedPageSize_ * header_.comp;
+
+	pageSlots_.resize(numPages_, -1);
+	pagePending_.resize(numPages_, 0);
+
+	const int cacheSize = cacheSizeInPages_ * paddedPageSize_;
+
+	glCreateTextures(GL_TEXTURE_2D, 1, &physicalCache_);
+	glTextureParameteri(physicalCache_, GL_TEXTURE_MAX_LEVEL, 0);
+	glTextureParameteri(physicalCache_, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTextureParameteri(physicalCache_, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTextureParameteri(physicalCache_, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(physicalCache_, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTextureStorage2D(physicalCache_, 1, GL_RGBA8, cacheSize, cacheSize);
+
+	const int numPagesLevel0 = getNumPages(0);
+
+	glCreateTextures(GL_TEXTURE_2D, 1, &pageTable_);
+	glTextureParameteri(pageTable_, GL_TEXTURE_MAX_LEVEL, header_.numLevels - 1);
+	glTextureParameteri(pageTable_, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTextureParameteri(pageTable_, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTextureStorage2D(pageTable_, header_.numLevels, GL_RGBA8UI, numPagesLevel0, numPagesLevel0);
+
+	// matches VirtualTextureParams in VirtualTexture.sp
+	struct
+	{
+		glm::vec4 size;
+		glm::ivec4 pages;
+		glm::vec4 feedback;
+	} params = {
+		glm::vec4(header_.width, header_.height, header_.pageSize, header_.border),
+		glm::ivec4(numPagesLevel0, numPagesLevel0, header_.numLevels, cacheSizeInPages_),
+		// derivatives in the feedback pass are feedbackScale times larger than on screen
+		glm::vec4(-log2((float)feedbackScale_), 0.0f, 0.0f, 0.0f)
+	};
+
+	glCreateBuffers(1, &params_);
+	glNamedBufferStorage(params_, sizeof(params), &params, 0);
+
+	const GLsizeiptr requestsSize = numPages_ * sizeof(uint32_t);
+
+	glCreateBuffers(1, &requestBuffer_);
+	glNamedBufferStorage(requestBuffer_, requestsSize, nullptr, GL_DYNAMIC_STORAGE_BIT);
+	glClearNamedBufferData(requestBuffer_, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+	const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+	for (auto& r : readbacks_)
+	{
+		glCreateBuffers(1, &r.buffer);
+		glNamedBufferStorage(r.buffer, requestsSize, nullptr, flags | GL_CLIENT_STORAGE_BIT);
+		r.ptr = (const uint32_t*)glMapNamedBufferRange(r.buffer, 0, requestsSize, flags);
+	}
+
+	// the single page of the coarsest level is loaded synchronously and never evicted
+	const int rootPage = getPageIndex(header_.numLevels - 1, 0, 0);
+	std::vector<uint8_t> rgba;
+
+	if (loadPage(rootPage, rgba))
+	{
+		const int slot = allocateSlot();
+		uploadPage(slot, rgba);
+		pageSlots_[rootPage] = slot;
+		slots_[slot].page = rootPage;
+		slots_[slot].lastUsedFrame = UINT64_MAX;
+	}
+
+	updatePageTable();
+}
+
+GLVirtualTexture::~GLVirtualTexture()
+{
+	loaderPool_.waitIdle();
+
+	for (auto& r : readbacks_)
+	{
+		if (r.fence)
+			glDeleteSync(r.fence);
+		if (r.buffer)
+			glUnmapNamedBuffer(r.buffer);
+		glDeleteBuffers(1, &r.buffer);
+	}
+
+	glDeleteBuffers(1, &requestBuffer_);
+	glDeleteBuffers(1, &params_);
+	glDeleteTextures(1, &pageTable_);
+	glDeleteTextures(1, &physicalCache_);
+	glDeleteRenderbuffers(1, &feedbackDepth_);
+	glDeleteFramebuffers(1, &feedbackFramebuffer_);
+}
+
+void GLVirtualTexture::bind() const
+{
+	glBindBufferBase(GL_UNIFORM_BUFFER, 2, params_);
+	glBindTextureUnit(2, physicalCache_);
+	glBindTextureUnit(3, pageTable_);
+}
+
+void GLVirtualTexture::beginFeedbackPass(int viewportW, int viewportH)
+{
+	const int w = std::max(1, viewportW / feedbackScale_);
+	const int h = std::max(1, viewportH / feedbackScale_);
+
+	if (w != feedbackW_ || h != feedbackH_)
+	{
+		glDeleteRenderbuffers(1, &feedbackDepth_);
+		glDeleteFramebuffers(1, &feedbackFramebuffer_);
+
+		glCreateRenderbuffers(1, &feedbackDepth_);
+		glNamedRenderbufferStorage(feedbackDepth_, GL_DEPTH_COMPONENT24, w, h);
+
+		// no color attachment: the feedback shader only writes into the request buffer
+		glCreateFramebuffers(1, &feedbackFramebuffer_);
+		glNamedFramebufferRenderbuffer(feedbackFramebuffer_, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackDepth_);
+		glNamedFramebufferDrawBuffer(feedbackFramebuffer_, GL_NONE);
+
+		feedbackW_ = w;
+		feedbackH_ = h;
+	}
+
+	glGetIntegerv(GL_VIEWPORT, savedViewport_);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer_);
+	glViewport(0, 0, w, h);
+	glClear(GL_DEPTH_BUFFER_BIT);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, requestBuffer_);
+	bind();
+}
+
+void GLVirtualTexture::endFeedbackPass()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(savedViewport_[0], savedViewport_[1], savedViewport_[2], savedViewport_[3]);
+
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	// skip this frame if the CPU has not consumed the oldest readback yet
+	Readback& r = readbacks_[nextReadback_];
+
+	if (!r.fence)
+	{
+		glCopyNamedBufferSubData(requestBuffer_, r.buffer, 0, 0, numPages_ * sizeof(uint32_t));
+		r.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		nextReadback_ = (nextReadback_ + 1) % kNumReadbacks;
+	}
+
+	glClearNamedBufferData(requestBuffer_, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+}
+
+void GLVirtualTexture::update()
+{
+	if (!isValid())
+		return;
+
+	for (auto& r : readbacks_)
+	{
+		if (!r.fence)
+			continue;
+
+		const GLenum result = glClientWaitSync(r.fence, 0, 0);
+
+		if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED)
+		{
+			glDeleteSync(r.fence);
+			r.fence = nullptr;
+			processRequests(r.ptr);
+		}
+	}
+
+	std::vector<LoadedPage> loaded;
+	{
+		std::lock_guard<std::mutex> lock(loadedMutex_);
+		loaded.swap(loadedPages_);
+	}
+
+	for (const auto& p : loaded)
+	{
+		pagePending_[p.index] = 0;
+		numPendingLoads_--;
+
+		const int slot = p.texels.empty() ? -1 : allocateSlot();
+
+		if (slot < 0)
+			continue;
+
+		if (slots_[slot].page >= 0)
+			pageSlots_[slots_[slot].page] = -1;
+
+		uploadPage(slot, p.texels);
+		pageSlots_[p.index] = slot;
+		slots_[slot].page = p.index;
+		slots_[slot].lastUsedFrame = frame_;
+		pageTableDirty_ = true;
+	}
+
+	if (pageTableDirty_)
+		updatePageTable();
+
+	frame_++;
+}
+
+bool GLVirtualTexture::loadPage(int index, std::vector<uint8_t>& rgba) const
+{
+	FILE* f = fopen(fileName_.c_str(), "rb");
+
+	if (!f)
+		return false;
+
+	std::vector<uint8_t> texels(pageFileSize_);
+
+	const uint64_t offset = sizeof(VirtualTextureHeader) + (uint64_t)index * pageFileSize_;
+	const bool ok = seekFile(f, offset) && fread(texels.data(), pageFileSize_, 1, f) == 1;
+	fclose(f);
+
+	if (!ok)
+		return false;
+
+	// transcode to the RGBA8 layout of the physical cache
+	const int numTexels = paddedPageSize_ * paddedPageSize_;
+	const int comp = header_.comp;
+
+	rgba.resize(numTexels * 4);
+
+	for (int i = 0; i != numTexels; i++)
+	{
+		const uint8_t* src = &texels[i * comp];
+		uint8_t* dst = &rgba[i * 4];
+		dst[0] = src[0];
+		dst[1] = comp > 2 ? src[1] : src[0];
+		dst[2] = comp > 2 ? src[2] : src[0];
+		dst[3] = comp == 4 ? src[3] : (comp == 2 ? src[1] : 255);
+	}
+
+	return true;
+}
+
+void GLVirtualTexture::processRequests(const uint32_t* requests)
+{
+	// a requested page also wants all of its ancestors so that detail refines progressively
+	std::vector<uint8_t> wanted(numPages_, 0);
+
+	for (int level = 0; level != (int)header_.numLevels; level++)
+	{
+		const int n = getNumPages(level);
+		for (int y = 0; y != n; y++)
+		{
+			for (int x = 0; x != n; x++)
+			{
+				if (!requests[getPageIndex(level, x, y)])
+					continue;
+				for (int l = level; l != (int)header_.numLevels; l++)
+					wanted[getPageIndex(l, x >> (l - level), y >> (l - level))] = 1;
+			}
+		}
+	}
+
+	// with all levels stored one after another, walking backwards loads coarse pages first
+	for (int i = numPages_ - 1; i >= 0; i--)
+	{
+		if (!wanted[i])
+			continue;
+
+		if (pageSlots_[i] >= 0)
+		{
+			CacheSlot& s = slots_[pageSlots_[i]];
+			s.lastUsedFrame = std::max(s.lastUsedFrame, frame_);
+			continue;
+		}
+
+		if (pagePending_[i] || numPendingLoads_ >= kMaxPendingLoads)
+			continue;
+
+		pagePending_[i] = 1;
+		numPendingLoads_++;
+
+		loaderPool_.submit([this, i]()
+		{
+			LoadedPage p;
+			p.index = i;
+			loadPage(i, p.texels);
+			std::lock_guard<std::mutex> lock(loadedMutex_);
+			loadedPages_.push_back(std::move(p));
+		});
+	}
+}
+
+int GLVirtualTexture::allocateSlot()
+{
+	int lru = -1;
+
+	for (int i = 0; i != (int)slots_.size(); i++)
+	{
+		if (slots_[i].page < 0)
+			return i;
+
+		// pages used by the current frame are never evicted
+		if (slots_[i].lastUsedFrame < frame_ && (lru < 0 || slots_[i].lastUsedFrame < slots_[lru].lastUsedFrame))
+			lru = i;
+	}
+
+	return lru;
+}
+
+void GLVirtualTexture::uploadPage(int slot, const std::vector<uint8_t>& rgba)
+{
+	const int x = (slot % cacheSizeInPages_) * paddedPageSize_;
+	const int y = (slot / cacheSizeInPages_) * paddedPageSize_;
+
+	glTextureSubImage2D(physicalCache_, 0, x, y, paddedPageSize_, paddedPageSize_, GL_RGBA, GL_UNSIGNED_BYTE, rgba.data());
+}
+
+void GLVirtualTexture::updatePageTable()
+{
+	std::vector<uint8_t> parent;
+
+	// from the coarsest level down: non-resident pages inherit the entry of their parent
+	for (int level = (int)header_.numLevels - 1; level >= 0; level--)
+	{
+		const int n = getNumPages(level);
+		std::vector<uint8_t> entries(n * n * 4);
+
+		for (int y = 0; y != n; y++)
+		{
+			for (int x = 0; x != n; x++)
+			{
+				uint8_t* e = &entries[(y * n + x) * 4];
+				const int slot = pageSlots_[getPageIndex(level, x, y)];
+
+				if (slot >= 0)
+				{
+					e[0] = uint8_t(slot % cacheSizeInPages_);
+					e[1] = uint8_t(slot / cacheSizeInPages_);
+					e[2] = uint8_t(level);
+					e[3] = 255;
+				}
+				else if (!parent.empty())
+				{
+					memcpy(e, &parent[((y / 2) * (n / 2) + x / 2) * 4], 4);
+				}
+			}
+		}
+
+		glTextureSubImage2D(pageTable_, level, 0, 0, n, n, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, entries.data());
+
+		parent.swap(entries);
+	}
+
+	pageTableDirty_ = false;
+}
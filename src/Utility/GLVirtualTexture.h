@@ -0,0 +1,132 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <stdint.h>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Bitmap.h"
+#include "ThreadPool.h"
+
+/// Tiled on-disk layout of a virtual texture: this header followed by all pages of all levels,
+/// level 0 first and pages of a level in row-major order. Every page is pageSize + 2 * border
+/// texels wide and stores 8-bit texels with 'comp' components.
+struct VirtualTextureHeader
+{
+	uint32_t magic = 0x30585456; // "VTX0"
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t comp = 0;
+	uint32_t pageSize = 0;
+	uint32_t border = 0;
+	uint32_t numLevels = 0;
+};
+
+/// Cuts a square power-of-two image and its mip chain into bordered pages and writes the tiled file.
+/// The whole image and its full mip chain are held in memory while writing, so this is an offline
+/// step for images which fit in RAM; non-8-bit images are clamped to 8 bits per component.
+bool writeVirtualTextureFile(const char* fileName, const Bitmap& image, int pageSize = 128, int border = 4);
+
+/// Software virtual texturing: a physical page cache texture, an RGBA8UI indirection texture
+/// (one mip level per virtual level) and a low-resolution feedback pass whose page requests
+/// are written into an SSBO and read back asynchronously a few frames later.
+/// Requested pages are read from the tiled file on worker threads; "transcoding" only expands
+/// their 1-4 components to the RGBA8 of the page cache, no block compression is involved.
+/// The coarsest level is a single page which stays resident, so every lookup has a fallback.
+/// Shader side: res/shaders/VirtualTexture.sp, GL03_duck_vt.frag and GL03_vt_feedback.frag.
+/// The demo textures the duck through it with --virtual-texture; unverified on a GPU.
+class GLVirtualTexture
+{
+public:
+	explicit GLVirtualTexture(const char* fileName, int cacheSizeInPages = 16, int feedbackScale = 8);
+	~GLVirtualTexture();
+
+	GLVirtualTexture(const GLVirtualTexture&) = delete;
+	GLVirtualTexture& operator=(const GLVirtualTexture&) = delete;
+
+	bool isValid() const { return pageTable_ != 0; }
+
+	/// binds the physical cache, the page table and the parameter block used by VirtualTexture.sp
+	void bind() const;
+
+	/// Redirects rendering into a low-resolution depth-only framebuffer.
+	/// Draw the visible geometry with GL03_vt_feedback.frag between begin and end.
+	void beginFeedbackPass(int viewportW, int viewportH);
+	void endFeedbackPass();
+
+	/// Consumes finished feedback readbacks, schedules page loads and uploads loaded pages.
+	/// Call once per frame.
+	void update();
+
+private:
+	struct LoadedPage
+	{
+		int index = 0;
+		std::vector<uint8_t> texels;
+	};
+
+	struct Readback
+	{
+		GLuint buffer = 0;
+		const uint32_t* ptr = nullptr;
+		GLsync fence = nullptr;
+	};
+
+	struct CacheSlot
+	{
+		int page = -1;
+		uint64_t lastUsedFrame = 0;
+	};
+
+	static constexpr int kNumReadbacks = 3;
+	static constexpr int kMaxPendingLoads = 32;
+
+	int getNumPages(int level) const { return std::max(1, (int)(header_.width / header_.pageSize) >> level); }
+	int getPageIndex(int level, int x, int y) const { return levelOffsets_[level] + y * getNumPages(level) + x; }
+
+	bool loadPage(int index, std::vector<uint8_t>& rgba) const;
+	void processRequests(const uint32_t* requests);
+	int allocateSlot();
+	void uploadPage(int slot, const std::vector<uint8_t>& rgba);
+	void updatePageTable();
+
+	std::string fileName_;
+	VirtualTextureHeader header_;
+	std::vector<int> levelOffsets_;
+	int numPages_ = 0;
+	int paddedPageSize_ = 0;
+	size_t pageFileSize_ = 0;
+
+	// residency of every virtual page
+	std::vector<int> pageSlots_;
+	std::vector<uint8_t> pagePending_;
+	int numPendingLoads_ = 0;
+
+	const int cacheSizeInPages_;
+	std::vector<CacheSlot> slots_;
+	uint64_t frame_ = 1;
+	bool pageTableDirty_ = true;
+
+	GLuint physicalCache_ = 0;
+	GLuint pageTable_ = 0;
+	GLuint params_ = 0;
+	GLuint requestBuffer_ = 0;
+	Readback readbacks_[kNumReadbacks];
+	int nextReadback_ = 0;
+
+	const int feedbackScale_;
+	GLuint feedbackFramebuffer_ = 0;
+	GLuint feedbackDepth_ = 0;
+	int feedbackW_ = 0;
+	int feedbackH_ = 0;
+	GLint savedViewport_[4] = {};
+
+	std::mutex loadedMutex_;
+	std::vector<LoadedPage> loadedPages_;
+
+	// declared last so the loaders are joined before anything they touch is destroyed
+	ThreadPool loaderPool_;
+};
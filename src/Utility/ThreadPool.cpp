@@ -0,0 +1,130 @@
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <memory>
+
+ThreadPool::ThreadPool(unsigned numThreads)
+{
+	if (!numThreads)
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	threads_.reserve(numThreads);
+
+	for (unsigned i = 0; i != numThreads; i++)
+		threads_.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	jobAvailable_.notify_all();
+
+	for (auto& t : threads_)
+		t.join();
+}
+
+void ThreadPool::submit(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		jobs_.push_back(std::move(job));
+	}
+	jobAvailable_.notify_one();
+}
+
+void ThreadPool::waitIdle()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	idle_.wait(lock, [this]() { return jobs_.empty() && numBusy_ == 0; });
+}
+
+void ThreadPool::parallelFor(int begin, int end, const std::function<void(int)>& f)
+{
+	if (begin >= end)
+		return;
+
+	// helpers which start after the last index was taken only touch this state, never f
+	struct State
+	{
+		std::atomic<int> next;
+		std::atomic<int> numDone;
+		int end;
+		int count;
+		const std::function<void(int)>* f;
+		std::mutex mutex;
+		std::condition_variable done;
+	};
+
+	const std::shared_ptr<State> state = std::make_shared<State>();
+	state->next = begin;
+	state->numDone = 0;
+	state->end = end;
+	state->count = end - begin;
+	state->f = &f;
+
+	auto run = [state]()
+	{
+		for (;;)
+		{
+			const int i = state->next++;
+			if (i >= state->end)
+				return;
+
+			(*state->f)(i);
+
+			if (++state->numDone == state->count)
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				state->done.notify_all();
+			}
+		}
+	};
+
+	const int numHelpers = std::min(state->count - 1, (int)threads_.size());
+
+	for (int i = 0; i < numHelpers; i++)
+		submit(run);
+
+	run();
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->done.wait(lock, [&state]() { return state->numDone == state->count; });
+}
+
+ThreadPool& ThreadPool::getShared()
+{
+	static ThreadPool pool(std::max(2u, std::thread::hardware_concurrency()) - 1);
+	return pool;
+}
+
+void ThreadPool::workerLoop()
+{
+	for (;;)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			jobAvailable_.wait(lock, [this]() { return stop_ || !jobs_.empty(); });
+
+			// drain the remaining jobs before shutting down
+			if (jobs_.empty())
+				return;
+
+			job = std::move(jobs_.front());
+			jobs_.pop_front();
+			numBusy_++;
+		}
+
+		job();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			numBusy_--;
+			if (jobs_.empty() && !numBusy_)
+				idle_.notify_all();
+		}
+	}
+}
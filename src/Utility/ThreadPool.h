@@ -0,0 +1,46 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Fixed-size pool of worker threads consuming a FIFO job queue
+class ThreadPool
+{
+public:
+	/// numThreads == 0 means one worker per hardware thread
+	explicit ThreadPool(unsigned numThreads = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void submit(std::function<void()> job);
+
+	/// blocks until the queue is empty and no job is running
+	void waitIdle();
+
+	/// Calls f(i) for every i in [begin, end) on the workers and on the calling thread and returns
+	/// when all calls are done. The caller takes indices itself, so nesting inside a job cannot deadlock.
+	void parallelFor(int begin, int end, const std::function<void(int)>& f);
+
+	unsigned getNumThreads() const { return (unsigned)threads_.size(); }
+
+	/// process-wide pool for data-parallel work, one worker less than hardware threads as the caller helps out
+	static ThreadPool& getShared();
+
+private:
+	void workerLoop();
+
+	std::vector<std::thread> threads_;
+	std::deque<std::function<void()>> jobs_;
+	std::mutex mutex_;
+	std::condition_variable jobAvailable_;
+	std::condition_variable idle_;
+	unsigned numBusy_ = 0;
+	bool stop_ = false;
+};
@@ -32,6 +32,15 @@ void printShaderSource(const char* text)
 	printf("\n");
 }
 
+bool seekFile(FILE* f, uint64_t offset)
+{
+#if defined(_WIN32)
+	return _fseeki64(f, (long long)offset, SEEK_SET) == 0;
+#else
+	return fseeko(f, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
 int endsWith(const char* s, const char* part)
 {
 	return (strstr(s, part) - s) == (strlen(s) - strlen(part));
@@ -5,6 +5,8 @@
 #endif // _CRT_SECURE_NO_WARNINGS
 
 #include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include <algorithm>
 #include <string>
@@ -16,6 +18,9 @@ std::string readShaderFile(const char* fileName);
 
 void printShaderSource(const char* text);
 
+/// 64-bit absolute seek, plain fseek() takes a 32-bit long on Windows
+bool seekFile(FILE* f, uint64_t offset);
+
 template <typename T>
 inline void mergeVectors(std::vector<T>& v1, const std::vector<T>& v2)
 {
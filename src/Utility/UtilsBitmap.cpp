@@ -0,0 +1,217 @@
+#include "UtilsBitmap.h"
+#include "BitmapSampler.h"
+#include "BitmapView.h"
+#include "ThreadPool.h"
+
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include "stb_image_resize2.h"
+#include <stb/stb_image.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+template <eBitmapFormat Format, int Comp, eBitmapLayout Layout>
+void downsampleBitmap2x(const Bitmap& b, Bitmap& result)
+{
+	// a bilinear tap halfway between 2x2 texels is their box filter
+	const BitmapSampler<Format, Comp, Layout> src(b, eBitmapFilter_Bilinear);
+	const BitmapView<Format, Comp> dst(result);
+
+	std::vector<float> sx(result.w_);
+	std::vector<float> sy(result.w_);
+	std::vector<glm::vec4> colors(result.w_);
+
+	for (int x = 0; x != result.w_; x++)
+		sx[x] = 2.0f * x + 0.5f;
+
+	for (int y = 0; y != result.h_; y++)
+	{
+		std::fill(sy.begin(), sy.end(), 2.0f * y + 0.5f);
+		src.sample(sx.data(), sy.data(), colors.data(), result.w_);
+		for (int x = 0; x != result.w_; x++)
+			dst.setPixel(x, y, colors[x]);
+	}
+}
+
+struct DownsampleBitmap2x
+{
+	const Bitmap& src;
+	Bitmap& dst;
+
+	template <eBitmapFormat Format, int Comp, eBitmapLayout Layout>
+	void operator()(BitmapFormatTag<Format, Comp, Layout>) const
+	{
+		downsampleBitmap2x<Format, Comp, Layout>(src, dst);
+	}
+};
+
+Bitmap downsampleBitmap2x(const Bitmap& b)
+{
+	Bitmap result(std::max(1, b.w_ / 2), std::max(1, b.h_ / 2), b.comp_, b.fmt_);
+
+	const DownsampleBitmap2x kernel = { b, result };
+	dispatchBitmapFormat(b, kernel);
+
+	return result;
+}
+
+std::vector<Bitmap> generateBitmapMipChain(const Bitmap& b)
+{
+	std::vector<Bitmap> mips;
+	mips.push_back(b);
+
+	while (mips.back().w_ > 1 || mips.back().h_ > 1)
+		mips.push_back(downsampleBitmap2x(mips.back()));
+
+	return mips;
+}
+
+struct ConvertBitmapLayout
+{
+	const Bitmap& src;
+	Bitmap& dst;
+
+	template <eBitmapFormat Format, int Comp, eBitmapLayout Layout>
+	void operator()(BitmapFormatTag<Format, Comp, Layout>) const
+	{
+		switch (dst.getLayout())
+		{
+		case eBitmapLayout_Linear: copy<Format, Comp, Layout, eBitmapLayout_Linear>(); break;
+		case eBitmapLayout_Tiled: copy<Format, Comp, Layout, eBitmapLayout_Tiled>(); break;
+		case eBitmapLayout_Morton: copy<Format, Comp, Layout, eBitmapLayout_Morton>(); break;
+		}
+	}
+
+	template <eBitmapFormat Format, int Comp, eBitmapLayout From, eBitmapLayout To>
+	void copy() const
+	{
+		typedef typename BitmapFormatTraits<Format>::Component Component;
+
+		const Component* s = reinterpret_cast<const Component*>(src.data_.data());
+		Component* d = reinterpret_cast<Component*>(dst.data_.data());
+
+		const BitmapAddressing& from = src.addressing_;
+		const BitmapAddressing& to = dst.addressing_;
+
+		for (int y = 0; y != src.h_; y++)
+			for (int x = 0; x != src.w_; x++)
+				memcpy(d + Comp * to.index<To>(x, y), s + Comp * from.index<From>(x, y), Comp * sizeof(Component));
+	}
+};
+
+Bitmap convertBitmapLayout(const Bitmap& b, eBitmapLayout layout)
+{
+	assert(b.d_ == 1);
+
+	Bitmap result(b.w_, b.h_, b.comp_, b.fmt_, layout);
+	result.type_ = b.type_;
+
+	const ConvertBitmapLayout kernel = { b, result };
+	dispatchBitmapFormat(b, kernel);
+
+	return result;
+}
+
+bool loadBitmap(const char* fileName, Bitmap& b)
+{
+	int w, h, comp;
+	uint8_t* pixels = stbi_load(fileName, &w, &h, &comp, 0);
+	if (!pixels)
+	{
+		printf("Unable to load %s\n", fileName);
+		return false;
+	}
+
+	b = Bitmap(w, h, comp, eBitmapFormat_UnsignedByte, BitmapStorage::adopt(pixels, (size_t)w * h * comp, stbi_image_free));
+	return true;
+}
+
+stbir_datatype getResizeDataType(eBitmapFormat fmt)
+{
+	switch (fmt)
+	{
+	case eBitmapFormat_UnsignedByte: return STBIR_TYPE_UINT8;
+	case eBitmapFormat_UnsignedShort: return STBIR_TYPE_UINT16;
+	case eBitmapFormat_HalfFloat: return STBIR_TYPE_HALF_FLOAT;
+	case eBitmapFormat_Float: return STBIR_TYPE_FLOAT;
+	default:
+		assert(false);
+		return STBIR_TYPE_FLOAT;
+	}
+}
+
+stbir_pixel_layout getResizePixelLayout(int comp)
+{
+	switch (comp)
+	{
+	case 1: return STBIR_1CHANNEL;
+	case 2: return STBIR_2CHANNEL;
+	case 3: return STBIR_RGB;
+	default: return STBIR_RGBA;
+	}
+}
+
+BitmapResizer::BitmapResizer()
+{
+	memset(&resize_, 0, sizeof(resize_));
+}
+
+BitmapResizer::~BitmapResizer()
+{
+	stbir_free_samplers(&resize_);
+}
+
+void BitmapResizer::resize(const Bitmap& src, Bitmap& dst, stbir_filter filter, stbir_edge edge)
+{
+	assert(src.d_ == 1 && dst.d_ == 1);
+	assert(src.fmt_ == dst.fmt_ && src.comp_ == dst.comp_);
+	assert(src.getLayout() == eBitmapLayout_Linear && dst.getLayout() == eBitmapLayout_Linear);
+	assert(!Bitmap::isPackedFormat(src.fmt_));
+
+	if (src.w_ != srcW_ || src.h_ != srcH_ || dst.w_ != dstW_ || dst.h_ != dstH_ ||
+		src.comp_ != comp_ || src.fmt_ != fmt_ || filter != filter_ || edge != edge_)
+	{
+		stbir_free_samplers(&resize_);
+
+		srcW_ = src.w_;
+		srcH_ = src.h_;
+		dstW_ = dst.w_;
+		dstH_ = dst.h_;
+		comp_ = src.comp_;
+		fmt_ = src.fmt_;
+		filter_ = filter;
+		edge_ = edge;
+
+		stbir_resize_init(&resize_, nullptr, srcW_, srcH_, 0, nullptr, dstW_, dstH_, 0, getResizePixelLayout(comp_), getResizeDataType(fmt_));
+		stbir_set_edgemodes(&resize_, edge, edge);
+		stbir_set_filters(&resize_, filter, filter);
+
+		// one stripe per worker plus one for the calling thread
+		numSplits_ = stbir_build_samplers_with_splits(&resize_, (int)ThreadPool::getShared().getNumThreads() + 1);
+	}
+
+	if (!numSplits_)
+		return;
+
+	stbir_set_buffer_ptrs(&resize_, src.data_.data(), 0, dst.data_.data(), 0);
+
+	STBIR_RESIZE* r = &resize_;
+	ThreadPool::getShared().parallelFor(0, numSplits_, [r](int split) { stbir_resize_extended_split(r, split, 1); });
+}
+
+Bitmap resizeBitmap(const Bitmap& b, int w, int h, stbir_filter filter, stbir_edge edge)
+{
+	if (b.getLayout() != eBitmapLayout_Linear)
+		return resizeBitmap(convertBitmapLayout(b, eBitmapLayout_Linear), w, h, filter, edge);
+
+	Bitmap result(w, h, b.comp_, b.fmt_);
+	result.type_ = b.type_;
+
+	static thread_local BitmapResizer resizer;
+	resizer.resize(b, result, filter, edge);
+
+	return result;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Bitmap.h"
+
+#include "stb_image_resize2.h"
+
+/// 2x2 box filter, odd sizes replicate the last row/column
+Bitmap downsampleBitmap2x(const Bitmap& b);
+
+/// Full mip chain down to 1x1, level 0 is a copy of the input
+std::vector<Bitmap> generateBitmapMipChain(const Bitmap& b);
+
+/// Re-packs the pixels into another storage layout (Bitmap::getRegion() and GL uploads expect linear data)
+Bitmap convertBitmapLayout(const Bitmap& b, eBitmapLayout layout);
+
+/// Decodes an 8-bit image file (PNG, JPEG, ...) with stb_image into a linear bitmap with the components of the file
+bool loadBitmap(const char* fileName, Bitmap& b);
+
+/// Resizes linear 2D bitmaps with stb_image_resize2. Output rows are split into stripes which run on
+/// ThreadPool::getShared(); the filter setup is kept and reused while sizes, format and filter stay the same.
+class BitmapResizer
+{
+public:
+	BitmapResizer();
+	~BitmapResizer();
+
+	BitmapResizer(const BitmapResizer&) = delete;
+	BitmapResizer& operator=(const BitmapResizer&) = delete;
+
+	/// dst provides the output size and must have the format and components of src (no packed formats)
+	void resize(const Bitmap& src, Bitmap& dst, stbir_filter filter = STBIR_FILTER_DEFAULT, stbir_edge edge = STBIR_EDGE_CLAMP);
+
+private:
+	STBIR_RESIZE resize_;
+	int numSplits_ = 0;
+	int srcW_ = 0;
+	int srcH_ = 0;
+	int dstW_ = 0;
+	int dstH_ = 0;
+	int comp_ = 0;
+	eBitmapFormat fmt_ = eBitmapFormat_UnsignedByte;
+	stbir_filter filter_ = STBIR_FILTER_DEFAULT;
+	stbir_edge edge_ = STBIR_EDGE_CLAMP;
+};
+
+/// Resized copy of a 2D bitmap using a per-thread BitmapResizer, the result has a linear layout
+Bitmap resizeBitmap(const Bitmap& b, int w, int h, stbir_filter filter = STBIR_FILTER_DEFAULT, stbir_edge edge = STBIR_EDGE_CLAMP);
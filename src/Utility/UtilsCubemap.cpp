@@ -1,15 +1,28 @@
-﻿#include "UtilsMath.h"
+﻿#include "Utils.h"
+#include "UtilsMath.h"
 #include "UtilsCubemap.h"
+#include "UtilsBitmap.h"
+#include "UtilsHDR.h"
+#include "UtilsPixelFormat.h"
+#include "BitmapSampler.h"
+#include "BitmapView.h"
+#include "ThreadPool.h"
+#include "UtilsSIMD.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <string>
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 
-#define STB_IMAGE_RESIZE_IMPLEMENTATION
-#include "stb_image_resize2.h"
-
 #define M_PI   3.14159265358979323846264338327950288
 
+const float kInvPi = 0.318309886f;
+
 
 using glm::vec2;
 using glm::vec3;
@@ -36,87 +49,438 @@ vec2 hammersley2d(uint32_t i, uint32_t N)
     return vec2(float(i)/float(N), radicalInverse_VdC(i));
 }
 
-void convolveDiffuse(const vec3* data, int srcW, int srcH, int dstW, int dstH, vec3* output, int numMonteCarloSamples)
+/// Hammersley samples of the prefiltered environment as structure of arrays, padded to a multiple of 8 with
+/// zero directions which never pass the cosine threshold
+struct DiffuseSamples
 {
-	// only equirectangular maps are supported
-	assert(srcW == 2 * srcH);
-
-	if (srcW != 2 * srcH) return;
-
-	std::vector<vec3> tmp(dstW * dstH);
-
-	stbir_resize(reinterpret_cast<const float*>(data),
-               srcW,
-               srcH,
-               0,
-               reinterpret_cast<float*>(tmp.data()),
-               dstW,
-               dstH,
-               0,
-               STBIR_RGB,
-               STBIR_TYPE_FLOAT,
-               STBIR_EDGE_CLAMP,
-               STBIR_FILTER_CUBICBSPLINE);
-
-	const vec3* scratch = tmp.data();
-	srcW = dstW;
-	srcH = dstH;
-
-	for (int y = 0; y != dstH; y++)
-	{
-		printf("Line %i...\n", y);
-		const float theta1 = float(y) / float(dstH) * Math::PI;
-		for (int x = 0; x != dstW; x++)
-		{
-			const float phi1 = float(x) / float(dstW) * Math::TWOPI;
-			const vec3 V1 = vec3(sin(theta1) * cos(phi1), sin(theta1) * sin(phi1), cos(theta1));
-			vec3 color = vec3(0.0f);
-			float weight = 0.0f;
-			for (int i = 0; i != numMonteCarloSamples; i++)
-			{
-				const vec2 h = hammersley2d(i, numMonteCarloSamples);
-				const int x1 = int(floor(h.x * srcW));
-				const int y1 = int(floor(h.y * srcH));
-				const float theta2 = float(y1) / float(srcH) * Math::PI;
-				const float phi2 = float(x1) / float(srcW) * Math::TWOPI;
-				const vec3 V2 = vec3(sin(theta2) * cos(phi2), sin(theta2) * sin(phi2), cos(theta2));
-				const float D = std::max(0.0f, glm::dot(V1, V2));
-				if (D > 0.01f)
-				{
-					color += scratch[y1 * srcW + x1] * D;
-					weight += D;
-				}
+	std::vector<float> x, y, z;
+	std::vector<float> r, g, b;
+
+	explicit DiffuseSamples(int numSamples)
+	{
+		const size_t n = (numSamples + 7) & ~7;
+		x.resize(n);
+		y.resize(n);
+		z.resize(n);
+		r.resize(n);
+		g.resize(n);
+		b.resize(n);
+	}
+};
+
+/// Adds up the 8 partial sums of the lanes, the same order for both the scalar and the AVX2 path
+float sumDiffuseLanes(const float* lanes)
+{
+	float sum = 0.0f;
+	for (int l = 0; l != 8; l++)
+		sum += lanes[l];
+	return sum;
+}
+
+/// Cosine weighted average of the samples around V, accumulated in 8 interleaved lanes
+vec3 accumulateDiffuseSamplesScalar(const DiffuseSamples& s, const vec3& V)
+{
+	float r[8] = {}, g[8] = {}, b[8] = {}, w[8] = {};
+
+	for (size_t i = 0; i != s.x.size(); i += 8)
+	{
+		for (int l = 0; l != 8; l++)
+		{
+			const float D = V.x * s.x[i + l] + V.y * s.y[i + l] + V.z * s.z[i + l];
+			if (D > 0.01f)
+			{
+				r[l] += s.r[i + l] * D;
+				g[l] += s.g[i + l] * D;
+				b[l] += s.b[i + l] * D;
+				w[l] += D;
+			}
+		}
+	}
+
+	return vec3(sumDiffuseLanes(r), sumDiffuseLanes(g), sumDiffuseLanes(b)) / sumDiffuseLanes(w);
+}
+
+#if defined(UTILS_SIMD_X86)
+UTILS_SIMD_TARGET_AVX2 vec3 accumulateDiffuseSamplesAVX2(const DiffuseSamples& s, const vec3& V)
+{
+	const __m256 vx = _mm256_set1_ps(V.x);
+	const __m256 vy = _mm256_set1_ps(V.y);
+	const __m256 vz = _mm256_set1_ps(V.z);
+	const __m256 threshold = _mm256_set1_ps(0.01f);
+
+	__m256 r = _mm256_setzero_ps();
+	__m256 g = _mm256_setzero_ps();
+	__m256 b = _mm256_setzero_ps();
+	__m256 w = _mm256_setzero_ps();
+
+	for (size_t i = 0; i != s.x.size(); i += 8)
+	{
+		const __m256 dot = _mm256_add_ps(_mm256_add_ps(
+			_mm256_mul_ps(vx, _mm256_loadu_ps(&s.x[i])),
+			_mm256_mul_ps(vy, _mm256_loadu_ps(&s.y[i]))),
+			_mm256_mul_ps(vz, _mm256_loadu_ps(&s.z[i])));
+		const __m256 D = _mm256_and_ps(_mm256_cmp_ps(dot, threshold, _CMP_GT_OQ), dot);
+		r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_loadu_ps(&s.r[i]), D));
+		g = _mm256_add_ps(g, _mm256_mul_ps(_mm256_loadu_ps(&s.g[i]), D));
+		b = _mm256_add_ps(b, _mm256_mul_ps(_mm256_loadu_ps(&s.b[i]), D));
+		w = _mm256_add_ps(w, D);
+	}
+
+	float lanes[4][8];
+	_mm256_storeu_ps(lanes[0], r);
+	_mm256_storeu_ps(lanes[1], g);
+	_mm256_storeu_ps(lanes[2], b);
+	_mm256_storeu_ps(lanes[3], w);
+
+	return vec3(sumDiffuseLanes(lanes[0]), sumDiffuseLanes(lanes[1]), sumDiffuseLanes(lanes[2])) / sumDiffuseLanes(lanes[3]);
+}
+#endif
+
+/// Equirectangular direction convention of convolveDiffuse(): theta from +Z at the top row, phi along the rows
+vec3 getDiffuseDirection(float theta, float phi)
+{
+	return vec3(sin(theta) * cos(phi), sin(theta) * sin(phi), cos(theta));
+}
+
+glm::vec3 getCubeFaceDirection(int face, float a, float b)
+{
+	switch (face)
+	{
+	case 0: return vec3(1.0f, -b, -a);
+	case 1: return vec3(-1.0f, -b, a);
+	case 2: return vec3(a, 1.0f, b);
+	case 3: return vec3(a, -1.0f, -b);
+	case 4: return vec3(a, -b, 1.0f);
+	default: return vec3(-a, -b, -1.0f);
+	}
+}
+
+int getCubeFaceCoords(const glm::vec3& dir, float& s, float& t)
+{
+	const vec3 a = glm::abs(dir);
+
+	int face;
+	float sc, tc, ma;
+	if (a.x >= a.y && a.x >= a.z)
+	{
+		face = dir.x > 0.0f ? 0 : 1;
+		sc = dir.x > 0.0f ? -dir.z : dir.z;
+		tc = -dir.y;
+		ma = a.x;
+	}
+	else if (a.y >= a.z)
+	{
+		face = dir.y > 0.0f ? 2 : 3;
+		sc = dir.x;
+		tc = dir.y > 0.0f ? dir.z : -dir.z;
+		ma = a.y;
+	}
+	else
+	{
+		face = dir.z > 0.0f ? 4 : 5;
+		sc = dir.z > 0.0f ? dir.x : -dir.x;
+		tc = -dir.y;
+		ma = a.z;
+	}
+
+	s = 0.5f * (sc / ma + 1.0f);
+	t = 0.5f * (tc / ma + 1.0f);
+
+	return face;
+}
+
+/// Texel of a GL cube map (faces stacked as rows of a faceSize x 6 * faceSize image) hit by the direction
+/// convertEquirectangularMapToCubeMapFaces() maps to the equirectangular direction V
+ivec2 getCubeMapTexel(const vec3& V, int faceSize)
+{
+	float s, t;
+	const int face = getCubeFaceCoords(vec3(V.y, V.z, V.x), s, t);
+
+	return ivec2(glm::clamp(int(s * faceSize), 0, faceSize - 1), face * faceSize + glm::clamp(int(t * faceSize), 0, faceSize - 1));
+}
+
+bool convolveDiffuse(const Bitmap& src, int dstW, int dstH, int numMonteCarloSamples, Bitmap& dst, const ConvolutionProgressCallback& progress)
+{
+	const bool isCube = src.type_ == eBitmapType_Cube;
+
+	assert(!isCube || (src.w_ == src.h_ && src.d_ == 6));
+
+	if (src.getLayout() != eBitmapLayout_Linear)
+		return convolveDiffuse(convertBitmapLayout(src, eBitmapLayout_Linear), dstW, dstH, numMonteCarloSamples, dst, progress);
+
+	if (src.fmt_ != eBitmapFormat_Float || src.comp_ < 3)
+		return convolveDiffuse(convertBitmapFormat(src, eBitmapFormat_Float), dstW, dstH, numMonteCarloSamples, dst, progress);
+
+	// the samples are point lookups, so the environment is low-pass filtered to roughly the output resolution first
+	static thread_local BitmapResizer resizer;
+
+	const int faceSize = isCube ? std::max(1, int(sqrt(dstW * dstH / 6.0))) : 0;
+	const int filteredW = isCube ? faceSize : dstW;
+	const int filteredH = isCube ? 6 * faceSize : dstH;
+	const size_t srcFaceSize = (size_t)src.w_ * src.h_ * Bitmap::getBytesPerPixel(src.fmt_, src.comp_);
+
+	Bitmap filtered(filteredW, filteredH, src.comp_, eBitmapFormat_Float);
+
+	for (int face = 0; face != (isCube ? 6 : 1); face++)
+	{
+		const size_t dstFaceSize = filtered.data_.size() / (isCube ? 6 : 1);
+		const Bitmap srcFace(src.w_, src.h_, src.comp_, src.fmt_,
+			BitmapStorage::borrow(const_cast<uint8_t*>(src.data_.data()) + face * srcFaceSize, srcFaceSize));
+		Bitmap dstFace(filteredW, isCube ? faceSize : filteredH, src.comp_, eBitmapFormat_Float,
+			BitmapStorage::borrow(filtered.data_.data() + face * dstFaceSize, dstFaceSize));
+
+		resizer.resize(srcFace, dstFace, STBIR_FILTER_CUBICBSPLINE, STBIR_EDGE_CLAMP);
+	}
+
+	// the sample directions and the texels they hit do not depend on the output texel
+	DiffuseSamples samples(numMonteCarloSamples);
+
+	for (int i = 0; i != numMonteCarloSamples; i++)
+	{
+		const vec2 h = hammersley2d(i, numMonteCarloSamples);
+
+		vec3 dir;
+		ivec2 texel;
+		if (isCube)
+		{
+			dir = getDiffuseDirection(h.y * Math::PI, h.x * Math::TWOPI);
+			texel = getCubeMapTexel(dir, faceSize);
+		}
+		else
+		{
+			texel = ivec2(int(floor(h.x * dstW)), int(floor(h.y * dstH)));
+			dir = getDiffuseDirection(float(texel.y) / float(dstH) * Math::PI, float(texel.x) / float(dstW) * Math::TWOPI);
+		}
+
+		const vec4 color = filtered.getPixel(texel.x, texel.y);
+		samples.x[i] = dir.x;
+		samples.y[i] = dir.y;
+		samples.z[i] = dir.z;
+		samples.r[i] = color.r;
+		samples.g[i] = color.g;
+		samples.b[i] = color.b;
+	}
+
+	if (dst.w_ != dstW || dst.h_ != dstH || dst.d_ != 1 || dst.comp_ != 3 || dst.fmt_ != eBitmapFormat_Float || dst.getLayout() != eBitmapLayout_Linear)
+		dst = Bitmap(dstW, dstH, 3, eBitmapFormat_Float);
+
+	dst.type_ = eBitmapType_2D;
+
+	vec3* output = reinterpret_cast<vec3*>(dst.data_.data());
+
+#if defined(UTILS_SIMD_X86)
+	vec3 (*accumulate)(const DiffuseSamples&, const vec3&) = hasAVX2F16C() ? accumulateDiffuseSamplesAVX2 : accumulateDiffuseSamplesScalar;
+#else
+	vec3 (*accumulate)(const DiffuseSamples&, const vec3&) = accumulateDiffuseSamplesScalar;
+#endif
+
+	const int tileSize = 16;
+	const int tilesX = (dstW + tileSize - 1) / tileSize;
+	const int tilesY = (dstH + tileSize - 1) / tileSize;
+	const int numTiles = tilesX * tilesY;
+
+	std::mutex progressMutex;
+	int tilesDone = 0;
+	std::atomic<bool> canceled(false);
+
+	ThreadPool::getShared().parallelFor(0, numTiles, [&](int tile)
+	{
+		if (canceled)
+			return;
+
+		const int x0 = (tile % tilesX) * tileSize;
+		const int y0 = (tile / tilesX) * tileSize;
+		const int x1 = std::min(dstW, x0 + tileSize);
+		const int y1 = std::min(dstH, y0 + tileSize);
+
+		for (int y = y0; y != y1; y++)
+		{
+			const float theta1 = float(y) / float(dstH) * Math::PI;
+			for (int x = x0; x != x1; x++)
+			{
+				const float phi1 = float(x) / float(dstW) * Math::TWOPI;
+				output[y * dstW + x] = accumulate(samples, getDiffuseDirection(theta1, phi1));
 			}
-			output[y * dstW + x] = color / weight;
 		}
+
+		if (progress)
+		{
+			std::lock_guard<std::mutex> lock(progressMutex);
+			if (!canceled && !progress(++tilesDone, numTiles))
+				canceled = true;
+		}
+	});
+
+	return !canceled;
+}
+
+void convolveDiffuse(const vec3* data, int srcW, int srcH, int dstW, int dstH, vec3* output, int numMonteCarloSamples)
+{
+	const Bitmap src(srcW, srcH, 3, eBitmapFormat_Float, BitmapStorage::borrow(const_cast<vec3*>(data), (size_t)srcW * srcH * sizeof(vec3)));
+	Bitmap dst(dstW, dstH, 3, eBitmapFormat_Float, BitmapStorage::borrow(output, (size_t)dstW * dstH * sizeof(vec3)));
+
+	convolveDiffuse(src, dstW, dstH, numMonteCarloSamples, dst);
+}
+
+/// Cube face directions as base + A * dirA + B * dirB with A, B = 2 * (column, row) / faceSize
+struct FaceBasis
+{
+	vec3 base;
+	vec3 dirA;
+	vec3 dirB;
+};
+
+const FaceBasis kFaceBases[] =
+{
+	{ vec3(-1.0f, -1.0f, -1.0f), vec3( 0.0f, 1.0f, 0.0f), vec3( 0.0f, 0.0f,  1.0f) },
+	{ vec3(-1.0f, -1.0f,  1.0f), vec3( 1.0f, 0.0f, 0.0f), vec3( 0.0f, 0.0f, -1.0f) },
+	{ vec3( 1.0f, -1.0f,  1.0f), vec3( 0.0f, 1.0f, 0.0f), vec3( 0.0f, 0.0f, -1.0f) },
+	{ vec3( 1.0f,  1.0f,  1.0f), vec3(-1.0f, 0.0f, 0.0f), vec3( 0.0f, 0.0f, -1.0f) },
+	{ vec3(-1.0f, -1.0f,  1.0f), vec3( 0.0f, 1.0f, 0.0f), vec3( 1.0f, 0.0f,  0.0f) },
+	{ vec3( 1.0f, -1.0f, -1.0f), vec3( 0.0f, 1.0f, 0.0f), vec3(-1.0f, 0.0f,  0.0f) },
+};
+
+/// Equirectangular source coordinates of row j of a face: longitude spans [0, scaleU * 2], latitude [0, scaleV]
+void getEquirectangularRowCoordsScalar(int face, int j, int faceSize, float scaleU, float scaleV, int i0, int i1, float* U, float* V)
+{
+	const FaceBasis& f = kFaceBases[face];
+	const float B = 2.0f * float(j) / faceSize;
+	const vec3 row = f.base + B * f.dirB;
+
+	for (int i = i0; i != i1; i++)
+	{
+		const float A = 2.0f * float(i) / faceSize;
+		const float x = row.x + A * f.dirA.x;
+		const float y = row.y + A * f.dirA.y;
+		const float z = row.z + A * f.dirA.z;
+		const float R = sqrtf(x * x + y * y);
+		const float theta = fastAtan2(y, x);
+		const float phi = fastAtan2(z, R);
+		U[i] = scaleU * (theta * kInvPi + 1.0f);
+		V[i] = scaleV * (0.5f - phi * kInvPi);
 	}
 }
 
-vec3 faceCoordsToXYZ(int i, int j, int faceID, int faceSize)
+#if defined(UTILS_SIMD_X86)
+
+/// fastAtan2() on 8 lanes, operation for operation
+UTILS_SIMD_TARGET_AVX2 __m256 fastAtan2AVX2(__m256 y, __m256 x)
+{
+	const __m256 signMask = _mm256_set1_ps(-0.0f);
+	const __m256 ax = _mm256_andnot_ps(signMask, x);
+	const __m256 ay = _mm256_andnot_ps(signMask, y);
+	const __m256 mx = _mm256_max_ps(ax, ay);
+	const __m256 mn = _mm256_min_ps(ax, ay);
+	const __m256 t = _mm256_and_ps(_mm256_div_ps(mn, mx), _mm256_cmp_ps(mx, _mm256_setzero_ps(), _CMP_GT_OQ));
+	const __m256 t2 = _mm256_mul_ps(t, t);
+
+	__m256 r = _mm256_set1_ps(-0.01172120f);
+	r = _mm256_add_ps(_mm256_mul_ps(r, t2), _mm256_set1_ps(0.05265332f));
+	r = _mm256_sub_ps(_mm256_mul_ps(r, t2), _mm256_set1_ps(0.11643287f));
+	r = _mm256_add_ps(_mm256_mul_ps(r, t2), _mm256_set1_ps(0.19354346f));
+	r = _mm256_sub_ps(_mm256_mul_ps(r, t2), _mm256_set1_ps(0.33262347f));
+	r = _mm256_add_ps(_mm256_mul_ps(r, t2), _mm256_set1_ps(0.99997726f));
+	r = _mm256_mul_ps(r, t);
+
+	r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(1.57079637f), r), _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+	r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(3.14159274f), r), _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ));
+
+	return _mm256_or_ps(_mm256_andnot_ps(signMask, r), _mm256_and_ps(signMask, y));
+}
+
+UTILS_SIMD_TARGET_AVX2 void getEquirectangularRowCoordsAVX2(int face, int j, int faceSize, float scaleU, float scaleV, int i0, int i1, float* U, float* V)
 {
-	const float A = 2.0f * float(i) / faceSize;
+	const FaceBasis& f = kFaceBases[face];
 	const float B = 2.0f * float(j) / faceSize;
+	const vec3 row = f.base + B * f.dirB;
+
+	const __m256 rowX = _mm256_set1_ps(row.x);
+	const __m256 rowY = _mm256_set1_ps(row.y);
+	const __m256 rowZ = _mm256_set1_ps(row.z);
+	const __m256 dirX = _mm256_set1_ps(f.dirA.x);
+	const __m256 dirY = _mm256_set1_ps(f.dirA.y);
+	const __m256 dirZ = _mm256_set1_ps(f.dirA.z);
+	const __m256 size = _mm256_set1_ps(float(faceSize));
+	const __m256 invPi = _mm256_set1_ps(kInvPi);
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 vScaleU = _mm256_set1_ps(scaleU);
+	const __m256 vScaleV = _mm256_set1_ps(scaleV);
 
-	if (faceID == 0) return vec3(-1.0f, A - 1.0f, B - 1.0f);
-	if (faceID == 1) return vec3(A - 1.0f, -1.0f, 1.0f - B);
-	if (faceID == 2) return vec3(1.0f, A - 1.0f, 1.0f - B);
-	if (faceID == 3) return vec3(1.0f - A, 1.0f, 1.0f - B);
-	if (faceID == 4) return vec3(B - 1.0f, A - 1.0f, 1.0f);
-	if (faceID == 5) return vec3(1.0f - B, A - 1.0f, -1.0f);
+	int i = i0;
+	for (; i + 8 <= i1; i += 8)
+	{
+		const __m256 fi = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(i), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+		const __m256 A = _mm256_div_ps(_mm256_mul_ps(_mm256_set1_ps(2.0f), fi), size);
+		const __m256 x = _mm256_add_ps(rowX, _mm256_mul_ps(A, dirX));
+		const __m256 y = _mm256_add_ps(rowY, _mm256_mul_ps(A, dirY));
+		const __m256 z = _mm256_add_ps(rowZ, _mm256_mul_ps(A, dirZ));
+		const __m256 R = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)));
+		const __m256 theta = fastAtan2AVX2(y, x);
+		const __m256 phi = fastAtan2AVX2(z, R);
+		_mm256_storeu_ps(U + i, _mm256_mul_ps(vScaleU, _mm256_add_ps(_mm256_mul_ps(theta, invPi), one)));
+		_mm256_storeu_ps(V + i, _mm256_mul_ps(vScaleV, _mm256_sub_ps(half, _mm256_mul_ps(phi, invPi))));
+	}
 
-	return vec3();
+	getEquirectangularRowCoordsScalar(face, j, faceSize, scaleU, scaleV, i, i1, U, V);
 }
 
-Bitmap convertEquirectangularMapToVerticalCross(const Bitmap& b)
+#endif // UTILS_SIMD_X86
+
+/// Columns [i0, i1) of the row, at their own indices in U and V
+void getEquirectangularRowCoords(int face, int j, int faceSize, float scaleU, float scaleV, int i0, int i1, float* U, float* V)
 {
-	if (b.type_ != eBitmapType_2D) return Bitmap();
+#if defined(UTILS_SIMD_X86)
+	if (hasAVX2F16C())
+	{
+		getEquirectangularRowCoordsAVX2(face, j, faceSize, scaleU, scaleV, i0, i1, U, V);
+		return;
+	}
+#endif
+	getEquirectangularRowCoordsScalar(face, j, faceSize, scaleU, scaleV, i0, i1, U, V);
+}
 
-	const int faceSize = b.w_ / 4;
+/// Rows of all 6 faces are spread over the shared pool in small groups
+const int kEquirectangularRowsPerJob = 8;
 
-	const int w = faceSize * 3;
-	const int h = faceSize * 4;
+/// The vertical cross block each GL face is cut from and whether it is rotated by 180 degrees there,
+/// see convertVerticalCrossToCubeMapFaces()
+const int kCubeFaceCrossBlocks[] = { 1, 3, 4, 5, 0, 2 };
+const bool kCubeFaceRotated[] = { false, false, true, true, true, false };
 
-	Bitmap result(w, h, b.comp_, b.fmt_);
+/// Source coordinates of columns [i0, i1) of row j of a GL cube face in an equirectangular map of srcW x srcH texels,
+/// at their own indices in U and V (which hold faceSize values)
+void getCubeFaceRowCoords(int face, int j, int faceSize, int srcW, int srcH, int i0, int i1, float* U, float* V)
+{
+	// longitude spans the input width, latitude its height
+	const float scaleU = srcW * 0.5f;
+	const float scaleV = float(srcH);
+
+	if (!kCubeFaceRotated[face])
+	{
+		getEquirectangularRowCoords(kCubeFaceCrossBlocks[face], j, faceSize, scaleU, scaleV, i0, i1, U, V);
+		return;
+	}
+
+	// a rotated face reads its cross block bottom to top and right to left: column i is block column faceSize - 1 - i,
+	// and reversing a range centered on the middle of the row moves every block column to its face column
+	getEquirectangularRowCoords(kCubeFaceCrossBlocks[face], faceSize - 1 - j, faceSize, scaleU, scaleV, faceSize - i1, faceSize - i0, U, V);
+	const int a = std::min(i0, faceSize - i1);
+	std::reverse(U + a, U + faceSize - a);
+	std::reverse(V + a, V + faceSize - a);
+}
+
+void getCubeFaceRowCoords(int face, int j, int faceSize, int srcW, int srcH, float* U, float* V)
+{
+	getCubeFaceRowCoords(face, j, faceSize, srcW, srcH, 0, faceSize, U, V);
+}
+
+template <eBitmapFormat Format, int Comp, eBitmapLayout Layout>
+void convertEquirectangularMapToVerticalCross(const Bitmap& b, Bitmap& result, int faceSize)
+{
+	// longitude wraps around the seam of the equirectangular map
+	const BitmapSampler<Format, Comp, Layout> src(b, eBitmapFilter_Bilinear, eBitmapWrap_Repeat, eBitmapWrap_Clamp);
+	const BitmapView<Format, Comp> dst(result);
 
 	const ivec2 kFaceOffsets[] =
 	{
@@ -128,124 +492,1525 @@ Bitmap convertEquirectangularMapToVerticalCross(const Bitmap& b)
 		ivec2(faceSize, faceSize * 2)
 	};
 
-	const int clampW = b.w_ - 1;
-	const int clampH = b.h_ - 1;
+	// the map spans 4 faces horizontally and 2 vertically
+	const float scaleU = 2.0f * faceSize;
+	const float scaleV = 2.0f * faceSize;
 
-	for (int face = 0; face != 6; face++)
+	const int jobsPerFace = (faceSize + kEquirectangularRowsPerJob - 1) / kEquirectangularRowsPerJob;
+
+	ThreadPool::getShared().parallelFor(0, 6 * jobsPerFace, [&](int job)
 	{
-		for (int i = 0; i != faceSize; i++)
-		{
-			for (int j = 0; j != faceSize; j++)
-			{
-				const vec3 P = faceCoordsToXYZ(i, j, face, faceSize);
-				const float R = hypot(P.x, P.y);
-				const float theta = atan2(P.y, P.x);
-				const float phi = atan2(P.z, R);
-				//	float point source coordinates
-				const float Uf = float(2.0f * faceSize * (theta + M_PI) / M_PI);
-				const float Vf = float(2.0f * faceSize * (M_PI / 2.0f - phi) / M_PI);
-				// 4-samples for bilinear interpolation
-				const int U1 = clamp(int(floor(Uf)), 0, clampW);
-				const int V1 = clamp(int(floor(Vf)), 0, clampH);
-				const int U2 = clamp(U1 + 1, 0, clampW);
-				const int V2 = clamp(V1 + 1, 0, clampH);
-				// fractional part
-				const float s = Uf - U1;
-				const float t = Vf - V1;
-				// fetch 4-samples
-				const vec4 A = b.getPixel(U1, V1);
-				const vec4 B = b.getPixel(U2, V1);
-				const vec4 C = b.getPixel(U1, V2);
-				const vec4 D = b.getPixel(U2, V2);
-				// bilinear interpolation
-				const vec4 color = A * (1 - s) * (1 - t) + B * (s) * (1 - t) + C * (1 - s) * t + D * (s) * (t);
-				result.setPixel(i + kFaceOffsets[face].x, j + kFaceOffsets[face].y, color);
-			}
-		};
+		const int face = job / jobsPerFace;
+		const int j0 = (job % jobsPerFace) * kEquirectangularRowsPerJob;
+		const int j1 = std::min(faceSize, j0 + kEquirectangularRowsPerJob);
+
+		std::vector<float> Uf(faceSize);
+		std::vector<float> Vf(faceSize);
+		std::vector<vec4> colors(faceSize);
+
+		for (int j = j0; j != j1; j++)
+		{
+			getEquirectangularRowCoords(face, j, faceSize, scaleU, scaleV, 0, faceSize, Uf.data(), Vf.data());
+			// bilinear fetches of a whole row, 8 at a time
+			src.sample(Uf.data(), Vf.data(), colors.data(), faceSize);
+			for (int i = 0; i != faceSize; i++)
+				dst.setPixel(i + kFaceOffsets[face].x, j + kFaceOffsets[face].y, colors[i]);
+		}
+	});
+}
+
+struct EquirectangularMapToVerticalCross
+{
+	const Bitmap& src;
+	Bitmap& dst;
+	int faceSize;
+
+	template <eBitmapFormat Format, int Comp, eBitmapLayout Layout>
+	void operator()(BitmapFormatTag<Format, Comp, Layout>) const
+	{
+		convertEquirectangularMapToVerticalCross<Format, Comp, Layout>(src, dst, faceSize);
 	}
+};
+
+Bitmap convertEquirectangularMapToVerticalCross(const Bitmap& b)
+{
+	if (b.type_ != eBitmapType_2D) return Bitmap();
+
+	const int faceSize = b.w_ / 4;
+
+	const int w = faceSize * 3;
+	const int h = faceSize * 4;
+
+	Bitmap result(w, h, b.comp_, b.fmt_);
+
+	// page a file-backed source back in ahead of the scattered fetches
+	b.adviseAccess(eBitmapAccess_WillNeed);
+
+	// the pixel format is resolved once per image, not once per texel;
+	// tiled/Morton sources keep the scattered bilinear fetches cache-local
+	const EquirectangularMapToVerticalCross kernel = { b, result, faceSize };
+	dispatchBitmapFormat(b, kernel);
 
 	return result;
 }
 
-Bitmap convertVerticalCrossToCubeMapFaces(const Bitmap& b)
+template <eBitmapFormat Format, int Comp, eBitmapLayout Layout>
+CubeMapJobs getEquirectangularMapToCubeMapFacesJobs(const Bitmap& b, Bitmap& result)
 {
-	const int faceWidth = b.w_ / 3;
-	const int faceHeight = b.h_ / 4;
+	typedef typename BitmapFormatTraits<Format>::Component Component;
 
-	Bitmap cubemap(faceWidth, faceHeight, 6, b.comp_, b.fmt_);
-	cubemap.type_ = eBitmapType_Cube;
+	const BitmapSampler<Format, Comp, Layout> src(b, eBitmapFilter_Bilinear, eBitmapWrap_Repeat, eBitmapWrap_Clamp);
 
-	const uint8_t* src = b.data_.data();
-	uint8_t* dst = cubemap.data_.data();
+	const int faceSize = result.w_;
+	const int srcW = b.w_;
+	const int srcH = b.h_;
 
-	/*
-			------
-			| +Y |
-	 ----------------
-	 | -X | -Z | +X |
-	 ----------------
-			| -Y |
-			------
-			| +Z |
-			------
-	*/
+	Component* faces = reinterpret_cast<Component*>(result.data_.data());
 
-	const int pixelSize = cubemap.comp_ * Bitmap::getBytesPerComponent(cubemap.fmt_);
+	const int jobsPerFace = (faceSize + kEquirectangularRowsPerJob - 1) / kEquirectangularRowsPerJob;
 
-	for (int face = 0; face != 6; ++face)
+	CubeMapJobs jobs;
+	jobs.numJobs = 6 * jobsPerFace;
+	jobs.run = [=](int job)
 	{
-		for (int j = 0; j != faceHeight; ++j)
+		const int face = job / jobsPerFace;
+		const int j0 = (job % jobsPerFace) * kEquirectangularRowsPerJob;
+		const int j1 = std::min(faceSize, j0 + kEquirectangularRowsPerJob);
+
+		const BitmapView<Format, Comp> dst(faces + (size_t)face * faceSize * faceSize * Comp, faceSize, faceSize);
+
+		std::vector<float> Uf(faceSize);
+		std::vector<float> Vf(faceSize);
+		std::vector<vec4> colors(faceSize);
+
+		for (int j = j0; j != j1; j++)
 		{
-			for (int i = 0; i != faceWidth; ++i)
-			{
-				int x = 0;
-				int y = 0;
+			getCubeFaceRowCoords(face, j, faceSize, srcW, srcH, Uf.data(), Vf.data());
+			// one face row per batch
+			src.sample(Uf.data(), Vf.data(), colors.data(), faceSize);
+			for (int i = 0; i != faceSize; i++)
+				dst.setPixel(i, j, colors[i]);
+		}
+	};
 
-				switch (face)
-				{
-					// GL_TEXTURE_CUBE_MAP_POSITIVE_X
-				case 0:
-					x = i;
-					y = faceHeight + j;
-					break;
+	return jobs;
+}
 
-					// GL_TEXTURE_CUBE_MAP_NEGATIVE_X
-				case 1:
-					x = 2 * faceWidth + i;
-					y = 1 * faceHeight + j;
-					break;
+struct EquirectangularMapToCubeMapFaces
+{
+	const Bitmap& src;
+	Bitmap& dst;
+	CubeMapJobs& jobs;
 
-					// GL_TEXTURE_CUBE_MAP_POSITIVE_Y
-				case 2:
-					x = 2 * faceWidth - (i + 1);
-					y = 1 * faceHeight - (j + 1);
-					break;
+	template <eBitmapFormat Format, int Comp, eBitmapLayout Layout>
+	void operator()(BitmapFormatTag<Format, Comp, Layout>) const
+	{
+		jobs = getEquirectangularMapToCubeMapFacesJobs<Format, Comp, Layout>(src, dst);
+	}
+};
 
-					// GL_TEXTURE_CUBE_MAP_NEGATIVE_Y
-				case 3:
-					x = 2 * faceWidth - (i + 1);
-					y = 3 * faceHeight - (j + 1);
-					break;
+CubeMapJobs getEquirectangularMapToCubeMapFacesJobs(const Bitmap& b, Bitmap& cubemap)
+{
+	assert(b.type_ == eBitmapType_2D && cubemap.type_ == eBitmapType_Cube && cubemap.d_ == 6);
+	assert(cubemap.comp_ == b.comp_ && cubemap.fmt_ == b.fmt_ && cubemap.getLayout() == eBitmapLayout_Linear);
 
-					// GL_TEXTURE_CUBE_MAP_POSITIVE_Z
-				case 4:
-					x = 2 * faceWidth - (i + 1);
-					y = b.h_ - (j + 1);
-					break;
+	CubeMapJobs jobs;
+	const EquirectangularMapToCubeMapFaces kernel = { b, cubemap, jobs };
+	dispatchBitmapFormat(b, kernel);
 
-					// GL_TEXTURE_CUBE_MAP_NEGATIVE_Z
-				case 5:
-					x = faceWidth + i;
-					y = faceHeight + j;
-					break;
-				}
+	return jobs;
+}
 
-				memcpy(dst, src + (y * b.w_ + x) * pixelSize, pixelSize);
+Bitmap convertEquirectangularMapToCubeMapFaces(const Bitmap& b, int faceSize)
+{
+	if (b.type_ != eBitmapType_2D) return Bitmap();
 
-				dst += pixelSize;
-			}
-		}
-	}
+	if (faceSize <= 0)
+		faceSize = b.w_ / 4;
+
+	Bitmap cubemap(faceSize, faceSize, 6, b.comp_, b.fmt_);
+	cubemap.type_ = eBitmapType_Cube;
+
+	b.adviseAccess(eBitmapAccess_WillNeed);
+
+	const CubeMapJobs jobs = getEquirectangularMapToCubeMapFacesJobs(b, cubemap);
+	ThreadPool::getShared().parallelFor(0, jobs.numJobs, jobs.run);
+
+	return cubemap;
+}
+
+/// On-disk layout of a CubeMapRemapTable: this header, the indices and the weights
+struct CubeMapRemapTableHeader
+{
+	uint32_t magic = 0x30544D52; // "RMT0"
+	uint32_t version = 1; // bump whenever getCubeFaceRowCoords() changes
+	uint32_t srcW = 0;
+	uint32_t srcH = 0;
+	uint32_t faceSize = 0;
+};
+
+CubeMapRemapTable::CubeMapRemapTable(int srcW, int srcH, int faceSize)
+	: srcW_(srcW)
+	, srcH_(srcH)
+	, faceSize_(faceSize)
+	, indices_((size_t)6 * faceSize * faceSize)
+	, weights_((size_t)6 * faceSize * faceSize)
+{
+	assert((size_t)srcW * srcH <= kIndexMask);
+
+	const int jobsPerFace = (faceSize + kEquirectangularRowsPerJob - 1) / kEquirectangularRowsPerJob;
+
+	ThreadPool::getShared().parallelFor(0, 6 * jobsPerFace, [&](int job)
+	{
+		const int face = job / jobsPerFace;
+		const int j0 = (job % jobsPerFace) * kEquirectangularRowsPerJob;
+		const int j1 = std::min(faceSize, j0 + kEquirectangularRowsPerJob);
+
+		std::vector<float> Uf(faceSize);
+		std::vector<float> Vf(faceSize);
+
+		for (int j = j0; j != j1; j++)
+		{
+			getCubeFaceRowCoords(face, j, faceSize, srcW, srcH, Uf.data(), Vf.data());
+
+			const size_t row = ((size_t)face * faceSize + j) * faceSize;
+
+			for (int i = 0; i != faceSize; i++)
+			{
+				// the same taps as BitmapSampler with eBitmapWrap_Repeat in U and eBitmapWrap_Clamp in V
+				const float fx = floorf(Uf[i]);
+				const float fy = floorf(Vf[i]);
+				const int x0 = wrapBitmapCoord((int)fx, srcW, eBitmapWrap_Repeat);
+				const int y0 = wrapBitmapCoord((int)fy, srcH, eBitmapWrap_Clamp);
+				const int y1 = wrapBitmapCoord((int)fy + 1, srcH, eBitmapWrap_Clamp);
+
+				uint32_t index = (uint32_t)(y0 * srcW + x0);
+				if (x0 == srcW - 1)
+					index |= kWrapX;
+				if (y1 == y0)
+					index |= kClampY;
+
+				const uint32_t s = (uint32_t)((Uf[i] - fx) * 65535.0f + 0.5f);
+				const uint32_t t = (uint32_t)((Vf[i] - fy) * 65535.0f + 0.5f);
+
+				indices_[row + i] = index;
+				weights_[row + i] = s | (t << 16);
+			}
+		}
+	});
+}
+
+std::mutex remapTablesMutex;
+std::map<std::string, std::shared_ptr<const CubeMapRemapTable>> remapTables;
+
+std::shared_ptr<const CubeMapRemapTable> CubeMapRemapTable::get(int srcW, int srcH, int faceSize, const char* cacheDirectory)
+{
+	char name[128];
+	snprintf(name, sizeof(name), "cubemap_remap_%dx%d_%d.bin", srcW, srcH, faceSize);
+
+	std::lock_guard<std::mutex> lock(remapTablesMutex);
+
+	std::shared_ptr<const CubeMapRemapTable>& table = remapTables[name];
+	if (table)
+		return table;
+
+	const std::string fileName = cacheDirectory ? std::string(cacheDirectory) + "/" + name : std::string();
+
+	std::shared_ptr<CubeMapRemapTable> loaded = fileName.empty() ? nullptr : load(fileName.c_str());
+
+	if (loaded && loaded->srcW_ == srcW && loaded->srcH_ == srcH && loaded->faceSize_ == faceSize)
+	{
+		table = loaded;
+		return table;
+	}
+
+	std::shared_ptr<CubeMapRemapTable> built(new CubeMapRemapTable(srcW, srcH, faceSize));
+
+	if (!fileName.empty())
+		built->save(fileName.c_str());
+
+	table = built;
+	return table;
+}
+
+void CubeMapRemapTable::clearCache()
+{
+	std::lock_guard<std::mutex> lock(remapTablesMutex);
+	remapTables.clear();
+}
+
+bool CubeMapRemapTable::save(const char* fileName) const
+{
+	FILE* f = fopen(fileName, "wb");
+
+	if (!f)
+	{
+		printf("I/O error. Cannot write remap table '%s'\n", fileName);
+		return false;
+	}
+
+	CubeMapRemapTableHeader header;
+	header.srcW = srcW_;
+	header.srcH = srcH_;
+	header.faceSize = faceSize_;
+
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+	ok = ok && fwrite(indices_.data(), sizeof(uint32_t), indices_.size(), f) == indices_.size();
+	ok = ok && fwrite(weights_.data(), sizeof(uint32_t), weights_.size(), f) == weights_.size();
+
+	fclose(f);
+
+	return ok;
+}
+
+std::shared_ptr<CubeMapRemapTable> CubeMapRemapTable::load(const char* fileName)
+{
+	FILE* f = fopen(fileName, "rb");
+
+	if (!f)
+		return nullptr;
+
+	CubeMapRemapTableHeader header;
+	const size_t numRead = fread(&header, sizeof(header), 1, f);
+
+	if (numRead != 1 || header.magic != CubeMapRemapTableHeader().magic || header.version != CubeMapRemapTableHeader().version ||
+		!header.faceSize || header.faceSize > 65536 || (uint64_t)header.srcW * header.srcH > kIndexMask)
+	{
+		fclose(f);
+		return nullptr;
+	}
+
+	std::shared_ptr<CubeMapRemapTable> table(new CubeMapRemapTable());
+	table->srcW_ = header.srcW;
+	table->srcH_ = header.srcH;
+	table->faceSize_ = header.faceSize;
+
+	const size_t numTexels = (size_t)6 * header.faceSize * header.faceSize;
+	table->indices_.resize(numTexels);
+	table->weights_.resize(numTexels);
+
+	bool ok = fread(table->indices_.data(), sizeof(uint32_t), numTexels, f) == numTexels;
+	ok = ok && fread(table->weights_.data(), sizeof(uint32_t), numTexels, f) == numTexels;
+
+	fclose(f);
+
+	if (!ok)
+	{
+		printf("Invalid remap table file '%s'\n", fileName);
+		return nullptr;
+	}
+
+	// a corrupt file must not index outside the source
+	const uint32_t numSrcTexels = header.srcW * header.srcH;
+	for (uint32_t index : table->indices_)
+	{
+		if ((index & kIndexMask) >= numSrcTexels)
+		{
+			printf("Invalid remap table file '%s'\n", fileName);
+			return nullptr;
+		}
+	}
+
+	return table;
+}
+
+/// Scalar gather of texels [t0, t1), also the tail of the SIMD loop
+template <eBitmapFormat Format, int Comp>
+void remapCubeMapTexels(const typename BitmapFormatTraits<Format>::Component* src, typename BitmapFormatTraits<Format>::Component* dst,
+	int w, const uint32_t* indices, const uint32_t* weights, size_t t0, size_t t1)
+{
+	typedef BitmapFormatTraits<Format> Traits;
+	typedef typename Traits::Component Component;
+
+	for (size_t t = t0; t != t1; t++)
+	{
+		const uint32_t e = indices[t];
+		const size_t i00 = e & CubeMapRemapTable::kIndexMask;
+		const size_t i01 = (e & CubeMapRemapTable::kWrapX) ? i00 + 1 - w : i00 + 1;
+		const size_t dy = (e & CubeMapRemapTable::kClampY) ? 0 : w;
+
+		const float s = float(weights[t] & 0xFFFF) * (1.0f / 65535.0f);
+		const float u = float(weights[t] >> 16) * (1.0f / 65535.0f);
+
+		const Component* A = src + Comp * i00;
+		const Component* B = src + Comp * i01;
+		const Component* C = src + Comp * (i00 + dy);
+		const Component* D = src + Comp * (i01 + dy);
+
+		for (int k = 0; k != Comp; k++)
+		{
+			const float c =
+				Traits::toFloat(A[k]) * (1 - s) * (1 - u) + Traits::toFloat(B[k]) * s * (1 - u) +
+				Traits::toFloat(C[k]) * (1 - s) * u + Traits::toFloat(D[k]) * s * u;
+			dst[Comp * t + k] = Traits::fromFloat(c);
+		}
+	}
+}
+
+#if defined(UTILS_SIMD_X86)
+
+/// 8 float or half components at element indices. Halves are gathered as (unaligned) pairs starting at
+/// the element, or at the element before it for the last one, so no read leaves the buffer;
+/// lastPair is the number of components minus 2.
+template <eBitmapFormat Format>
+UTILS_SIMD_TARGET_AVX2 __m256 gatherComponents8(const void* src, __m256i lastPair, __m256i element)
+{
+	if (Format == eBitmapFormat_Float)
+		return _mm256_i32gather_ps(static_cast<const float*>(src), element, 4);
+
+	const __m256i first = _mm256_min_epi32(element, lastPair);
+	const __m256i pair = _mm256_i32gather_epi32(static_cast<const int*>(src), first, 2);
+	const __m256i v = _mm256_and_si256(_mm256_srlv_epi32(pair, _mm256_slli_epi32(_mm256_sub_epi32(element, first), 4)), _mm256_set1_epi32(0xFFFF));
+	return _mm256_cvtph_ps(_mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+}
+
+/// remapCubeMapTexels() for float and half sources, 8 texels per iteration with the same operation order
+template <eBitmapFormat Format, int Comp>
+UTILS_SIMD_TARGET_AVX2 void remapCubeMapTexelsAVX2(const typename BitmapFormatTraits<Format>::Component* src, typename BitmapFormatTraits<Format>::Component* dst,
+	int w, int numSrcComponents, const uint32_t* indices, const uint32_t* weights, size_t t0, size_t t1)
+{
+	const __m256i lastPair = _mm256_set1_epi32(numSrcComponents - 2);
+	const __m256i indexMask = _mm256_set1_epi32(CubeMapRemapTable::kIndexMask);
+	const __m256i clampY = _mm256_set1_epi32(CubeMapRemapTable::kClampY);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i width = _mm256_set1_epi32(w);
+	const __m256i comp = _mm256_set1_epi32(Comp);
+	const __m256 scale = _mm256_set1_ps(1.0f / 65535.0f);
+	const __m256 fone = _mm256_set1_ps(1.0f);
+
+	size_t t = t0;
+	for (; t + 8 <= t1; t += 8)
+	{
+		const __m256i e = _mm256_loadu_si256((const __m256i*)(indices + t));
+		const __m256i wt = _mm256_loadu_si256((const __m256i*)(weights + t));
+
+		const __m256i i00 = _mm256_and_si256(e, indexMask);
+		const __m256i i01 = _mm256_add_epi32(i00, _mm256_blendv_epi8(one, _mm256_sub_epi32(one, width), _mm256_cmpgt_epi32(zero, e)));
+		const __m256i dy = _mm256_andnot_si256(_mm256_cmpeq_epi32(_mm256_and_si256(e, clampY), clampY), width);
+
+		const __m256 s = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(wt, _mm256_set1_epi32(0xFFFF))), scale);
+		const __m256 u = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(wt, 16)), scale);
+		const __m256 s1 = _mm256_sub_ps(fone, s);
+		const __m256 u1 = _mm256_sub_ps(fone, u);
+
+		const __m256i a = _mm256_mullo_epi32(i00, comp);
+		const __m256i b = _mm256_mullo_epi32(i01, comp);
+		const __m256i c = _mm256_mullo_epi32(_mm256_add_epi32(i00, dy), comp);
+		const __m256i d = _mm256_mullo_epi32(_mm256_add_epi32(i01, dy), comp);
+
+		float out[Comp][8];
+
+		for (int k = 0; k != Comp; k++)
+		{
+			const __m256i kk = _mm256_set1_epi32(k);
+			__m256 v = _mm256_mul_ps(_mm256_mul_ps(gatherComponents8<Format>(src, lastPair, _mm256_add_epi32(a, kk)), s1), u1);
+			v = _mm256_add_ps(v, _mm256_mul_ps(_mm256_mul_ps(gatherComponents8<Format>(src, lastPair, _mm256_add_epi32(b, kk)), s), u1));
+			v = _mm256_add_ps(v, _mm256_mul_ps(_mm256_mul_ps(gatherComponents8<Format>(src, lastPair, _mm256_add_epi32(c, kk)), s1), u));
+			v = _mm256_add_ps(v, _mm256_mul_ps(_mm256_mul_ps(gatherComponents8<Format>(src, lastPair, _mm256_add_epi32(d, kk)), s), u));
+			_mm256_storeu_ps(out[k], v);
+		}
+
+		if (Format == eBitmapFormat_Float)
+		{
+			float* p = reinterpret_cast<float*>(dst) + Comp * t;
+			for (int i = 0; i != 8; i++)
+				for (int k = 0; k != Comp; k++)
+					p[Comp * i + k] = out[k][i];
+		}
+		else
+		{
+			uint16_t halfs[Comp][8];
+			for (int k = 0; k != Comp; k++)
+				_mm_storeu_si128((__m128i*)halfs[k], _mm256_cvtps_ph(_mm256_loadu_ps(out[k]), _MM_FROUND_TO_NEAREST_INT));
+
+			uint16_t* p = reinterpret_cast<uint16_t*>(dst) + Comp * t;
+			for (int i = 0; i != 8; i++)
+				for (int k = 0; k != Comp; k++)
+					p[Comp * i + k] = halfs[k][i];
+		}
+	}
+
+	remapCubeMapTexels<Format, Comp>(src, dst, w, indices, weights, t, t1);
+}
+
+#endif // UTILS_SIMD_X86
+
+template <eBitmapFormat Format, int Comp>
+void remapCubeMapFaces(const Bitmap& b, Bitmap& result, const uint32_t* indices, const uint32_t* weights)
+{
+	typedef typename BitmapFormatTraits<Format>::Component Component;
+
+	const Component* src = reinterpret_cast<const Component*>(b.data_.data());
+	Component* dst = reinterpret_cast<Component*>(result.data_.data());
+
+	const int w = b.w_;
+	const size_t numTexels = (size_t)6 * result.w_ * result.h_;
+
+	// gathers take 32-bit element indices, halves need at least one pair
+	const uint64_t numSrcComponents = (uint64_t)b.w_ * b.h_ * Comp;
+	const bool useSIMD = (Format == eBitmapFormat_Float || Format == eBitmapFormat_HalfFloat) &&
+		hasAVX2F16C() && numSrcComponents >= 2 && numSrcComponents < (1u << 31);
+	const int texelsPerJob = 4096;
+	const int numJobs = (int)((numTexels + texelsPerJob - 1) / texelsPerJob);
+
+	ThreadPool::getShared().parallelFor(0, numJobs, [&](int job)
+	{
+		const size_t t0 = (size_t)job * texelsPerJob;
+		const size_t t1 = std::min(numTexels, t0 + texelsPerJob);
+
+#if defined(UTILS_SIMD_X86)
+		if (useSIMD)
+		{
+			remapCubeMapTexelsAVX2<Format, Comp>(src, dst, w, (int)numSrcComponents, indices, weights, t0, t1);
+			return;
+		}
+#endif
+		remapCubeMapTexels<Format, Comp>(src, dst, w, indices, weights, t0, t1);
+	});
+}
+
+struct RemapCubeMapFaces
+{
+	const Bitmap& src;
+	Bitmap& dst;
+	const uint32_t* indices;
+	const uint32_t* weights;
+
+	template <eBitmapFormat Format, int Comp, eBitmapLayout Layout>
+	void operator()(BitmapFormatTag<Format, Comp, Layout>) const
+	{
+		remapCubeMapFaces<Format, Comp>(src, dst, indices, weights);
+	}
+};
+
+Bitmap CubeMapRemapTable::convert(const Bitmap& b) const
+{
+	if (b.type_ != eBitmapType_2D || b.w_ != srcW_ || b.h_ != srcH_) return Bitmap();
+
+	// the table holds linear indices
+	if (b.getLayout() != eBitmapLayout_Linear)
+		return convert(convertBitmapLayout(b, eBitmapLayout_Linear));
+
+	Bitmap cubemap(faceSize_, faceSize_, 6, b.comp_, b.fmt_);
+	cubemap.type_ = eBitmapType_Cube;
+
+	b.adviseAccess(eBitmapAccess_WillNeed);
+
+	const RemapCubeMapFaces kernel = { b, cubemap, indices_.data(), weights_.data() };
+	dispatchBitmapFormat(b.fmt_, b.comp_, kernel);
+
+	return cubemap;
+}
+
+Bitmap convertVerticalCrossToCubeMapFaces(const Bitmap& b)
+{
+	const int faceWidth = b.w_ / 3;
+	const int faceHeight = b.h_ / 4;
+
+	Bitmap cubemap(faceWidth, faceHeight, 6, b.comp_, b.fmt_);
+	cubemap.type_ = eBitmapType_Cube;
+
+	b.adviseAccess(eBitmapAccess_Sequential);
+
+	const uint8_t* src = b.data_.data();
+	uint8_t* dst = cubemap.data_.data();
+
+	/*
+			------
+			| +Y |
+	 ----------------
+	 | -X | -Z | +X |
+	 ----------------
+			| -Y |
+			------
+			| +Z |
+			------
+	*/
+
+	const int pixelSize = Bitmap::getBytesPerPixel(cubemap.fmt_, cubemap.comp_);
+
+	for (int face = 0; face != 6; ++face)
+	{
+		for (int j = 0; j != faceHeight; ++j)
+		{
+			for (int i = 0; i != faceWidth; ++i)
+			{
+				int x = 0;
+				int y = 0;
+
+				switch (face)
+				{
+					// GL_TEXTURE_CUBE_MAP_POSITIVE_X
+				case 0:
+					x = i;
+					y = faceHeight + j;
+					break;
+
+					// GL_TEXTURE_CUBE_MAP_NEGATIVE_X
+				case 1:
+					x = 2 * faceWidth + i;
+					y = 1 * faceHeight + j;
+					break;
+
+					// GL_TEXTURE_CUBE_MAP_POSITIVE_Y
+				case 2:
+					x = 2 * faceWidth - (i + 1);
+					y = 1 * faceHeight - (j + 1);
+					break;
+
+					// GL_TEXTURE_CUBE_MAP_NEGATIVE_Y
+				case 3:
+					x = 2 * faceWidth - (i + 1);
+					y = 3 * faceHeight - (j + 1);
+					break;
+
+					// GL_TEXTURE_CUBE_MAP_POSITIVE_Z
+				case 4:
+					x = 2 * faceWidth - (i + 1);
+					y = b.h_ - (j + 1);
+					break;
+
+					// GL_TEXTURE_CUBE_MAP_NEGATIVE_Z
+				case 5:
+					x = faceWidth + i;
+					y = faceHeight + j;
+					break;
+				}
+
+				memcpy(dst, src + ((size_t)y * b.w_ + x) * pixelSize, pixelSize);
+
+				dst += pixelSize;
+			}
+		}
+	}
+
+	return cubemap;
+}
+
+/// Face and texel a texel position up to one texel outside of a face lands on: the direction of its center,
+/// extended beyond the face plane, is looked up again, so edge texels read the adjacent faces and the three
+/// texels around a cube corner read one of the two faces meeting there
+int getCubeFaceNeighbourTexel(int face, int x, int y, int size, int& nx, int& ny)
+{
+	const float a = 2.0f * (float(x) + 0.5f) / float(size) - 1.0f;
+	const float b = 2.0f * (float(y) + 0.5f) / float(size) - 1.0f;
+
+	float s, t;
+	const int neighbour = getCubeFaceCoords(getCubeFaceDirection(face, a, b), s, t);
+
+	nx = glm::clamp(int(s * size), 0, size - 1);
+	ny = glm::clamp(int(t * size), 0, size - 1);
+
+	return neighbour;
+}
+
+/// 4 tent weights per destination texel and the first source texel they apply to, the same for rows and columns
+struct DownsampleTentTaps
+{
+	std::vector<int> first;
+	std::vector<float> weights;
+};
+
+DownsampleTentTaps getDownsampleTentTaps(int srcSize, int dstSize)
+{
+	DownsampleTentTaps taps;
+	taps.first.resize(dstSize);
+	taps.weights.resize(4 * dstSize);
+
+	// a tent two destination texels wide: 1/8, 3/8, 3/8, 1/8 for an even source size
+	const float scale = float(srcSize) / float(dstSize);
+
+	for (int i = 0; i != dstSize; i++)
+	{
+		const float p = (float(i) + 0.5f) * scale - 0.5f;
+		const int first = int(floorf(p)) - 1;
+
+		float sum = 0.0f;
+		for (int k = 0; k != 4; k++)
+		{
+			const float w = std::max(0.0f, 1.0f - fabsf(float(first + k) - p) / scale);
+			taps.weights[4 * i + k] = w;
+			sum += w;
+		}
+		for (int k = 0; k != 4; k++)
+			taps.weights[4 * i + k] /= sum;
+
+		taps.first[i] = first;
+	}
+
+	return taps;
+}
+
+/// Separable 4x4 tent downsampling of destination rows [y0, y1) of a square with a one texel border, which
+/// the first and last taps of every row and column reach. fetchRow(y, texels) decodes source row y in
+/// [-1, srcSize] from x = -1 to x = srcSize as comp floats per texel, store(y, row) takes a finished row.
+template <typename FetchRow, typename Store>
+void downsampleTent2x(int srcSize, int dstSize, int comp, const DownsampleTentTaps& taps, int y0, int y1, const FetchRow& fetchRow, const Store& store)
+{
+	const int firstRow = taps.first[y0];
+	const int numRows = taps.first[y1 - 1] + 4 - firstRow;
+
+	std::vector<float> padded((size_t)(srcSize + 2) * comp);
+	std::vector<float> rows((size_t)numRows * dstSize * comp);
+
+	// the source rows the output needs, filtered horizontally
+	for (int r = 0; r != numRows; r++)
+	{
+		fetchRow(firstRow + r, padded.data());
+
+		float* out = &rows[(size_t)r * dstSize * comp];
+		for (int x = 0; x != dstSize; x++)
+			for (int c = 0; c != comp; c++)
+			{
+				float sum = 0.0f;
+				for (int k = 0; k != 4; k++)
+					sum += taps.weights[4 * x + k] * padded[(size_t)(taps.first[x] + k + 1) * comp + c];
+				out[x * comp + c] = sum;
+			}
+	}
+
+	std::vector<float> row((size_t)dstSize * comp);
+	for (int y = y0; y != y1; y++)
+	{
+		for (int i = 0; i != dstSize * comp; i++)
+		{
+			float sum = 0.0f;
+			for (int k = 0; k != 4; k++)
+				sum += taps.weights[4 * y + k] * rows[(size_t)(taps.first[y] + k - firstRow) * dstSize * comp + i];
+			row[i] = sum;
+		}
+
+		store(y, row.data());
+	}
+}
+
+CubeMapJobs getCubeMapDownsampleJobs(const Bitmap& src, Bitmap& dst)
+{
+	assert(src.type_ == eBitmapType_Cube && src.d_ == 6 && src.w_ == src.h_ && src.getLayout() == eBitmapLayout_Linear);
+
+	dst = Bitmap(std::max(1, src.w_ / 2), std::max(1, src.h_ / 2), 6, src.comp_, src.fmt_);
+	dst.type_ = eBitmapType_Cube;
+
+	const int srcSize = src.w_;
+	const int dstSize = dst.w_;
+	const eBitmapFormat fmt = src.fmt_;
+	const int comp = Bitmap::isPackedFormat(fmt) ? 3 : src.comp_;
+	const size_t pixelSize = Bitmap::getBytesPerPixel(fmt, src.comp_);
+	const uint8_t* srcData = src.data_.data();
+	uint8_t* dstData = dst.data_.data();
+
+	const std::shared_ptr<const DownsampleTentTaps> taps = std::make_shared<DownsampleTentTaps>(getDownsampleTentTaps(srcSize, dstSize));
+
+	CubeMapJobs jobs;
+	jobs.numJobs = 6;
+	jobs.run = [=](int face)
+	{
+		auto texel = [&](int f, int x, int y) { return srcData + (((size_t)f * srcSize + y) * srcSize + x) * pixelSize; };
+
+		// the border comes from the adjacent faces, so the filter never clamps at a seam
+		auto fetchNeighbour = [&](int x, int y, float* out)
+		{
+			int nx, ny;
+			const int neighbour = getCubeFaceNeighbourTexel(face, x, y, srcSize, nx, ny);
+			convertPixelsToFloat(fmt, comp, texel(neighbour, nx, ny), out, 1);
+		};
+
+		auto fetchRow = [&](int y, float* texels)
+		{
+			if (y < 0 || y >= srcSize)
+			{
+				for (int x = -1; x <= srcSize; x++)
+					fetchNeighbour(x, y, texels + (x + 1) * comp);
+				return;
+			}
+
+			convertPixelsToFloat(fmt, comp, texel(face, 0, y), texels + comp, srcSize);
+			fetchNeighbour(-1, y, texels);
+			fetchNeighbour(srcSize, y, texels + (srcSize + 1) * comp);
+		};
+
+		auto store = [&](int y, const float* row)
+		{
+			convertPixelsFromFloat(fmt, comp, row, dstData + (((size_t)face * dstSize + y) * dstSize) * pixelSize, dstSize);
+		};
+
+		downsampleTent2x(srcSize, dstSize, comp, *taps, 0, dstSize, fetchRow, store);
+	};
+
+	return jobs;
+}
+
+std::vector<Bitmap> generateCubeMapMipChain(const Bitmap& b)
+{
+	assert(b.type_ == eBitmapType_Cube && b.d_ == 6 && b.getLayout() == eBitmapLayout_Linear);
+
+	std::vector<Bitmap> mips;
+	mips.push_back(b);
+
+	while (mips.back().w_ > 1)
+	{
+		Bitmap dst;
+		const CubeMapJobs jobs = getCubeMapDownsampleJobs(mips.back(), dst);
+		ThreadPool::getShared().parallelFor(0, jobs.numJobs, jobs.run);
+
+		mips.push_back(std::move(dst));
+	}
+
+	return mips;
+}
+
+vec2 encodeOctahedral(const vec3& dir)
+{
+	// project onto the octahedron |x| + |y| + |z| = 1 and look at it from +Y
+	const vec3 n = dir / (fabsf(dir.x) + fabsf(dir.y) + fabsf(dir.z));
+	vec2 p(n.x, n.z);
+
+	// the lower half is folded over the edges of the upper diamond
+	if (n.y < 0.0f)
+		p = vec2((1.0f - fabsf(n.z)) * (n.x >= 0.0f ? 1.0f : -1.0f), (1.0f - fabsf(n.x)) * (n.z >= 0.0f ? 1.0f : -1.0f));
+
+	return 0.5f * p + vec2(0.5f);
+}
+
+vec3 decodeOctahedral(const vec2& uv)
+{
+	const vec2 p = 2.0f * uv - vec2(1.0f);
+	vec3 n(p.x, 1.0f - fabsf(p.x) - fabsf(p.y), p.y);
+
+	if (n.y < 0.0f)
+	{
+		const float x = n.x;
+		n.x = (1.0f - fabsf(n.z)) * (x >= 0.0f ? 1.0f : -1.0f);
+		n.z = (1.0f - fabsf(x)) * (n.z >= 0.0f ? 1.0f : -1.0f);
+	}
+
+	return glm::normalize(n);
+}
+
+template <eBitmapFormat Format, int Comp, eBitmapLayout Layout>
+void convertEquirectangularMapToOctahedralMap(const Bitmap& b, Bitmap& result)
+{
+	const BitmapSampler<Format, Comp, Layout> src(b, eBitmapFilter_Bilinear, eBitmapWrap_Repeat, eBitmapWrap_Clamp);
+	const BitmapView<Format, Comp> dst(result);
+
+	const int size = result.w_;
+
+	// the same longitude and latitude as getEquirectangularRowCoords()
+	const float scaleU = b.w_ * 0.5f;
+	const float scaleV = float(b.h_);
+
+	const int numJobs = (size + kEquirectangularRowsPerJob - 1) / kEquirectangularRowsPerJob;
+
+	ThreadPool::getShared().parallelFor(0, numJobs, [&](int job)
+	{
+		std::vector<float> U(size);
+		std::vector<float> V(size);
+		std::vector<vec4> colors(size);
+
+		const int y1 = std::min(size, (job + 1) * kEquirectangularRowsPerJob);
+
+		for (int y = job * kEquirectangularRowsPerJob; y != y1; y++)
+		{
+			for (int x = 0; x != size; x++)
+			{
+				// texel centers, so the folded edges mirror texel for texel
+				const vec3 G = decodeOctahedral(vec2((float(x) + 0.5f) / size, (float(y) + 0.5f) / size));
+
+				// back from the GL cube map direction to the one convertEquirectangularMapToCubeMapFaces() starts from
+				const vec3 P(-G.z, -G.x, G.y);
+				const float theta = fastAtan2(P.y, P.x);
+				const float phi = fastAtan2(P.z, sqrtf(P.x * P.x + P.y * P.y));
+				U[x] = scaleU * (theta * kInvPi + 1.0f);
+				V[x] = scaleV * (0.5f - phi * kInvPi);
+			}
+
+			src.sample(U.data(), V.data(), colors.data(), size);
+			for (int x = 0; x != size; x++)
+				dst.setPixel(x, y, colors[x]);
+		}
+	});
+}
+
+struct EquirectangularMapToOctahedralMap
+{
+	const Bitmap& src;
+	Bitmap& dst;
+
+	template <eBitmapFormat Format, int Comp, eBitmapLayout Layout>
+	void operator()(BitmapFormatTag<Format, Comp, Layout>) const
+	{
+		convertEquirectangularMapToOctahedralMap<Format, Comp, Layout>(src, dst);
+	}
+};
+
+Bitmap convertEquirectangularMapToOctahedralMap(const Bitmap& b, int size)
+{
+	if (b.type_ != eBitmapType_2D) return Bitmap();
+
+	if (size <= 0)
+		size = b.w_ / 2;
+
+	Bitmap result(size, size, b.comp_, b.fmt_);
+
+	b.adviseAccess(eBitmapAccess_WillNeed);
+
+	const EquirectangularMapToOctahedralMap kernel = { b, result };
+	dispatchBitmapFormat(b, kernel);
+
+	return result;
+}
+
+/// Where a texel position up to one texel outside of an octahedral map lands: every edge folds onto itself mirrored
+/// around its middle and all four corners are the same point, so the border is the mirrored outermost texels
+void foldOctahedralTexel(int& x, int& y, int size)
+{
+	if (x < 0 || x >= size)
+	{
+		x = x < 0 ? -1 - x : 2 * size - 1 - x;
+		y = size - 1 - y;
+	}
+	if (y < 0 || y >= size)
+	{
+		y = y < 0 ? -1 - y : 2 * size - 1 - y;
+		x = size - 1 - x;
+	}
+}
+
+std::vector<Bitmap> generateOctahedralMipChain(const Bitmap& b)
+{
+	assert(b.w_ == b.h_ && b.getLayout() == eBitmapLayout_Linear);
+
+	const eBitmapFormat fmt = b.fmt_;
+	const int comp = Bitmap::isPackedFormat(fmt) ? 3 : b.comp_;
+	const size_t pixelSize = Bitmap::getBytesPerPixel(fmt, b.comp_);
+
+	std::vector<Bitmap> mips;
+	mips.push_back(b);
+
+	while (mips.back().w_ > 1)
+	{
+		const Bitmap& src = mips.back();
+		Bitmap dst(src.w_ / 2, src.h_ / 2, src.comp_, fmt);
+
+		const int srcSize = src.w_;
+		const int dstSize = dst.w_;
+		const DownsampleTentTaps taps = getDownsampleTentTaps(srcSize, dstSize);
+
+		// bands of output rows, the filter reads over the folded edges exactly like over the cube faces
+		const int rowsPerJob = 16;
+		const int numJobs = (dstSize + rowsPerJob - 1) / rowsPerJob;
+
+		ThreadPool::getShared().parallelFor(0, numJobs, [&](int job)
+		{
+			const uint8_t* srcData = src.data_.data();
+
+			auto fetchFolded = [&](int x, int y, float* out)
+			{
+				foldOctahedralTexel(x, y, srcSize);
+				convertPixelsToFloat(fmt, comp, srcData + ((size_t)y * srcSize + x) * pixelSize, out, 1);
+			};
+
+			auto fetchRow = [&](int y, float* texels)
+			{
+				if (y < 0 || y >= srcSize)
+				{
+					for (int x = -1; x <= srcSize; x++)
+						fetchFolded(x, y, texels + (x + 1) * comp);
+					return;
+				}
+
+				convertPixelsToFloat(fmt, comp, srcData + (size_t)y * srcSize * pixelSize, texels + comp, srcSize);
+				fetchFolded(-1, y, texels);
+				fetchFolded(srcSize, y, texels + (srcSize + 1) * comp);
+			};
+
+			auto store = [&](int y, const float* row)
+			{
+				convertPixelsFromFloat(fmt, comp, row, dst.data_.data() + (size_t)y * dstSize * pixelSize, dstSize);
+			};
+
+			downsampleTent2x(srcSize, dstSize, comp, taps, job * rowsPerJob, std::min(dstSize, (job + 1) * rowsPerJob), fetchRow, store);
+		});
+
+		mips.push_back(std::move(dst));
+	}
+
+	return mips;
+}
+
+/// Bilinear lookup into one level of a float RGB cube map, clamped at the face edges
+vec3 sampleCubeMapLevel(const Bitmap& level, const vec3& dir)
+{
+	float s, t;
+	const int face = getCubeFaceCoords(dir, s, t);
+
+	const int size = level.w_;
+	const float x = glm::clamp(s * size - 0.5f, 0.0f, float(size - 1));
+	const float y = glm::clamp(t * size - 0.5f, 0.0f, float(size - 1));
+	const int x0 = int(x);
+	const int y0 = int(y);
+	const int x1 = std::min(x0 + 1, size - 1);
+	const int y1 = std::min(y0 + 1, size - 1);
+	const float fx = x - float(x0);
+	const float fy = y - float(y0);
+
+	const vec3* texels = reinterpret_cast<const vec3*>(level.data_.data()) + (size_t)face * size * size;
+	const vec3 top = glm::mix(texels[y0 * size + x0], texels[y0 * size + x1], fx);
+	const vec3 bottom = glm::mix(texels[y1 * size + x0], texels[y1 * size + x1], fx);
+
+	return glm::mix(top, bottom, fy);
+}
+
+/// Trilinear lookup between the two source levels around lod
+vec3 sampleCubeMapChain(const std::vector<Bitmap>& chain, const vec3& dir, float lod)
+{
+	lod = glm::clamp(lod, 0.0f, float(chain.size() - 1));
+
+	const int level0 = int(lod);
+	const int level1 = std::min(level0 + 1, int(chain.size()) - 1);
+	const float f = lod - float(level0);
+
+	const vec3 c0 = sampleCubeMapLevel(chain[level0], dir);
+
+	return f > 0.0f ? glm::mix(c0, sampleCubeMapLevel(chain[level1], dir), f) : c0;
+}
+
+/// Half vector around N = +Z distributed by GGX with alpha^2 = alpha2 for the uniform point Xi
+vec3 importanceSampleGGX(const vec2& Xi, float alpha2)
+{
+	const float phi = Math::TWOPI * Xi.x;
+	const float cosTheta = sqrt((1.0f - Xi.y) / (1.0f + (alpha2 - 1.0f) * Xi.y));
+	const float sinTheta = sqrt(1.0f - cosTheta * cosTheta);
+
+	return vec3(sinTheta * cos(phi), sinTheta * sin(phi), cosTheta);
+}
+
+/// GGX importance samples around N = V = +Z: the tangent space light direction with N.L in w, and the source lod
+struct GGXSample
+{
+	vec4 L;
+	float lod;
+};
+
+std::vector<GGXSample> getGGXSamples(float roughness, int numSamples, int srcFaceSize)
+{
+	const float alpha = roughness * roughness;
+	const float alpha2 = alpha * alpha;
+
+	// solid angle of a source texel at level 0 (averaged over the cube)
+	const float texelSolidAngle = 4.0f * Math::PI / (6.0f * srcFaceSize * srcFaceSize);
+
+	std::vector<GGXSample> samples;
+	samples.reserve(numSamples);
+
+	for (int i = 0; i != numSamples; i++)
+	{
+		const vec3 H = importanceSampleGGX(hammersley2d(i, numSamples), alpha2);
+		const float cosTheta = H.z;
+
+		// reflect V = N = +Z around H
+		const vec3 L = 2.0f * H.z * H - vec3(0.0f, 0.0f, 1.0f);
+		if (L.z <= 0.0f)
+			continue;
+
+		// with N = V the PDF of L is D(H) / 4, a sample covers 1 / (numSamples * pdf) of the sphere
+		const float d = (cosTheta * cosTheta) * (alpha2 - 1.0f) + 1.0f;
+		const float D = alpha2 / (Math::PI * d * d);
+		const float sampleSolidAngle = 1.0f / (numSamples * D * 0.25f + 0.0001f);
+
+		// one extra level smooths the undersampling (Karis, "Real Shading in Unreal Engine 4")
+		const float lod = roughness > 0.0f ? 0.5f * log2(sampleSolidAngle / texelSolidAngle) + 1.0f : 0.0f;
+
+		samples.push_back({ vec4(L, L.z), lod });
+	}
+
+	return samples;
+}
+
+std::vector<Bitmap> prefilterEnvironmentGGX(const Bitmap& cube, int numSamples, int numLevels)
+{
+	assert(cube.type_ == eBitmapType_Cube && cube.d_ == 6 && cube.w_ == cube.h_);
+
+	if (cube.getLayout() != eBitmapLayout_Linear)
+		return prefilterEnvironmentGGX(convertBitmapLayout(cube, eBitmapLayout_Linear), numSamples, numLevels);
+
+	if (cube.fmt_ != eBitmapFormat_Float || cube.comp_ != 3)
+	{
+		// the lookups read float RGB texels directly
+		Bitmap rgb(cube.w_, cube.h_, 6, 3, eBitmapFormat_Float);
+		rgb.type_ = eBitmapType_Cube;
+
+		const int comp = Bitmap::isPackedFormat(cube.fmt_) ? 3 : cube.comp_;
+		const size_t numPixels = (size_t)cube.w_ * cube.h_ * 6;
+
+		std::vector<float> pixels(numPixels * comp);
+		convertPixelsToFloat(cube.fmt_, comp, cube.data_.data(), pixels.data(), numPixels);
+
+		vec3* dst = reinterpret_cast<vec3*>(rgb.data_.data());
+		for (size_t i = 0; i != numPixels; i++)
+		{
+			const float* p = &pixels[i * comp];
+			dst[i] = comp >= 3 ? vec3(p[0], p[1], p[2]) : vec3(p[0]);
+		}
+
+		return prefilterEnvironmentGGX(rgb, numSamples, numLevels);
+	}
+
+	const std::vector<Bitmap> source = generateCubeMapMipChain(cube);
+
+	std::vector<Bitmap> levels;
+	const CubeMapJobs jobs = getPrefilterEnvironmentGGXJobs(source, numSamples, numLevels, levels);
+	ThreadPool::getShared().parallelFor(0, jobs.numJobs, jobs.run);
+
+	return levels;
+}
+
+CubeMapJobs getPrefilterEnvironmentGGXJobs(const std::vector<Bitmap>& source, int numSamples, int numLevels, std::vector<Bitmap>& levels)
+{
+	assert(!source.empty() && source[0].fmt_ == eBitmapFormat_Float && source[0].comp_ == 3);
+
+	const int maxLevels = int(source.size());
+	if (numLevels <= 0 || numLevels > maxLevels)
+		numLevels = maxLevels;
+
+	// roughness 0 is a mirror, level 0 is the environment itself
+	levels.assign(source.begin(), source.begin() + 1);
+	std::shared_ptr<std::vector<std::vector<GGXSample>>> samples = std::make_shared<std::vector<std::vector<GGXSample>>>(numLevels);
+
+	for (int level = 1; level != numLevels; level++)
+	{
+		levels.push_back(Bitmap(source[level].w_, source[level].h_, 6, 3, eBitmapFormat_Float));
+		levels.back().type_ = eBitmapType_Cube;
+		(*samples)[level] = getGGXSamples(float(level) / float(std::max(1, numLevels - 1)), numSamples, source[0].w_);
+	}
+
+	// jobs are rows of one face of one level, short enough to run a few of them per frame
+	const int rowsPerJob = 2;
+	std::vector<ivec2> ranges;
+	std::vector<vec3*> outputs(numLevels, nullptr);
+	for (int level = 1; level != numLevels; level++)
+	{
+		outputs[level] = reinterpret_cast<vec3*>(levels[level].data_.data());
+		for (int row = 0; row < 6 * levels[level].h_; row += rowsPerJob)
+			ranges.push_back(ivec2(level, row));
+	}
+
+	const std::vector<Bitmap>* chain = &source;
+
+	CubeMapJobs jobs;
+	jobs.numJobs = int(ranges.size());
+	jobs.run = [=](int job)
+	{
+		const std::vector<Bitmap>& src = *chain;
+		const int level = ranges[job].x;
+		const int size = src[level].w_;
+		const int row1 = std::min(6 * size, ranges[job].y + rowsPerJob);
+
+		vec3* dst = outputs[level];
+
+		for (int row = ranges[job].y; row != row1; row++)
+		{
+			const int face = row / size;
+			const float b = 2.0f * (float(row % size) + 0.5f) / float(size) - 1.0f;
+
+			for (int x = 0; x != size; x++)
+			{
+				const float a = 2.0f * (float(x) + 0.5f) / float(size) - 1.0f;
+				const vec3 N = glm::normalize(getCubeFaceDirection(face, a, b));
+
+				const vec3 up = fabs(N.z) < 0.999f ? vec3(0.0f, 0.0f, 1.0f) : vec3(1.0f, 0.0f, 0.0f);
+				const vec3 T = glm::normalize(glm::cross(up, N));
+				const vec3 B = glm::cross(N, T);
+
+				vec3 color(0.0f);
+				float weight = 0.0f;
+				for (const GGXSample& s : (*samples)[level])
+				{
+					const vec3 L = T * s.L.x + B * s.L.y + N * s.L.z;
+					color += sampleCubeMapChain(src, L, s.lod) * s.L.w;
+					weight += s.L.w;
+				}
+
+				dst[(size_t)row * size + x] = weight > 0.0f ? color / weight : sampleCubeMapLevel(src[0], N);
+			}
+		}
+	};
+
+	return jobs;
+}
+
+/// Scale and bias of F0 for one N.V and roughness (Karis, "Real Shading in Unreal Engine 4")
+vec2 integrateBRDF(float NdotV, float roughness, int numSamples)
+{
+	const vec3 V(sqrt(1.0f - NdotV * NdotV), 0.0f, NdotV);
+
+	const float alpha = roughness * roughness;
+	const float alpha2 = alpha * alpha;
+
+	// Schlick-GGX with the image based lighting remapping k = alpha / 2
+	const float k = alpha * 0.5f;
+	const float G_V = NdotV / (NdotV * (1.0f - k) + k);
+
+	float A = 0.0f;
+	float B = 0.0f;
+
+	for (int i = 0; i != numSamples; i++)
+	{
+		const vec3 H = importanceSampleGGX(hammersley2d(i, numSamples), alpha2);
+		const float VdotH = glm::dot(V, H);
+		const vec3 L = 2.0f * VdotH * H - V;
+
+		const float NdotL = L.z;
+		if (NdotL <= 0.0f)
+			continue;
+
+		const float G = G_V * NdotL / (NdotL * (1.0f - k) + k);
+		const float G_Vis = G * VdotH / (H.z * NdotV);
+		const float Fc = pow(1.0f - VdotH, 5.0f);
+
+		A += (1.0f - Fc) * G_Vis;
+		B += Fc * G_Vis;
+	}
+
+	return vec2(A, B) / float(numSamples);
+}
+
+Bitmap generateBRDFIntegrationLUT(int size, int numSamples)
+{
+	Bitmap lut(size, size, 2, eBitmapFormat_HalfFloat);
+	uint16_t* texels = reinterpret_cast<uint16_t*>(lut.data_.data());
+
+	ThreadPool::getShared().parallelFor(0, size, [&](int y)
+	{
+		const float roughness = (float(y) + 0.5f) / float(size);
+
+		for (int x = 0; x != size; x++)
+		{
+			const vec2 ab = integrateBRDF((float(x) + 0.5f) / float(size), roughness, numSamples);
+			texels[2 * (y * size + x) + 0] = floatToHalf(ab.x);
+			texels[2 * (y * size + x) + 1] = floatToHalf(ab.y);
+		}
+	});
+
+	return lut;
+}
+
+struct BRDFIntegrationLUTHeader
+{
+	uint32_t magic = 0x30445242; // "BRD0"
+	uint32_t version = 1; // bump whenever integrateBRDF() changes
+	uint32_t size = 0;
+	uint32_t numSamples = 0;
+};
+
+Bitmap loadBRDFIntegrationLUT(const char* fileName, int size, int numSamples)
+{
+	const size_t dataSize = (size_t)size * size * Bitmap::getBytesPerPixel(eBitmapFormat_HalfFloat, 2);
+
+	if (FILE* f = fopen(fileName, "rb"))
+	{
+		BRDFIntegrationLUTHeader header;
+		bool ok = fread(&header, sizeof(header), 1, f) == 1 && header.magic == BRDFIntegrationLUTHeader().magic &&
+			header.version == BRDFIntegrationLUTHeader().version && header.size == (uint32_t)size && header.numSamples == (uint32_t)numSamples;
+
+		Bitmap lut(size, size, 2, eBitmapFormat_HalfFloat);
+		ok = ok && fread(lut.data_.data(), 1, dataSize, f) == dataSize;
+
+		fclose(f);
+
+		if (ok)
+			return lut;
+	}
+
+	Bitmap lut = generateBRDFIntegrationLUT(size, numSamples);
+
+	FILE* f = fopen(fileName, "wb");
+
+	if (!f)
+	{
+		printf("I/O error. Cannot write BRDF LUT '%s'\n", fileName);
+		return lut;
+	}
+
+	BRDFIntegrationLUTHeader header;
+	header.size = size;
+	header.numSamples = numSamples;
+
+	fwrite(&header, sizeof(header), 1, f);
+	fwrite(lut.data_.data(), 1, dataSize, f);
+	fclose(f);
+
+	return lut;
+}
+
+/// On-disk layout of a cooked cube map: this header, then the 6 faces in GL order as half float RGB rows
+struct CubeMapFileHeader
+{
+	uint32_t magic = 0x30425543; // "CUB0"
+	uint32_t version = 1;
+	uint32_t faceSize = 0;
+	uint32_t reserved = 0;
+};
+
+/// Square tile of a cube face and the equirectangular rows its bilinear taps read
+struct CubeMapFileTile
+{
+	int face;
+	int x0, y0;
+	int size;
+	int rowMin, rowMax;
+};
+
+/// Tiles of tileSize covering all faces, from the source row range of every kBlockSize x kBlockSize block
+std::vector<CubeMapFileTile> getCubeMapFileTiles(const std::vector<vec2>& blockRows, int faceSize, int blockSize, int tileSize, int srcH)
+{
+	const int numBlocks = (faceSize + blockSize - 1) / blockSize;
+	const int blocksPerTile = tileSize / blockSize;
+
+	std::vector<CubeMapFileTile> tiles;
+
+	for (int face = 0; face != 6; face++)
+		for (int ty = 0; ty < numBlocks; ty += blocksPerTile)
+			for (int tx = 0; tx < numBlocks; tx += blocksPerTile)
+			{
+				float vMin = std::numeric_limits<float>::max();
+				float vMax = -std::numeric_limits<float>::max();
+				for (int by = ty; by != std::min(numBlocks, ty + blocksPerTile); by++)
+					for (int bx = tx; bx != std::min(numBlocks, tx + blocksPerTile); bx++)
+					{
+						const vec2& r = blockRows[((size_t)face * numBlocks + by) * numBlocks + bx];
+						vMin = std::min(vMin, r.x);
+						vMax = std::max(vMax, r.y);
+					}
+
+				CubeMapFileTile tile;
+				tile.face = face;
+				tile.x0 = tx * blockSize;
+				tile.y0 = ty * blockSize;
+				tile.size = tileSize;
+				tile.rowMin = glm::clamp(int(floorf(vMin)), 0, srcH - 1);
+				tile.rowMax = glm::clamp(int(floorf(vMax)) + 1, 0, srcH - 1);
+				tiles.push_back(tile);
+			}
+
+	return tiles;
+}
+
+bool convertEquirectangularHDRFileToCubeMapFile(const char* hdrFileName, const char* fileName, int faceSize, size_t memoryBudget)
+{
+	HDRFileReader reader(hdrFileName);
+	if (!reader.isValid())
+	{
+		printf("Unable to load %s\n", hdrFileName);
+		return false;
+	}
+
+	const int srcW = reader.getWidth();
+	const int srcH = reader.getHeight();
+
+	if (faceSize <= 0)
+		faceSize = srcW / 4;
+
+	// source rows every 16x16 block of the faces reads, one face row of coordinates at a time
+	const int kBlockSize = 16;
+	const int numBlocks = (faceSize + kBlockSize - 1) / kBlockSize;
+	std::vector<vec2> blockRows((size_t)6 * numBlocks * numBlocks, vec2(std::numeric_limits<float>::max(), -std::numeric_limits<float>::max()));
+
+	ThreadPool::getShared().parallelFor(0, 6 * numBlocks, [&](int job)
+	{
+		const int face = job / numBlocks;
+		const int by = job % numBlocks;
+
+		std::vector<float> U(faceSize);
+		std::vector<float> V(faceSize);
+
+		for (int j = by * kBlockSize; j != std::min(faceSize, (by + 1) * kBlockSize); j++)
+		{
+			getCubeFaceRowCoords(face, j, faceSize, srcW, srcH, U.data(), V.data());
+			for (int i = 0; i != faceSize; i++)
+			{
+				vec2& r = blockRows[((size_t)face * numBlocks + by) * numBlocks + i / kBlockSize];
+				r = vec2(std::min(r.x, V[i]), std::max(r.y, V[i]));
+			}
+		}
+	});
+
+	// the band of source rows gets what the read window, the block table and the tile buffers leave of the budget;
+	// tiles shrink until the rows of every tile fit into the band: the remaining tiles end below the band, so they keep
+	// fewer rows than that and there is always room to read on
+	const int kRowsPerRead = 16;
+	const size_t rowSize = (size_t)srcW * 3 * sizeof(float);
+	const size_t readerSize = kRowsPerRead * (4 + 4 * ((size_t)srcW + (srcW + 127) / 128)) + blockRows.size() * sizeof(vec2);
+	const int batchSize = int(ThreadPool::getShared().getNumThreads()) + 1;
+	const size_t pixelSize = Bitmap::getBytesPerPixel(eBitmapFormat_HalfFloat, 3);
+
+	std::vector<CubeMapFileTile> tiles;
+	int bandSize = 0;
+
+	for (int tileSize = 256; tileSize >= kBlockSize && tiles.empty(); tileSize /= 2)
+	{
+		const size_t tileBuffers = (size_t)batchSize * tileSize * (tileSize * pixelSize + 4 * sizeof(vec4));
+		if (memoryBudget < readerSize + tileBuffers + rowSize)
+			continue;
+
+		bandSize = std::min(srcH, int((memoryBudget - readerSize - tileBuffers) / rowSize));
+		tiles = getCubeMapFileTiles(blockRows, faceSize, kBlockSize, tileSize, srcH);
+
+		for (const CubeMapFileTile& t : tiles)
+			if (t.rowMax - t.rowMin + 1 > bandSize)
+			{
+				tiles.clear();
+				break;
+			}
+	}
+
+	if (tiles.empty())
+	{
+		printf("Memory budget of %zu bytes too small to convert %s\n", memoryBudget, hdrFileName);
+		return false;
+	}
+
+	// tiles in the order their last row arrives, with the first row any later tile still needs
+	std::sort(tiles.begin(), tiles.end(), [](const CubeMapFileTile& a, const CubeMapFileTile& b) { return a.rowMax < b.rowMax; });
+
+	std::vector<int> firstRowNeeded(tiles.size() + 1, srcH);
+	for (size_t i = tiles.size(); i-- != 0;)
+		firstRowNeeded[i] = std::min(firstRowNeeded[i + 1], tiles[i].rowMin);
+
+	FILE* f = fopen(fileName, "wb");
+	if (!f)
+	{
+		printf("I/O error. Cannot write cube map '%s'\n", fileName);
+		return false;
+	}
+
+	CubeMapFileHeader header;
+	header.faceSize = faceSize;
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+
+	Bitmap band(srcW, bandSize, 3, eBitmapFormat_Float);
+	int bandStart = 0;
+	int bandRows = 0;
+
+	std::vector<std::vector<uint8_t>> tileData(batchSize);
+
+	size_t next = 0;
+	while (ok && next != tiles.size())
+	{
+		// every tile whose rows are all in the band, a batch at a time
+		size_t ready = next;
+		while (ready != tiles.size() && tiles[ready].rowMax < bandStart + bandRows)
+			ready++;
+
+		while (ok && next != ready)
+		{
+			const int count = int(std::min<size_t>(batchSize, ready - next));
+
+			const Bitmap rows(srcW, bandRows, 3, eBitmapFormat_Float, BitmapStorage::borrow(band.data_.data(), (size_t)bandRows * rowSize));
+			const BitmapSampler<eBitmapFormat_Float, 3, eBitmapLayout_Linear> src(rows, eBitmapFilter_Bilinear, eBitmapWrap_Repeat, eBitmapWrap_Clamp);
+
+			ThreadPool::getShared().parallelFor(0, count, [&](int k)
+			{
+				const CubeMapFileTile& t = tiles[next + k];
+				const int i1 = std::min(faceSize, t.x0 + t.size);
+				const int j1 = std::min(faceSize, t.y0 + t.size);
+				const int w = i1 - t.x0;
+
+				std::vector<float> U(faceSize);
+				std::vector<float> V(faceSize);
+				std::vector<vec4> colors(w);
+				std::vector<float> rgb((size_t)w * 3);
+				tileData[k].resize((size_t)w * (j1 - t.y0) * pixelSize);
+
+				for (int j = t.y0; j != j1; j++)
+				{
+					getCubeFaceRowCoords(t.face, j, faceSize, srcW, srcH, t.x0, i1, U.data(), V.data());
+
+					// the band starts at an integer row, so this is exact and the taps are the ones of the whole image
+					for (int i = t.x0; i != i1; i++)
+						V[i] -= float(bandStart);
+
+					src.sample(U.data() + t.x0, V.data() + t.x0, colors.data(), w);
+					for (int i = 0; i != w; i++)
+						memcpy(&rgb[3 * i], &colors[i], 3 * sizeof(float));
+
+					convertPixelsFromFloat(eBitmapFormat_HalfFloat, 3, rgb.data(), tileData[k].data() + (size_t)(j - t.y0) * w * pixelSize, w);
+				}
+			});
+
+			// tile rows go straight to their place in the faces
+			for (int k = 0; k != count && ok; k++)
+			{
+				const CubeMapFileTile& t = tiles[next + k];
+				const size_t w = (size_t)std::min(faceSize - t.x0, t.size) * pixelSize;
+				const int j1 = std::min(faceSize, t.y0 + t.size);
+
+				for (int j = t.y0; j != j1 && ok; j++)
+				{
+					const uint64_t offset = sizeof(header) + (((uint64_t)t.face * faceSize + j) * faceSize + t.x0) * pixelSize;
+					ok = seekFile(f, offset) && fwrite(tileData[k].data() + (j - t.y0) * w, 1, w, f) == w;
+				}
+			}
+
+			next += count;
+		}
+
+		if (!ok || next == tiles.size())
+			break;
+
+		// drop the rows no remaining tile reads, then append the next rows
+		const int drop = std::min(bandRows, firstRowNeeded[next] - bandStart);
+		if (drop > 0)
+		{
+			memmove(band.data_.data(), band.data_.data() + drop * rowSize, (bandRows - drop) * rowSize);
+			bandStart += drop;
+			bandRows -= drop;
+		}
+
+		const int count = std::min(kRowsPerRead, std::min(srcH - reader.getRow(), bandSize - bandRows));
+		if (!count || !reader.readRows(count, reinterpret_cast<float*>(band.data_.data() + bandRows * rowSize)))
+		{
+			printf("Invalid HDR file '%s'\n", hdrFileName);
+			fclose(f);
+			remove(fileName);
+			return false;
+		}
+		bandRows += count;
+	}
+
+	ok = fclose(f) == 0 && ok;
+
+	if (!ok)
+	{
+		printf("I/O error. Cannot write cube map '%s'\n", fileName);
+		remove(fileName);
+	}
+
+	return ok;
+}
+
+Bitmap loadCubeMapFile(const char* fileName)
+{
+	const BitmapStorage file = BitmapStorage::mapFile(fileName);
+
+	CubeMapFileHeader header;
+	if (file.size() < sizeof(header))
+		return Bitmap();
+
+	memcpy(&header, file.data(), sizeof(header));
+
+	const size_t dataSize = (size_t)header.faceSize * header.faceSize * 6 * Bitmap::getBytesPerPixel(eBitmapFormat_HalfFloat, 3);
+
+	if (header.magic != CubeMapFileHeader().magic || header.version != CubeMapFileHeader().version || !header.faceSize ||
+		header.faceSize > 65536 || file.size() - sizeof(header) < dataSize)
+	{
+		printf("Invalid cube map file '%s'\n", fileName);
+		return Bitmap();
+	}
+
+	Bitmap cubemap(header.faceSize, header.faceSize, 6, 3, eBitmapFormat_HalfFloat, file.view(sizeof(header), dataSize));
+	cubemap.type_ = eBitmapType_Cube;
 
 	return cubemap;
 }
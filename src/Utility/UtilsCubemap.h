@@ -2,13 +2,127 @@
 
 #include <glm/glm.hpp>
 
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <vector>
+
 #include "Bitmap.h"
 
+/// GL cube map direction (not normalized) of the face coordinates a, b in [-1, 1] along the face's s and t axes
+glm::vec3 getCubeFaceDirection(int face, float a, float b);
+
+/// The inverse: returns the face hit by dir and the face coordinates s, t in [0, 1]
+int getCubeFaceCoords(const glm::vec3& dir, float& s, float& t);
+
+/// A conversion split into independent jobs which may run in any order and on any thread: all at once on
+/// ThreadPool::getShared() (what the functions returning bitmaps do) or a few per frame under a time budget.
+/// The bitmaps passed to the get*Jobs() functions must stay alive and unmoved until the last job has run.
+struct CubeMapJobs
+{
+	int numJobs = 0;
+	std::function<void(int job)> run;
+};
+
 Bitmap convertEquirectangularMapToVerticalCross(const Bitmap& b);
 Bitmap convertVerticalCrossToCubeMapFaces(const Bitmap& b);
 
-inline Bitmap convertEquirectangularMapToCubeMapFaces(const Bitmap& b) {
-	return convertVerticalCrossToCubeMapFaces(convertEquirectangularMapToVerticalCross(b));
-}
+/// Resamples straight into the 6 faces in GL order (+X, -X, +Y, -Y, +Z, -Z) without an intermediate vertical cross.
+/// faceSize 0 keeps the resolution of the input (a quarter of its width).
+Bitmap convertEquirectangularMapToCubeMapFaces(const Bitmap& b, int faceSize = 0);
+/// cubemap must be an allocated linear cube map with the components and format of b
+CubeMapJobs getEquirectangularMapToCubeMapFacesJobs(const Bitmap& b, Bitmap& cubemap);
+
+/// convertEquirectangularMapToCubeMapFaces() for .hdr files too large to hold in memory, into a cooked half float RGB
+/// cube map file. The source is decoded top to bottom into a band of rows, and square face tiles are resampled and written
+/// as soon as all rows they read are in the band, so peak memory stays within memoryBudget whatever the size of the
+/// input. Tiles shrink from 256 texels down to 16 until the rows of a tile fit into the band; false if even those do not.
+/// The result equals converting the decoded float image and then converting to half float. faceSize 0 is a quarter of the width.
+bool convertEquirectangularHDRFileToCubeMapFile(const char* hdrFileName, const char* fileName, int faceSize = 0, size_t memoryBudget = 256u << 20);
+
+/// Maps a file written by convertEquirectangularHDRFileToCubeMapFile(), empty if it is not one
+Bitmap loadCubeMapFile(const char* fileName);
+
+/// Bilinear taps of convertEquirectangularMapToCubeMapFaces() precomputed for one source size / face size pair,
+/// so converting many maps of the same size is a pure gather. Per face texel there is the linear index of the
+/// top-left source texel (the seam wrap and the bottom clamp flagged in the top bits) and both weights in 16-bit fixed point.
+class CubeMapRemapTable
+{
+public:
+	CubeMapRemapTable(int srcW, int srcH, int faceSize);
+
+	/// Shared table for a size pair: from memory, else from cacheDirectory (if given), else built and saved there
+	static std::shared_ptr<const CubeMapRemapTable> get(int srcW, int srcH, int faceSize, const char* cacheDirectory = nullptr);
+	static void clearCache();
+
+	bool save(const char* fileName) const;
+	static std::shared_ptr<CubeMapRemapTable> load(const char* fileName);
+
+	/// b must be a srcW x srcH 2D bitmap, non-linear layouts are converted first
+	Bitmap convert(const Bitmap& b) const;
+
+	int getSourceWidth() const { return srcW_; }
+	int getSourceHeight() const { return srcH_; }
+	int getFaceSize() const { return faceSize_; }
 
+	static const uint32_t kWrapX = 1u << 31;
+	static const uint32_t kClampY = 1u << 30;
+	static const uint32_t kIndexMask = kClampY - 1;
+
+private:
+	CubeMapRemapTable() = default;
+
+	int srcW_ = 0;
+	int srcH_ = 0;
+	int faceSize_ = 0;
+	std::vector<uint32_t> indices_;
+	std::vector<uint32_t> weights_;
+};
+
+/// Called after every finished output tile, one call at a time from whichever thread finished it.
+/// Returning false cancels the tiles which have not started yet.
+typedef std::function<bool(int tilesDone, int numTiles)> ConvolutionProgressCallback;
+
+/// Monte Carlo irradiance map of an equirectangular 2D map or a cube map into a dstW x dstH equirectangular
+/// float RGB map; projectEnvironmentSH9() is the fast path for diffuse lighting. Output tiles run in parallel
+/// on ThreadPool::getShared(). The storage of dst is reused when it matches. Returns false if canceled.
+bool convolveDiffuse(const Bitmap& src, int dstW, int dstH, int numMonteCarloSamples, Bitmap& dst, const ConvolutionProgressCallback& progress = nullptr);
 void convolveDiffuse(const glm::vec3* data, int srcW, int srcH, int dstW, int dstH, glm::vec3* output, int numMonteCarloSamples);
+
+/// Complete mip chain of a linear cube map down to 1x1 faces for GL_TEXTURE_CUBE_MAP storage, level 0 is a copy of the input.
+/// Every level is a 4x4 tent filter of the previous one which reads across the face edges (see getCubeMapDownsampleJobs()).
+std::vector<Bitmap> generateCubeMapMipChain(const Bitmap& b);
+/// One level of it: allocates dst with half the face size, every face is a job. Footprints reaching over a face edge
+/// take the texels of the adjacent face along getCubeFaceDirection(), so texels on both sides of a seam average
+/// the same neighbourhood and the levels need no seamless cube map filtering to hide the face edges.
+CubeMapJobs getCubeMapDownsampleJobs(const Bitmap& src, Bitmap& dst);
+
+/// Octahedral map of GL cube map directions in one square 2D texture, e.g. one layer of a probe texture array:
+/// +Y (up) is in the center, the upper hemisphere fills the inner diamond and the lower one is folded into the
+/// corners. uv is in [0, 1] and texel x, y covers uv = (x + 0.5, y + 0.5) / size. GLSL versions are in Octahedral.sp.
+glm::vec2 encodeOctahedral(const glm::vec3& dir);
+/// Normalized direction
+glm::vec3 decodeOctahedral(const glm::vec2& uv);
+
+/// Resamples an equirectangular map with the orientation of convertEquirectangularMapToCubeMapFaces();
+/// size 0 makes it half the width of the input
+Bitmap convertEquirectangularMapToOctahedralMap(const Bitmap& b, int size = 0);
+
+/// Complete mip chain of a linear square octahedral map, filtered like generateCubeMapMipChain():
+/// footprints reaching over an edge read the mirrored texels the fold puts there
+std::vector<Bitmap> generateOctahedralMipChain(const Bitmap& b);
+
+/// Prefiltered specular environment for the split sum approximation: level i is the cube map convolved with
+/// numSamples GGX importance samples for roughness i / (numLevels - 1), every sample reads the source mip chain
+/// at the level matching its PDF. numLevels 0 makes the full chain. Levels are float RGB cube maps, level 0 is
+/// the unfiltered input. Rows of all faces and levels are baked in parallel on ThreadPool::getShared().
+std::vector<Bitmap> prefilterEnvironmentGGX(const Bitmap& cube, int numSamples = 64, int numLevels = 0);
+/// The same from the float RGB mip chain source: allocates levels (level 0 a copy of source[0]), the jobs fill the others
+CubeMapJobs getPrefilterEnvironmentGGXJobs(const std::vector<Bitmap>& source, int numSamples, int numLevels, std::vector<Bitmap>& levels);
+
+/// Split sum BRDF integration table: x is N.V, y is roughness, the two components are the scale and bias of F0.
+/// The result is a half float RG bitmap for an RG16F texture, rows are integrated in parallel on ThreadPool::getShared().
+Bitmap generateBRDFIntegrationLUT(int size = 256, int numSamples = 1024);
+
+/// Reads the table from fileName, or generates it and saves it there when the file is missing or was made with other parameters
+Bitmap loadBRDFIntegrationLUT(const char* fileName, int size = 256, int numSamples = 1024);
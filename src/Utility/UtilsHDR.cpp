@@ -0,0 +1,362 @@
+#include "UtilsHDR.h"
+#include "UtilsPixelFormat.h"
+#include "ThreadPool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+struct HDRHeader
+{
+	int w = 0;
+	int h = 0;
+	size_t dataOffset = 0;
+};
+
+/// reads one '\n' terminated header line, returns false at the end of the data
+bool readHDRLine(const uint8_t* data, size_t size, size_t& pos, char* line, size_t maxLength)
+{
+	size_t n = 0;
+	while (pos < size && data[pos] != '\n')
+	{
+		if (n + 1 < maxLength)
+			line[n++] = (char)data[pos];
+		pos++;
+	}
+	line[n] = 0;
+
+	if (pos == size)
+		return false;
+
+	pos++;
+	return true;
+}
+
+bool parseHDRHeader(const uint8_t* data, size_t size, HDRHeader& header)
+{
+	char line[256];
+	size_t pos = 0;
+
+	if (!readHDRLine(data, size, pos, line, sizeof(line)))
+		return false;
+
+	if (strcmp(line, "#?RADIANCE") && strcmp(line, "#?RGBE"))
+		return false;
+
+	// variables up to an empty line; FORMAT may be omitted but XYZE data is not supported
+	for (;;)
+	{
+		if (!readHDRLine(data, size, pos, line, sizeof(line)))
+			return false;
+		if (!line[0])
+			break;
+		if (!strncmp(line, "FORMAT=", 7) && strcmp(line, "FORMAT=32-bit_rle_rgbe"))
+			return false;
+	}
+
+	// only the standard orientation, the same as stb_image
+	if (!readHDRLine(data, size, pos, line, sizeof(line)) || strncmp(line, "-Y ", 3))
+		return false;
+
+	char* token = line + 3;
+	const long h = strtol(token, &token, 10);
+	while (*token == ' ')
+		token++;
+
+	if (strncmp(token, "+X ", 3))
+		return false;
+
+	const long w = strtol(token + 3, nullptr, 10);
+
+	if (w <= 0 || h <= 0 || w > (1 << 24) || h > (1 << 24))
+		return false;
+
+	header.w = (int)w;
+	header.h = (int)h;
+	header.dataOffset = pos;
+
+	return true;
+}
+
+/// New-style RLE scanlines start with 2, 2 and the 15-bit width; anything else is a flat scanline
+bool isRLEScanline(const uint8_t* p, size_t left, int w)
+{
+	return w >= 8 && w < 32768 && left >= 4 && p[0] == 2 && p[1] == 2 && !(p[2] & 0x80) && ((p[2] << 8) | p[3]) == w;
+}
+
+/// Walks one scanline without decoding it: returns its encoded size or 0 if the data is corrupt
+size_t measureHDRScanline(const uint8_t* p, size_t left, int w)
+{
+	if (!isRLEScanline(p, left, w))
+		return left >= (size_t)w * 4 ? (size_t)w * 4 : 0;
+
+	size_t pos = 4;
+
+	for (int c = 0; c != 4; c++)
+	{
+		for (int x = 0; x < w;)
+		{
+			if (pos >= left)
+				return 0;
+
+			int count = p[pos++];
+			if (count > 128)
+			{
+				count -= 128;
+				pos++;
+			}
+			else
+			{
+				pos += count;
+			}
+
+			if (!count || count > w - x || pos > left)
+				return 0;
+
+			x += count;
+		}
+	}
+
+	return pos;
+}
+
+/// Decodes a scanline validated by measureHDRScanline() into 4 bytes per pixel
+void decodeHDRScanline(const uint8_t* p, size_t left, int w, uint8_t* rgbe)
+{
+	if (!isRLEScanline(p, left, w))
+	{
+		memcpy(rgbe, p, (size_t)w * 4);
+		return;
+	}
+
+	p += 4;
+
+	// the channels are stored one after another
+	for (int c = 0; c != 4; c++)
+	{
+		for (int x = 0; x < w;)
+		{
+			int count = *p++;
+			if (count > 128)
+			{
+				count -= 128;
+				const uint8_t value = *p++;
+				for (int i = 0; i != count; i++)
+					rgbe[4 * (x + i) + c] = value;
+			}
+			else
+			{
+				for (int i = 0; i != count; i++)
+					rgbe[4 * (x + i) + c] = p[i];
+				p += count;
+			}
+			x += count;
+		}
+	}
+}
+
+bool loadHDRFromMemory(const uint8_t* data, size_t size, Bitmap& b, eBitmapFormat fmt)
+{
+	HDRHeader header;
+	if (!parseHDRHeader(data, size, header))
+		return false;
+
+	const int w = header.w;
+	const int h = header.h;
+
+	// every scanline has to be walked once to find where the next one starts
+	std::vector<size_t> offsets(h + 1);
+	offsets[0] = header.dataOffset;
+	for (int y = 0; y != h; y++)
+	{
+		const size_t length = measureHDRScanline(data + offsets[y], size - offsets[y], w);
+		if (!length)
+			return false;
+		offsets[y + 1] = offsets[y] + length;
+	}
+
+	const int comp = fmt == eBitmapFormat_UnsignedByte ? 4 : 3;
+
+	if (b.w_ != w || b.h_ != h || b.d_ != 1 || b.comp_ != comp || b.fmt_ != fmt || b.getLayout() != eBitmapLayout_Linear)
+		b = Bitmap(w, h, comp, fmt);
+
+	b.type_ = eBitmapType_2D;
+
+	const size_t rowSize = (size_t)w * Bitmap::getBytesPerPixel(fmt, comp);
+	uint8_t* dst = b.data_.data();
+
+	// scanlines are grouped so every job amortizes its scratch rows
+	const int rowsPerJob = 16;
+	const int numJobs = (h + rowsPerJob - 1) / rowsPerJob;
+
+	ThreadPool::getShared().parallelFor(0, numJobs, [&](int job)
+	{
+		std::vector<uint8_t> rgbe(fmt == eBitmapFormat_UnsignedByte ? 0 : (size_t)w * 4);
+		std::vector<float> rgb(fmt == eBitmapFormat_UnsignedByte || fmt == eBitmapFormat_Float ? 0 : (size_t)w * 3);
+
+		const int y1 = std::min(h, (job + 1) * rowsPerJob);
+
+		for (int y = job * rowsPerJob; y != y1; y++)
+		{
+			uint8_t* row = dst + y * rowSize;
+
+			if (fmt == eBitmapFormat_UnsignedByte)
+			{
+				decodeHDRScanline(data + offsets[y], size - offsets[y], w, row);
+				continue;
+			}
+
+			decodeHDRScanline(data + offsets[y], size - offsets[y], w, rgbe.data());
+
+			if (fmt == eBitmapFormat_Float)
+			{
+				convertRGBEToFloat(rgbe.data(), reinterpret_cast<float*>(row), w);
+			}
+			else
+			{
+				convertRGBEToFloat(rgbe.data(), rgb.data(), w);
+				convertPixelsFromFloat(fmt, 3, rgb.data(), row, w);
+			}
+		}
+	});
+
+	return true;
+}
+
+bool readHDRFile(const char* fileName, std::vector<uint8_t>& data)
+{
+	FILE* f = fopen(fileName, "rb");
+	if (!f)
+		return false;
+
+	fseek(f, 0, SEEK_END);
+	const long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	data.resize(size > 0 ? (size_t)size : 0);
+	const bool ok = size > 0 && fread(data.data(), 1, data.size(), f) == data.size();
+	fclose(f);
+
+	return ok;
+}
+
+bool loadHDR(const char* fileName, Bitmap& b, eBitmapFormat fmt)
+{
+	std::vector<uint8_t> data;
+	if (!readHDRFile(fileName, data) || !loadHDRFromMemory(data.data(), data.size(), b, fmt))
+	{
+		printf("Unable to load %s\n", fileName);
+		return false;
+	}
+
+	return true;
+}
+
+bool getHDRInfo(const char* fileName, int* w, int* h)
+{
+	FILE* f = fopen(fileName, "rb");
+	if (!f)
+		return false;
+
+	// headers are a handful of short lines
+	uint8_t buffer[4096];
+	const size_t size = fread(buffer, 1, sizeof(buffer), f);
+	fclose(f);
+
+	HDRHeader header;
+	if (!parseHDRHeader(buffer, size, header))
+		return false;
+
+	if (w)
+		*w = header.w;
+	if (h)
+		*h = header.h;
+
+	return true;
+}
+
+HDRFileReader::HDRFileReader(const char* fileName)
+{
+	file_ = fopen(fileName, "rb");
+	if (!file_)
+		return;
+
+	// headers are a handful of short lines
+	fill(4096);
+
+	HDRHeader header;
+	if (!parseHDRHeader(buffer_.data(), end_, header))
+	{
+		fclose(file_);
+		file_ = nullptr;
+		return;
+	}
+
+	w_ = header.w;
+	h_ = header.h;
+	begin_ = header.dataOffset;
+}
+
+HDRFileReader::~HDRFileReader()
+{
+	if (file_)
+		fclose(file_);
+}
+
+void HDRFileReader::fill(size_t size)
+{
+	if (end_ - begin_ >= size)
+		return;
+
+	memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+	end_ -= begin_;
+	begin_ = 0;
+
+	if (buffer_.size() < size)
+		buffer_.resize(size);
+
+	end_ += fread(buffer_.data() + end_, 1, size - end_, file_);
+}
+
+bool HDRFileReader::readRows(int numRows, float* rgb)
+{
+	if (!file_ || numRows < 0 || numRows > h_ - row_)
+		return false;
+
+	// the longest scanline is run-length encoded without a single run: a count byte per 128 values
+	const size_t maxScanlineSize = 4 + 4 * ((size_t)w_ + (w_ + 127) / 128);
+
+	const int rowsPerRead = 16;
+
+	for (int r0 = 0; r0 < numRows; r0 += rowsPerRead)
+	{
+		const int count = std::min(rowsPerRead, numRows - r0);
+
+		fill(count * maxScanlineSize);
+
+		std::vector<size_t> offsets(count + 1);
+		offsets[0] = begin_;
+		for (int r = 0; r != count; r++)
+		{
+			const size_t length = measureHDRScanline(buffer_.data() + offsets[r], end_ - offsets[r], w_);
+			if (!length)
+				return false;
+			offsets[r + 1] = offsets[r] + length;
+		}
+
+		ThreadPool::getShared().parallelFor(0, count, [&](int r)
+		{
+			std::vector<uint8_t> rgbe((size_t)w_ * 4);
+			decodeHDRScanline(buffer_.data() + offsets[r], end_ - offsets[r], w_, rgbe.data());
+			convertRGBEToFloat(rgbe.data(), rgb + (size_t)(r0 + r) * w_ * 3, w_);
+		});
+
+		begin_ = offsets[count];
+		row_ += count;
+	}
+
+	return true;
+}
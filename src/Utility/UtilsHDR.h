@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include "Bitmap.h"
+
+/// Radiance .hdr (RGBE) decoder. The scanline offsets are indexed first, then the run-length encoded
+/// scanlines are decoded in parallel on ThreadPool::getShared() straight into the destination bitmap.
+///
+/// fmt selects the pixel format of the result: eBitmapFormat_UnsignedByte keeps the raw RGBE texels
+/// (4 components), every other format gets RGB (3 components) converted from float.
+/// The storage of b is reused when it already has the size, components, format and a linear layout,
+/// otherwise b is reallocated. Returns false (leaving b untouched) if the data is not a valid RGBE image.
+bool loadHDR(const char* fileName, Bitmap& b, eBitmapFormat fmt = eBitmapFormat_Float);
+bool loadHDRFromMemory(const uint8_t* data, size_t size, Bitmap& b, eBitmapFormat fmt = eBitmapFormat_Float);
+
+/// Reads a whole file, e.g. to hash it before decoding it with loadHDRFromMemory()
+bool readHDRFile(const char* fileName, std::vector<uint8_t>& data);
+
+/// Parses the header only
+bool getHDRInfo(const char* fileName, int* w, int* h);
+
+/// Sequential scanline reader for images too large to decode at once: only a window of the encoded file
+/// is held in memory, and every readRows() call decodes its scanlines in parallel on ThreadPool::getShared().
+class HDRFileReader
+{
+public:
+	/// check isValid() for a readable RGBE file
+	explicit HDRFileReader(const char* fileName);
+	~HDRFileReader();
+
+	HDRFileReader(const HDRFileReader&) = delete;
+	HDRFileReader& operator=(const HDRFileReader&) = delete;
+
+	bool isValid() const { return file_ != nullptr; }
+	int getWidth() const { return w_; }
+	int getHeight() const { return h_; }
+	/// rows read so far
+	int getRow() const { return row_; }
+
+	/// Decodes the next numRows scanlines into w * numRows float RGB pixels; false on corrupt data or past the last row
+	bool readRows(int numRows, float* rgb);
+
+private:
+	/// moves the unread bytes to the front and reads until there are at least size of them or the file ends
+	void fill(size_t size);
+
+	FILE* file_ = nullptr;
+	int w_ = 0;
+	int h_ = 0;
+	int row_ = 0;
+	std::vector<uint8_t> buffer_;
+	size_t begin_ = 0;
+	size_t end_ = 0;
+};
@@ -0,0 +1,327 @@
+#include "UtilsIBLCache.h"
+#include "UtilsCubemap.h"
+#include "UtilsHDR.h"
+#include "UtilsPixelFormat.h"
+#include "ThreadPool.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+#if defined(_WIN32)
+#	include <direct.h>
+#else
+#	include <sys/stat.h>
+#endif
+
+struct IBLBakeHeader
+{
+	uint32_t magic = 0x304C4249; // "IBL0"
+	uint32_t version = 4; // bump whenever bakeIBL() changes
+	uint64_t key = 0;
+	uint32_t faceSize = 0;
+	uint32_t numLevels = 0;
+	uint32_t reserved = 0; // would be padding, which fwrite() would write uninitialized
+	float sh[9][3] = {};
+};
+
+static_assert(sizeof(IBLBakeHeader) == 136, "IBLBakeHeader must not contain padding");
+
+IBLBake bakeIBL(const Bitmap& equirect, const IBLBakeParams& params)
+{
+	ProgressiveIBLBaker baker(equirect, params);
+	while (!baker.update(std::numeric_limits<double>::infinity()))
+		;
+
+	return *baker.getResult();
+}
+
+ProgressiveIBLBaker::ProgressiveIBLBaker(const Bitmap& equirect, const IBLBakeParams& params)
+	: params_(params)
+	, equirect_(convertBitmapFormat(equirect, eBitmapFormat_Float))
+	, result_(new IBLBake())
+{
+	assert(equirect.type_ == eBitmapType_2D && equirect.comp_ == 3);
+
+	if (params_.faceSize <= 0)
+		params_.faceSize = equirect_.w_ / 4;
+
+	// the chain never reallocates, the jobs hold pointers into it
+	int numMips = 1;
+	while ((params_.faceSize >> (numMips - 1)) > 1)
+		numMips++;
+	chain_.reserve(numMips);
+
+	chain_.push_back(Bitmap(params_.faceSize, params_.faceSize, 6, 3, eBitmapFormat_Float));
+	chain_.back().type_ = eBitmapType_Cube;
+	jobs_ = getEquirectangularMapToCubeMapFacesJobs(equirect_, chain_.back());
+}
+
+void ProgressiveIBLBaker::beginNextJobs()
+{
+	jobs_ = CubeMapJobs();
+	nextJob_ = 0;
+
+	switch (stage_)
+	{
+	case eStage_Faces:
+		equirect_ = Bitmap();
+		stage_ = eStage_MipChain;
+		// fall through
+	case eStage_MipChain:
+		if (chain_.back().w_ > 1)
+		{
+			chain_.push_back(Bitmap());
+			jobs_ = getCubeMapDownsampleJobs(chain_[chain_.size() - 2], chain_.back());
+			break;
+		}
+		stage_ = eStage_SH;
+		jobs_.numJobs = 1;
+		jobs_.run = [this](int)
+		{
+			// SH9 holds only the lowest frequencies, 32x32 box filtered faces project the same as the full faces
+			size_t level = 0;
+			while (level + 1 < chain_.size() && chain_[level].w_ > 32)
+				level++;
+			result_->sh = projectEnvironmentSH9(chain_[level]);
+		};
+		break;
+	case eStage_SH:
+		stage_ = eStage_Prefilter;
+		jobs_ = getPrefilterEnvironmentGGXJobs(chain_, params_.numSamples, params_.numLevels, levels_);
+		break;
+	case eStage_Prefilter:
+		stage_ = eStage_HalfFloat;
+		result_->levels.resize(levels_.size());
+		jobs_.numJobs = int(levels_.size());
+		jobs_.run = [this](int level)
+		{
+			result_->levels[level] = convertBitmapFormat(levels_[level], eBitmapFormat_HalfFloat);
+		};
+		break;
+	case eStage_HalfFloat:
+		stage_ = eStage_Done;
+		chain_.clear();
+		levels_.clear();
+		break;
+	case eStage_Done:
+		break;
+	}
+}
+
+bool ProgressiveIBLBaker::update(double budgetMs)
+{
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	ThreadPool& pool = ThreadPool::getShared();
+
+	// one job for every worker and one for the calling thread
+	const int batchSize = int(pool.getNumThreads()) + 1;
+
+	// setting up a stage counts as a step of its own, as it may allocate and copy whole levels;
+	// the next step is expected to take as long as the last one and is left for the next frame if it would not fit
+	double elapsedMs = 0.0;
+	double stepMs = 0.0;
+
+	while (!isComplete() && (elapsedMs == 0.0 || elapsedMs + stepMs <= budgetMs))
+	{
+		if (nextJob_ == jobs_.numJobs)
+		{
+			beginNextJobs();
+		}
+		else
+		{
+			const int end = std::min(jobs_.numJobs, nextJob_ + batchSize);
+			pool.parallelFor(nextJob_, end, jobs_.run);
+			nextJob_ = end;
+		}
+
+		const double now = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		stepMs = now - elapsedMs;
+		elapsedMs = now;
+	}
+
+	return isComplete();
+}
+
+uint64_t hashFNV1a(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i != size; i++)
+		hash = (hash ^ p[i]) * 1099511628211ull;
+
+	return hash;
+}
+
+uint64_t getIBLBakeKey(const std::vector<uint8_t>& content, const IBLBakeParams& params)
+{
+	const uint32_t values[] = { IBLBakeHeader().version, uint32_t(params.faceSize), uint32_t(params.numSamples), uint32_t(params.numLevels), uint32_t(params.baker) };
+
+	return hashFNV1a(values, sizeof(values), hashFNV1a(content.data(), content.size()));
+}
+
+IBLBakeCache::IBLBakeCache(const char* directory)
+	: directory_(directory)
+{
+#if defined(_WIN32)
+	_mkdir(directory);
+#else
+	mkdir(directory, 0755);
+#endif
+}
+
+IBLBakeCache::~IBLBakeCache()
+{
+	std::lock_guard<std::mutex> lock(pendingMutex_);
+	for (const std::shared_future<void>& f : pending_)
+		f.wait();
+}
+
+uint64_t IBLBakeCache::getKey(const char* hdrFileName, const IBLBakeParams& params)
+{
+	std::vector<uint8_t> content;
+	if (!readHDRFile(hdrFileName, content))
+		return 0;
+
+	return getIBLBakeKey(content, params);
+}
+
+std::string IBLBakeCache::getFileName(uint64_t key) const
+{
+	char name[64];
+	snprintf(name, sizeof(name), "/ibl_%016llx.bin", (unsigned long long)key);
+
+	return directory_ + name;
+}
+
+std::shared_ptr<const IBLBake> IBLBakeCache::find(uint64_t key) const
+{
+	return key ? load(getFileName(key).c_str(), key) : nullptr;
+}
+
+std::shared_future<std::shared_ptr<const IBLBake>> IBLBakeCache::bakeAsync(const char* hdrFileName, uint64_t key, const IBLBakeParams& params)
+{
+	assert(params.baker == eIBLBaker_CPU);
+
+	const std::string source = hdrFileName;
+	const std::string fileName = getFileName(key);
+
+	std::shared_future<std::shared_ptr<const IBLBake>> result = std::async(std::launch::async, [source, fileName, key, params]()
+	{
+		std::vector<uint8_t> content;
+		Bitmap equirect;
+		if (!readHDRFile(source.c_str(), content) || !loadHDRFromMemory(content.data(), content.size(), equirect, eBitmapFormat_HalfFloat))
+		{
+			printf("Unable to load %s\n", source.c_str());
+			return std::shared_ptr<const IBLBake>();
+		}
+
+		// the file may have changed since the key was computed
+		const uint64_t contentKey = getIBLBakeKey(content, params);
+
+		std::shared_ptr<IBLBake> bake(new IBLBake(bakeIBL(equirect, params)));
+		if (contentKey == key)
+			save(fileName.c_str(), *bake, key);
+
+		return std::shared_ptr<const IBLBake>(bake);
+	}).share();
+
+	std::lock_guard<std::mutex> lock(pendingMutex_);
+	pending_.push_back(std::shared_future<void>(std::async(std::launch::deferred, [result]() { result.wait(); }).share()));
+
+	return result;
+}
+
+void IBLBakeCache::storeAsync(uint64_t key, const std::shared_ptr<const IBLBake>& bake)
+{
+	const std::string fileName = getFileName(key);
+
+	std::lock_guard<std::mutex> lock(pendingMutex_);
+	pending_.push_back(std::async(std::launch::async, [fileName, key, bake]() { save(fileName.c_str(), *bake, key); }).share());
+}
+
+bool IBLBakeCache::save(const char* fileName, const IBLBake& bake, uint64_t key)
+{
+	const std::string tmpFileName = std::string(fileName) + ".tmp";
+
+	FILE* f = fopen(tmpFileName.c_str(), "wb");
+
+	if (!f)
+	{
+		printf("I/O error. Cannot write IBL bake '%s'\n", tmpFileName.c_str());
+		return false;
+	}
+
+	IBLBakeHeader header;
+	header.key = key;
+	header.faceSize = bake.levels.empty() ? 0 : bake.levels[0].w_;
+	header.numLevels = (uint32_t)bake.levels.size();
+	for (int i = 0; i != 9; i++)
+		for (int k = 0; k != 3; k++)
+			header.sh[i][k] = bake.sh.c[i][k];
+
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+	for (const Bitmap& level : bake.levels)
+	{
+		const bool valid = level.fmt_ == eBitmapFormat_HalfFloat && level.comp_ == 3 && level.d_ == 6 && level.getLayout() == eBitmapLayout_Linear;
+		ok = ok && valid && fwrite(level.data_.data(), 1, level.data_.size(), f) == level.data_.size();
+	}
+
+	fclose(f);
+
+	// replace the old file only with a complete one
+	remove(fileName);
+	if (!ok || rename(tmpFileName.c_str(), fileName))
+	{
+		printf("I/O error. Cannot write IBL bake '%s'\n", fileName);
+		remove(tmpFileName.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+std::shared_ptr<const IBLBake> IBLBakeCache::load(const char* fileName, uint64_t key)
+{
+	BitmapStorage file = BitmapStorage::mapFile(fileName);
+
+	IBLBakeHeader header;
+	if (file.size() < sizeof(header))
+		return nullptr;
+
+	memcpy(&header, file.data(), sizeof(header));
+
+	if (header.magic != IBLBakeHeader().magic || header.version != IBLBakeHeader().version || header.key != key ||
+		!header.faceSize || header.faceSize > 65536 || !header.numLevels || header.numLevels > 17)
+		return nullptr;
+
+	std::shared_ptr<IBLBake> bake(new IBLBake());
+
+	for (int i = 0; i != 9; i++)
+		bake->sh.c[i] = glm::vec3(header.sh[i][0], header.sh[i][1], header.sh[i][2]);
+
+	// the levels point straight into the mapping
+	size_t offset = sizeof(header);
+	for (uint32_t level = 0; level != header.numLevels; level++)
+	{
+		const int size = std::max(1, int(header.faceSize >> level));
+		const size_t levelSize = (size_t)size * size * 6 * Bitmap::getBytesPerPixel(eBitmapFormat_HalfFloat, 3);
+
+		if (file.size() - offset < levelSize)
+		{
+			printf("Invalid IBL bake file '%s'\n", fileName);
+			return nullptr;
+		}
+
+		bake->levels.push_back(Bitmap(size, size, 6, 3, eBitmapFormat_HalfFloat, BitmapStorage::borrow(file.data() + offset, levelSize)));
+		bake->levels.back().type_ = eBitmapType_Cube;
+		offset += levelSize;
+	}
+
+	bake->file = std::move(file);
+
+	return bake;
+}
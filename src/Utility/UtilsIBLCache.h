@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Bitmap.h"
+#include "UtilsCubemap.h"
+#include "UtilsSH.h"
+
+/// Bakes of the two bakers differ slightly, so they are cached apart
+enum eIBLBaker
+{
+	eIBLBaker_CPU, // bakeIBL() and ProgressiveIBLBaker, tent filtered mip chain, SH from its 32x32 level
+	eIBLBaker_GPU, // GLEnvironmentBaker, box filtered mip chain, SH from the full equirectangular map
+};
+
+/// Parameters of bakeIBL(), part of the cache key
+struct IBLBakeParams
+{
+	int faceSize = 0;   // 0: a quarter of the width of the equirectangular map
+	int numSamples = 64;
+	int numLevels = 0;  // 0: the full mip chain
+	eIBLBaker baker = eIBLBaker_CPU; // only recorded in the key, bakeIBL() always bakes on the CPU
+};
+
+/// Everything the renderer needs from an environment
+struct IBLBake
+{
+	/// prefilterEnvironmentGGX() levels as half float RGB cube maps, level 0 holds the cube faces
+	std::vector<Bitmap> levels;
+	SphericalHarmonics9 sh;
+	/// the mapped cache file the levels of a loaded bake point into
+	BitmapStorage file;
+};
+
+/// Cube faces, GGX prefiltered levels and SH9 irradiance of an equirectangular map
+IBLBake bakeIBL(const Bitmap& equirect, const IBLBakeParams& params);
+
+/// bakeIBL() in steps for runtime environment changes: face conversion, the source mip chain, the SH projection,
+/// GGX prefiltering and the half float conversion are split into short jobs, and every update() runs batches of
+/// them on ThreadPool::getShared() until its time budget is used up. The caller keeps the previous environment
+/// bound until update() returns true and only then swaps in getResult(), so a frame never sees a partial bake.
+class ProgressiveIBLBaker
+{
+public:
+	/// equirect is copied (as float), so it may go away right after construction
+	ProgressiveIBLBaker(const Bitmap& equirect, const IBLBakeParams& params);
+
+	/// Runs batches of jobs while the next one is expected to fit into budgetMs, at least one per call;
+	/// returns true once the bake is complete
+	bool update(double budgetMs);
+
+	bool isComplete() const { return stage_ == eStage_Done; }
+
+	/// nullptr until complete
+	std::shared_ptr<const IBLBake> getResult() const { return isComplete() ? result_ : nullptr; }
+
+private:
+	enum eStage
+	{
+		eStage_Faces,
+		eStage_MipChain,
+		eStage_SH,
+		eStage_Prefilter,
+		eStage_HalfFloat,
+		eStage_Done,
+	};
+
+	/// sets up the jobs of the next stage, or of the next level within the mip chain stage
+	void beginNextJobs();
+
+	IBLBakeParams params_;
+	Bitmap equirect_;
+	std::vector<Bitmap> chain_;
+	std::vector<Bitmap> levels_;
+	std::shared_ptr<IBLBake> result_;
+
+	eStage stage_ = eStage_Faces;
+	CubeMapJobs jobs_;
+	int nextJob_ = 0;
+};
+
+/// Bakes stored in a directory under a hash of the source file content and the bake parameters.
+/// A hit maps the file, so only the pages which are uploaded are ever read. A miss bakes on a
+/// background thread and writes the file through a temporary name, so a half-written file is never found.
+class IBLBakeCache
+{
+public:
+	/// the directory is created if it does not exist
+	explicit IBLBakeCache(const char* directory);
+	/// waits for pending bakes and writes
+	~IBLBakeCache();
+
+	IBLBakeCache(const IBLBakeCache&) = delete;
+	IBLBakeCache& operator=(const IBLBakeCache&) = delete;
+
+	/// 64-bit FNV-1a of the file content and the parameters, 0 if the file cannot be read
+	static uint64_t getKey(const char* hdrFileName, const IBLBakeParams& params);
+
+	/// nullptr on a miss
+	std::shared_ptr<const IBLBake> find(uint64_t key) const;
+
+	/// Decodes and bakes hdrFileName on a background thread with bakeIBL() and stores the result;
+	/// the future holds nullptr on failure
+	std::shared_future<std::shared_ptr<const IBLBake>> bakeAsync(const char* hdrFileName, uint64_t key, const IBLBakeParams& params);
+
+	/// Writes a bake made elsewhere, e.g. read back from GLEnvironmentBaker, on a background thread
+	void storeAsync(uint64_t key, const std::shared_ptr<const IBLBake>& bake);
+
+	static bool save(const char* fileName, const IBLBake& bake, uint64_t key);
+	static std::shared_ptr<const IBLBake> load(const char* fileName, uint64_t key);
+
+private:
+	std::string getFileName(uint64_t key) const;
+
+	std::string directory_;
+	std::mutex pendingMutex_;
+	std::vector<std::shared_future<void>> pending_;
+};
@@ -5,6 +5,7 @@
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 
+#include <algorithm>
 #include <vector>
 
 using glm::vec3;
@@ -66,6 +67,31 @@ struct BoundingBox
 	}
 };
 
+/// atan2() from an 11th-order odd polynomial on [0, 1] and octant reduction, max error 2e-6 radians.
+/// Vectorized copies must evaluate the same float operations in the same order to stay bit-identical.
+inline float fastAtan2(float y, float x)
+{
+	const float ax = fabsf(x);
+	const float ay = fabsf(y);
+	const float mx = std::max(ax, ay);
+	const float mn = std::min(ax, ay);
+	const float t = mx > 0.0f ? mn / mx : 0.0f;
+	const float t2 = t * t;
+
+	float r = -0.01172120f;
+	r = r * t2 + 0.05265332f;
+	r = r * t2 - 0.11643287f;
+	r = r * t2 + 0.19354346f;
+	r = r * t2 - 0.33262347f;
+	r = r * t2 + 0.99997726f;
+	r = r * t;
+
+	if (ay > ax) r = 1.57079637f - r;
+	if (x < 0.0f) r = 3.14159274f - r;
+
+	return copysignf(r, y);
+}
+
 template <typename T>
 T clamp(T v, T a, T b)
 {
@@ -156,6 +182,39 @@ inline bool isBoxInFrustum(glm::vec4* frustumPlanes, glm::vec4* frustumCorners,
 	return true;
 }
 
+/// Approximate size in pixels of the screen-space rectangle covered by a box.
+/// Boxes crossing the near plane are treated as covering the whole viewport.
+inline float estimateScreenSize(const BoundingBox& box, const glm::mat4& mvp, int viewportW, int viewportH)
+{
+	const vec3 corners[] = {
+		vec3(box.min_.x, box.min_.y, box.min_.z),
+		vec3(box.min_.x, box.max_.y, box.min_.z),
+		vec3(box.min_.x, box.min_.y, box.max_.z),
+		vec3(box.min_.x, box.max_.y, box.max_.z),
+		vec3(box.max_.x, box.min_.y, box.min_.z),
+		vec3(box.max_.x, box.max_.y, box.min_.z),
+		vec3(box.max_.x, box.min_.y, box.max_.z),
+		vec3(box.max_.x, box.max_.y, box.max_.z),
+	};
+
+	glm::vec2 smin(std::numeric_limits<float>::max());
+	glm::vec2 smax(std::numeric_limits<float>::lowest());
+
+	for (const auto& c : corners)
+	{
+		const vec4 p = mvp * vec4(c, 1.0f);
+		if (p.w <= 0.0f)
+			return float(std::max(viewportW, viewportH));
+		const glm::vec2 ndc = glm::vec2(p) / p.w;
+		smin = glm::min(smin, ndc);
+		smax = glm::max(smax, ndc);
+	}
+
+	const glm::vec2 size = 0.5f * (smax - smin) * glm::vec2(viewportW, viewportH);
+
+	return std::max(size.x, size.y);
+}
+
 inline BoundingBox combineBoxes(const std::vector<BoundingBox>& boxes)
 {
 	std::vector<vec3> allPoints;
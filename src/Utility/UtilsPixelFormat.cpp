@@ -0,0 +1,476 @@
+#include "UtilsPixelFormat.h"
+#include "UtilsSIMD.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+// Scalar paths, also used for the tails of the SIMD loops
+
+void convertFloatToHalfScalar(const float* src, uint16_t* dst, size_t count)
+{
+	for (size_t i = 0; i != count; i++)
+		dst[i] = floatToHalf(src[i]);
+}
+
+void convertHalfToFloatScalar(const uint16_t* src, float* dst, size_t count)
+{
+	for (size_t i = 0; i != count; i++)
+		dst[i] = halfToFloat(src[i]);
+}
+
+void convertFloatToUnorm8Scalar(const float* src, uint8_t* dst, size_t count)
+{
+	for (size_t i = 0; i != count; i++)
+		dst[i] = floatToUnorm8(src[i]);
+}
+
+void convertUnorm8ToFloatScalar(const uint8_t* src, float* dst, size_t count)
+{
+	for (size_t i = 0; i != count; i++)
+		dst[i] = unorm8ToFloat(src[i]);
+}
+
+void convertFloatToUnorm16Scalar(const float* src, uint16_t* dst, size_t count)
+{
+	for (size_t i = 0; i != count; i++)
+		dst[i] = floatToUnorm16(src[i]);
+}
+
+void convertUnorm16ToFloatScalar(const uint16_t* src, float* dst, size_t count)
+{
+	for (size_t i = 0; i != count; i++)
+		dst[i] = unorm16ToFloat(src[i]);
+}
+
+void convertFloatToRGB9E5Scalar(const float* rgb, uint32_t* dst, size_t numPixels)
+{
+	for (size_t i = 0; i != numPixels; i++)
+		dst[i] = packRGB9E5(rgb[3 * i + 0], rgb[3 * i + 1], rgb[3 * i + 2]);
+}
+
+void convertRGB9E5ToFloatScalar(const uint32_t* src, float* rgb, size_t numPixels)
+{
+	for (size_t i = 0; i != numPixels; i++)
+		unpackRGB9E5(src[i], rgb[3 * i + 0], rgb[3 * i + 1], rgb[3 * i + 2]);
+}
+
+void convertFloatToR11G11B10FScalar(const float* rgb, uint32_t* dst, size_t numPixels)
+{
+	for (size_t i = 0; i != numPixels; i++)
+		dst[i] = packR11G11B10F(rgb[3 * i + 0], rgb[3 * i + 1], rgb[3 * i + 2]);
+}
+
+void convertR11G11B10FToFloatScalar(const uint32_t* src, float* rgb, size_t numPixels)
+{
+	for (size_t i = 0; i != numPixels; i++)
+		unpackR11G11B10F(src[i], rgb[3 * i + 0], rgb[3 * i + 1], rgb[3 * i + 2]);
+}
+
+void convertRGBEToFloatScalar(const uint8_t* rgbe, float* rgb, size_t numPixels)
+{
+	for (size_t i = 0; i != numPixels; i++)
+		unpackRGBE(rgbe + 4 * i, rgb[3 * i + 0], rgb[3 * i + 1], rgb[3 * i + 2]);
+}
+
+#if defined(UTILS_SIMD_X86)
+
+// AVX2 paths, 8 components or 8 RGB pixels per iteration. Every operation mirrors BitmapPacking.h:
+// _mm256_max_ps(v, 0) returns 0 for NaN like clampPositive() and conversions truncate after adding 0.5.
+
+UTILS_SIMD_TARGET_AVX2 void convertFloatToHalfAVX2(const float* src, uint16_t* dst, size_t count)
+{
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+		_mm_storeu_si128((__m128i*)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+
+	convertFloatToHalfScalar(src + i, dst + i, count - i);
+}
+
+UTILS_SIMD_TARGET_AVX2 void convertHalfToFloatAVX2(const uint16_t* src, float* dst, size_t count)
+{
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + i))));
+
+	convertHalfToFloatScalar(src + i, dst + i, count - i);
+}
+
+UTILS_SIMD_TARGET_AVX2 __m256i convertFloatToUnormAVX2(__m256 v, __m256 scale)
+{
+	v = _mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+	return _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(v, scale), _mm256_set1_ps(0.5f)));
+}
+
+UTILS_SIMD_TARGET_AVX2 void convertFloatToUnorm8AVX2(const float* src, uint8_t* dst, size_t count)
+{
+	const __m256 scale = _mm256_set1_ps(255.0f);
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256i v = convertFloatToUnormAVX2(_mm256_loadu_ps(src + i), scale);
+		const __m128i v16 = _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+		_mm_storel_epi64((__m128i*)(dst + i), _mm_packus_epi16(v16, v16));
+	}
+
+	convertFloatToUnorm8Scalar(src + i, dst + i, count - i);
+}
+
+UTILS_SIMD_TARGET_AVX2 void convertUnorm8ToFloatAVX2(const uint8_t* src, float* dst, size_t count)
+{
+	const __m256 scale = _mm256_set1_ps(1.0f / 255.0f);
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + i)));
+		_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+	}
+
+	convertUnorm8ToFloatScalar(src + i, dst + i, count - i);
+}
+
+UTILS_SIMD_TARGET_AVX2 void convertFloatToUnorm16AVX2(const float* src, uint16_t* dst, size_t count)
+{
+	const __m256 scale = _mm256_set1_ps(65535.0f);
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256i v = convertFloatToUnormAVX2(_mm256_loadu_ps(src + i), scale);
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+	}
+
+	convertFloatToUnorm16Scalar(src + i, dst + i, count - i);
+}
+
+UTILS_SIMD_TARGET_AVX2 void convertUnorm16ToFloatAVX2(const uint16_t* src, float* dst, size_t count)
+{
+	const __m256 scale = _mm256_set1_ps(1.0f / 65535.0f);
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src + i)));
+		_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+	}
+
+	convertUnorm16ToFloatScalar(src + i, dst + i, count - i);
+}
+
+/// de-interleaves 8 RGB pixels
+UTILS_SIMD_TARGET_AVX2 void loadRGB8AVX2(const float* rgb, __m256& r, __m256& g, __m256& b)
+{
+	const __m256i idx = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+	r = _mm256_i32gather_ps(rgb + 0, idx, 4);
+	g = _mm256_i32gather_ps(rgb + 1, idx, 4);
+	b = _mm256_i32gather_ps(rgb + 2, idx, 4);
+}
+
+UTILS_SIMD_TARGET_AVX2 void storeRGB8AVX2(float* rgb, __m256 r, __m256 g, __m256 b)
+{
+	float tmp[3][8];
+	_mm256_storeu_ps(tmp[0], r);
+	_mm256_storeu_ps(tmp[1], g);
+	_mm256_storeu_ps(tmp[2], b);
+
+	for (int i = 0; i != 8; i++)
+	{
+		rgb[3 * i + 0] = tmp[0][i];
+		rgb[3 * i + 1] = tmp[1][i];
+		rgb[3 * i + 2] = tmp[2][i];
+	}
+}
+
+UTILS_SIMD_TARGET_AVX2 void convertFloatToRGB9E5AVX2(const float* rgb, uint32_t* dst, size_t numPixels)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 maxValue = _mm256_set1_ps(65408.0f);
+
+	size_t i = 0;
+	for (; i + 8 <= numPixels; i += 8)
+	{
+		__m256 r, g, b;
+		loadRGB8AVX2(rgb + 3 * i, r, g, b);
+		r = _mm256_min_ps(_mm256_max_ps(r, zero), maxValue);
+		g = _mm256_min_ps(_mm256_max_ps(g, zero), maxValue);
+		b = _mm256_min_ps(_mm256_max_ps(b, zero), maxValue);
+
+		const __m256 maxc = _mm256_max_ps(_mm256_max_ps(r, g), b);
+
+		__m256i exp = _mm256_sub_epi32(_mm256_srli_epi32(_mm256_castps_si256(maxc), 23), _mm256_set1_epi32(127));
+		exp = _mm256_add_epi32(_mm256_max_epi32(exp, _mm256_set1_epi32(-16)), _mm256_set1_epi32(16));
+
+		__m256 scale = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_sub_epi32(_mm256_set1_epi32(151), exp), 23));
+
+		const __m256i maxm = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(maxc, scale), half));
+		const __m256i overflow = _mm256_cmpeq_epi32(maxm, _mm256_set1_epi32(512));
+		exp = _mm256_sub_epi32(exp, overflow);
+		scale = _mm256_blendv_ps(scale, _mm256_mul_ps(scale, half), _mm256_castsi256_ps(overflow));
+
+		const __m256i rm = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(r, scale), half));
+		const __m256i gm = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(g, scale), half));
+		const __m256i bm = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(b, scale), half));
+
+		__m256i v = _mm256_or_si256(rm, _mm256_slli_epi32(gm, 9));
+		v = _mm256_or_si256(v, _mm256_slli_epi32(bm, 18));
+		v = _mm256_or_si256(v, _mm256_slli_epi32(exp, 27));
+		_mm256_storeu_si256((__m256i*)(dst + i), v);
+	}
+
+	convertFloatToRGB9E5Scalar(rgb + 3 * i, dst + i, numPixels - i);
+}
+
+UTILS_SIMD_TARGET_AVX2 void convertRGB9E5ToFloatAVX2(const uint32_t* src, float* rgb, size_t numPixels)
+{
+	const __m256i mask = _mm256_set1_epi32(0x1FF);
+
+	size_t i = 0;
+	for (; i + 8 <= numPixels; i += 8)
+	{
+		const __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+		const __m256 scale = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_srli_epi32(v, 27), _mm256_set1_epi32(103)), 23));
+		const __m256 r = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(v, mask)), scale);
+		const __m256 g = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(v, 9), mask)), scale);
+		const __m256 b = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(v, 18), mask)), scale);
+		storeRGB8AVX2(rgb + 3 * i, r, g, b);
+	}
+
+	convertRGB9E5ToFloatScalar(src + i, rgb + 3 * i, numPixels - i);
+}
+
+UTILS_SIMD_TARGET_AVX2 void convertFloatToR11G11B10FAVX2(const float* rgb, uint32_t* dst, size_t numPixels)
+{
+	const __m256 zero = _mm256_setzero_ps();
+
+	size_t i = 0;
+	for (; i + 8 <= numPixels; i += 8)
+	{
+		__m256 r, g, b;
+		loadRGB8AVX2(rgb + 3 * i, r, g, b);
+		const __m256i rh = _mm256_cvtepu16_epi32(_mm256_cvtps_ph(_mm256_max_ps(r, zero), _MM_FROUND_TO_NEAREST_INT));
+		const __m256i gh = _mm256_cvtepu16_epi32(_mm256_cvtps_ph(_mm256_max_ps(g, zero), _MM_FROUND_TO_NEAREST_INT));
+		const __m256i bh = _mm256_cvtepu16_epi32(_mm256_cvtps_ph(_mm256_max_ps(b, zero), _MM_FROUND_TO_NEAREST_INT));
+
+		__m256i v = _mm256_srli_epi32(rh, 4);
+		v = _mm256_or_si256(v, _mm256_slli_epi32(_mm256_srli_epi32(gh, 4), 11));
+		v = _mm256_or_si256(v, _mm256_slli_epi32(_mm256_srli_epi32(bh, 5), 22));
+		_mm256_storeu_si256((__m256i*)(dst + i), v);
+	}
+
+	convertFloatToR11G11B10FScalar(rgb + 3 * i, dst + i, numPixels - i);
+}
+
+UTILS_SIMD_TARGET_AVX2 __m256 convertPackedFieldToFloatAVX2(__m256i v, int shift, int mask, int halfShift)
+{
+	const __m256i h = _mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(v, shift), _mm256_set1_epi32(mask)), halfShift);
+	return _mm256_cvtph_ps(_mm_packus_epi32(_mm256_castsi256_si128(h), _mm256_extracti128_si256(h, 1)));
+}
+
+UTILS_SIMD_TARGET_AVX2 void convertR11G11B10FToFloatAVX2(const uint32_t* src, float* rgb, size_t numPixels)
+{
+	size_t i = 0;
+	for (; i + 8 <= numPixels; i += 8)
+	{
+		const __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+		storeRGB8AVX2(rgb + 3 * i,
+			convertPackedFieldToFloatAVX2(v, 0, 0x7FF, 4),
+			convertPackedFieldToFloatAVX2(v, 11, 0x7FF, 4),
+			convertPackedFieldToFloatAVX2(v, 22, 0x3FF, 5));
+	}
+
+	convertR11G11B10FToFloatScalar(src + i, rgb + 3 * i, numPixels - i);
+}
+
+UTILS_SIMD_TARGET_AVX2 void convertRGBEToFloatAVX2(const uint8_t* rgbe, float* rgb, size_t numPixels)
+{
+	const __m256i mask = _mm256_set1_epi32(0xFF);
+	const __m256i minNormal = _mm256_set1_epi32(10);
+
+	size_t i = 0;
+	for (; i + 8 <= numPixels; i += 8)
+	{
+		const __m256i v = _mm256_loadu_si256((const __m256i*)(rgbe + 4 * i));
+		const __m256i e = _mm256_srli_epi32(v, 24);
+
+		// 2^(e-136) is denormal for exponents 1..9, leave these (practically black) texels to ldexpf()
+		const __m256i denormal = _mm256_andnot_si256(_mm256_cmpeq_epi32(e, _mm256_setzero_si256()), _mm256_cmpgt_epi32(minNormal, e));
+		if (!_mm256_testz_si256(denormal, denormal))
+		{
+			convertRGBEToFloatScalar(rgbe + 4 * i, rgb + 3 * i, 8);
+			continue;
+		}
+
+		// exponent 0 is black: the shift below turns it into a negative scale, the mask clears it
+		const __m256 zero = _mm256_castsi256_ps(_mm256_cmpeq_epi32(e, _mm256_setzero_si256()));
+		const __m256 scale = _mm256_andnot_ps(zero, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_sub_epi32(e, _mm256_set1_epi32(9)), 23)));
+		const __m256 r = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(v, mask)), scale);
+		const __m256 g = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(v, 8), mask)), scale);
+		const __m256 b = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(v, 16), mask)), scale);
+		storeRGB8AVX2(rgb + 3 * i, r, g, b);
+	}
+
+	convertRGBEToFloatScalar(rgbe + 4 * i, rgb + 3 * i, numPixels - i);
+}
+
+#	define DISPATCH_SIMD(func, ...) if (hasAVX2F16C()) func##AVX2(__VA_ARGS__); else func##Scalar(__VA_ARGS__)
+#else
+#	define DISPATCH_SIMD(func, ...) func##Scalar(__VA_ARGS__)
+#endif // UTILS_SIMD_X86
+
+void convertFloatToHalf(const float* src, uint16_t* dst, size_t count)
+{
+	DISPATCH_SIMD(convertFloatToHalf, src, dst, count);
+}
+
+void convertHalfToFloat(const uint16_t* src, float* dst, size_t count)
+{
+	DISPATCH_SIMD(convertHalfToFloat, src, dst, count);
+}
+
+void convertFloatToUnorm8(const float* src, uint8_t* dst, size_t count)
+{
+	DISPATCH_SIMD(convertFloatToUnorm8, src, dst, count);
+}
+
+void convertUnorm8ToFloat(const uint8_t* src, float* dst, size_t count)
+{
+	DISPATCH_SIMD(convertUnorm8ToFloat, src, dst, count);
+}
+
+void convertFloatToUnorm16(const float* src, uint16_t* dst, size_t count)
+{
+	DISPATCH_SIMD(convertFloatToUnorm16, src, dst, count);
+}
+
+void convertUnorm16ToFloat(const uint16_t* src, float* dst, size_t count)
+{
+	DISPATCH_SIMD(convertUnorm16ToFloat, src, dst, count);
+}
+
+void convertFloatToRGB9E5(const float* rgb, uint32_t* dst, size_t numPixels)
+{
+	DISPATCH_SIMD(convertFloatToRGB9E5, rgb, dst, numPixels);
+}
+
+void convertRGB9E5ToFloat(const uint32_t* src, float* rgb, size_t numPixels)
+{
+	DISPATCH_SIMD(convertRGB9E5ToFloat, src, rgb, numPixels);
+}
+
+void convertFloatToR11G11B10F(const float* rgb, uint32_t* dst, size_t numPixels)
+{
+	DISPATCH_SIMD(convertFloatToR11G11B10F, rgb, dst, numPixels);
+}
+
+void convertR11G11B10FToFloat(const uint32_t* src, float* rgb, size_t numPixels)
+{
+	DISPATCH_SIMD(convertR11G11B10FToFloat, src, rgb, numPixels);
+}
+
+void convertRGBEToFloat(const uint8_t* rgbe, float* rgb, size_t numPixels)
+{
+	DISPATCH_SIMD(convertRGBEToFloat, rgbe, rgb, numPixels);
+}
+
+#undef DISPATCH_SIMD
+
+void convertPixelsToFloat(eBitmapFormat fmt, int comp, const void* src, float* dst, size_t numPixels)
+{
+	const size_t count = numPixels * comp;
+
+	switch (fmt)
+	{
+	case eBitmapFormat_UnsignedByte:
+		convertUnorm8ToFloat(static_cast<const uint8_t*>(src), dst, count);
+		break;
+	case eBitmapFormat_Float:
+		memcpy(dst, src, count * sizeof(float));
+		break;
+	case eBitmapFormat_HalfFloat:
+		convertHalfToFloat(static_cast<const uint16_t*>(src), dst, count);
+		break;
+	case eBitmapFormat_UnsignedShort:
+		convertUnorm16ToFloat(static_cast<const uint16_t*>(src), dst, count);
+		break;
+	case eBitmapFormat_RGB9E5:
+		assert(comp == 3);
+		convertRGB9E5ToFloat(static_cast<const uint32_t*>(src), dst, numPixels);
+		break;
+	case eBitmapFormat_R11G11B10F:
+		assert(comp == 3);
+		convertR11G11B10FToFloat(static_cast<const uint32_t*>(src), dst, numPixels);
+		break;
+	}
+}
+
+void convertPixelsFromFloat(eBitmapFormat fmt, int comp, const float* src, void* dst, size_t numPixels)
+{
+	const size_t count = numPixels * comp;
+
+	switch (fmt)
+	{
+	case eBitmapFormat_UnsignedByte:
+		convertFloatToUnorm8(src, static_cast<uint8_t*>(dst), count);
+		break;
+	case eBitmapFormat_Float:
+		memcpy(dst, src, count * sizeof(float));
+		break;
+	case eBitmapFormat_HalfFloat:
+		convertFloatToHalf(src, static_cast<uint16_t*>(dst), count);
+		break;
+	case eBitmapFormat_UnsignedShort:
+		convertFloatToUnorm16(src, static_cast<uint16_t*>(dst), count);
+		break;
+	case eBitmapFormat_RGB9E5:
+		assert(comp == 3);
+		convertFloatToRGB9E5(src, static_cast<uint32_t*>(dst), numPixels);
+		break;
+	case eBitmapFormat_R11G11B10F:
+		assert(comp == 3);
+		convertFloatToR11G11B10F(src, static_cast<uint32_t*>(dst), numPixels);
+		break;
+	}
+}
+
+Bitmap convertBitmapFormat(const Bitmap& b, eBitmapFormat fmt)
+{
+	const int srcComp = b.comp_;
+	const int dstComp = Bitmap::isPackedFormat(fmt) ? 3 : b.comp_;
+
+	assert(!Bitmap::isPackedFormat(fmt) || srcComp >= 3);
+
+	Bitmap result = b.d_ > 1 ? Bitmap(b.w_, b.h_, b.d_, dstComp, fmt) : Bitmap(b.w_, b.h_, dstComp, fmt, b.getLayout());
+	result.type_ = b.type_;
+
+	const int srcPixelSize = Bitmap::getBytesPerPixel(b.fmt_, srcComp);
+	const int dstPixelSize = Bitmap::getBytesPerPixel(fmt, dstComp);
+	const size_t numPixels = result.data_.size() / dstPixelSize;
+
+	// go through a small float buffer which stays in L1
+	const size_t kChunkSize = 1024;
+	std::vector<float> tmp(kChunkSize * 4);
+
+	for (size_t i = 0; i < numPixels; i += kChunkSize)
+	{
+		const size_t n = std::min(kChunkSize, numPixels - i);
+
+		convertPixelsToFloat(b.fmt_, srcComp, &b.data_[i * srcPixelSize], tmp.data(), n);
+
+		// RGBA into a packed RGB format
+		if (srcComp != dstComp)
+		{
+			for (size_t j = 0; j != n; j++)
+				for (int c = 0; c != dstComp; c++)
+					tmp[j * dstComp + c] = tmp[j * srcComp + c];
+		}
+
+		convertPixelsFromFloat(fmt, dstComp, tmp.data(), &result.data_[i * dstPixelSize], n);
+	}
+
+	return result;
+}
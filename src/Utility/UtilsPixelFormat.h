@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Bitmap.h"
+
+/// Bulk pixel format conversions, vectorized with AVX2/F16C when the CPU has them.
+/// The scalar fallbacks in BitmapPacking.h produce bit-identical results, NaN payloads included.
+/// Counts are in components for the per-component formats and in RGB pixels for the packed ones.
+
+void convertFloatToHalf(const float* src, uint16_t* dst, size_t count);
+void convertHalfToFloat(const uint16_t* src, float* dst, size_t count);
+
+void convertFloatToUnorm8(const float* src, uint8_t* dst, size_t count);
+void convertUnorm8ToFloat(const uint8_t* src, float* dst, size_t count);
+
+void convertFloatToUnorm16(const float* src, uint16_t* dst, size_t count);
+void convertUnorm16ToFloat(const uint16_t* src, float* dst, size_t count);
+
+void convertFloatToRGB9E5(const float* rgb, uint32_t* dst, size_t numPixels);
+void convertRGB9E5ToFloat(const uint32_t* src, float* rgb, size_t numPixels);
+
+void convertFloatToR11G11B10F(const float* rgb, uint32_t* dst, size_t numPixels);
+void convertR11G11B10FToFloat(const uint32_t* src, float* rgb, size_t numPixels);
+
+/// Radiance RGBE texels (4 bytes each) into RGB floats
+void convertRGBEToFloat(const uint8_t* rgbe, float* rgb, size_t numPixels);
+
+/// Decodes numPixels pixels of any format into floats with 'comp' components per pixel (3 for packed formats)
+void convertPixelsToFloat(eBitmapFormat fmt, int comp, const void* src, float* dst, size_t numPixels);
+/// Encodes floats with 'comp' components per pixel (3 for packed formats) into any format
+void convertPixelsFromFloat(eBitmapFormat fmt, int comp, const float* src, void* dst, size_t numPixels);
+
+/// Converts all pixels (all faces of a cube map) into another format, keeping the storage layout.
+/// Packed formats only hold RGB: converting a 4-component bitmap into one drops the alpha channel.
+Bitmap convertBitmapFormat(const Bitmap& b, eBitmapFormat fmt);
@@ -0,0 +1,191 @@
+#include "UtilsSH.h"
+#include "UtilsBitmap.h"
+#include "UtilsCubemap.h"
+#include "UtilsPixelFormat.h"
+#include "ThreadPool.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+/// Partial sums of one job, added up in job order so the result does not depend on the thread count
+struct SH9Accumulator
+{
+	double c[9][3] = {};
+
+	void add(const glm::vec3& dir, const float* rgb, double weight)
+	{
+		const double x = dir.x;
+		const double y = dir.y;
+		const double z = dir.z;
+
+		const double basis[9] =
+		{
+			0.282095,
+			0.488603 * y,
+			0.488603 * z,
+			0.488603 * x,
+			1.092548 * x * y,
+			1.092548 * y * z,
+			0.315392 * (3.0 * z * z - 1.0),
+			1.092548 * x * z,
+			0.546274 * (x * x - y * y),
+		};
+
+		for (int i = 0; i != 9; i++)
+			for (int k = 0; k != 3; k++)
+				c[i][k] += basis[i] * weight * rgb[k];
+	}
+};
+
+/// Solid angle of the cube face rectangle from (0, 0) to (x, y) on the plane at distance 1
+double getCubeAreaElement(double x, double y)
+{
+	return atan2(x * y, sqrt(x * x + y * y + 1.0));
+}
+
+/// Decodes one row of any format into RGB floats, 1- and 2-component bitmaps replicate their first component
+void getRowRGB(const Bitmap& b, size_t row, std::vector<float>& pixels, std::vector<float>& rgb)
+{
+	const int comp = Bitmap::isPackedFormat(b.fmt_) ? 3 : b.comp_;
+	const size_t rowSize = (size_t)b.w_ * Bitmap::getBytesPerPixel(b.fmt_, b.comp_);
+
+	convertPixelsToFloat(b.fmt_, comp, b.data_.data() + row * rowSize, pixels.data(), b.w_);
+
+	for (int x = 0; x != b.w_; x++)
+	{
+		const float* p = pixels.data() + (size_t)x * comp;
+		rgb[3 * x + 0] = p[0];
+		rgb[3 * x + 1] = comp >= 3 ? p[1] : p[0];
+		rgb[3 * x + 2] = comp >= 3 ? p[2] : p[0];
+	}
+}
+
+SphericalHarmonics9 projectEnvironmentSH9(const Bitmap& b)
+{
+	// rows are decoded in place, which needs linear storage
+	if (b.getLayout() != eBitmapLayout_Linear)
+		return projectEnvironmentSH9(convertBitmapLayout(b, eBitmapLayout_Linear));
+
+	const bool isCube = b.type_ == eBitmapType_Cube;
+	const int numRows = isCube ? 6 * b.h_ : b.h_;
+
+	const int rowsPerJob = 8;
+	const int numJobs = (numRows + rowsPerJob - 1) / rowsPerJob;
+
+	std::vector<SH9Accumulator> partial(numJobs);
+
+	ThreadPool::getShared().parallelFor(0, numJobs, [&](int job)
+	{
+		std::vector<float> pixels((size_t)b.w_ * 4);
+		std::vector<float> rgb((size_t)b.w_ * 3);
+		std::vector<double> area0(isCube ? b.w_ + 1 : 0);
+		std::vector<double> area1(isCube ? b.w_ + 1 : 0);
+
+		const int row1 = std::min(numRows, (job + 1) * rowsPerJob);
+
+		for (int row = job * rowsPerJob; row != row1; row++)
+		{
+			getRowRGB(b, row, pixels, rgb);
+
+			if (isCube)
+			{
+				const int face = row / b.h_;
+				const double t0 = 2.0 * (row % b.h_) / b.h_ - 1.0;
+				const double t1 = 2.0 * (row % b.h_ + 1) / b.h_ - 1.0;
+
+				// area elements of the texel corners, every one is shared by two texels of the row
+				for (int x = 0; x <= b.w_; x++)
+				{
+					const double s = 2.0 * x / b.w_ - 1.0;
+					area0[x] = getCubeAreaElement(s, t0);
+					area1[x] = getCubeAreaElement(s, t1);
+				}
+
+				for (int x = 0; x != b.w_; x++)
+				{
+					const double s0 = 2.0 * x / b.w_ - 1.0;
+					const double s1 = 2.0 * (x + 1) / b.w_ - 1.0;
+					const double solidAngle = area0[x] - area1[x] - area0[x + 1] + area1[x + 1];
+					const glm::vec3 dir = glm::normalize(getCubeFaceDirection(face, float(0.5 * (s0 + s1)), float(0.5 * (t0 + t1))));
+					partial[job].add(dir, &rgb[3 * x], solidAngle);
+				}
+			}
+			else
+			{
+				// latitude runs from +PI/2 at the top row to -PI/2, every row is a band of the sphere
+				const double phi0 = M_PI * (0.5 - double(row) / b.h_);
+				const double phi1 = M_PI * (0.5 - double(row + 1) / b.h_);
+				const double phi = 0.5 * (phi0 + phi1);
+				const double solidAngle = 2.0 * M_PI / b.w_ * (sin(phi0) - sin(phi1));
+
+				for (int x = 0; x != b.w_; x++)
+				{
+					// the direction convertEquirectangularMapToCubeMapFaces() maps to this texel
+					const double theta = 2.0 * M_PI * (x + 0.5) / b.w_ - M_PI;
+					const glm::vec3 P(float(cos(phi) * cos(theta)), float(cos(phi) * sin(theta)), float(sin(phi)));
+					partial[job].add(glm::vec3(-P.y, P.z, -P.x), &rgb[3 * x], solidAngle);
+				}
+			}
+		}
+	});
+
+	SH9Accumulator sum;
+	for (const SH9Accumulator& p : partial)
+		for (int i = 0; i != 9; i++)
+			for (int k = 0; k != 3; k++)
+				sum.c[i][k] += p.c[i][k];
+
+	SphericalHarmonics9 sh;
+	for (int i = 0; i != 9; i++)
+		sh.c[i] = glm::vec3(float(sum.c[i][0]), float(sum.c[i][1]), float(sum.c[i][2]));
+
+	return sh;
+}
+
+IrradianceSH9UniformData getIrradianceSH9UniformData(const SphericalHarmonics9& sh)
+{
+	// the clamped cosine convolution scales band l by A_l, PI cancels against the Lambertian 1 / PI
+	const float A0 = 1.0f;
+	const float A1 = 2.0f / 3.0f;
+	const float A2 = 1.0f / 4.0f;
+
+	const float k[9] =
+	{
+		A0 * 0.282095f,
+		A1 * 0.488603f,
+		A1 * 0.488603f,
+		A1 * 0.488603f,
+		A2 * 1.092548f,
+		A2 * 1.092548f,
+		A2 * 0.315392f,
+		A2 * 1.092548f,
+		A2 * 0.546274f,
+	};
+
+	IrradianceSH9UniformData data;
+	for (int i = 0; i != 9; i++)
+		data.c[i] = glm::vec4(sh.c[i] * k[i], 0.0f);
+
+	return data;
+}
+
+glm::vec3 evaluateIrradianceSH9(const SphericalHarmonics9& sh, const glm::vec3& n)
+{
+	// the same polynomial as GL03_duck.frag, times PI
+	const IrradianceSH9UniformData d = getIrradianceSH9UniformData(sh);
+
+	const glm::vec3 e =
+		glm::vec3(d.c[0]) +
+		glm::vec3(d.c[1]) * n.y +
+		glm::vec3(d.c[2]) * n.z +
+		glm::vec3(d.c[3]) * n.x +
+		glm::vec3(d.c[4]) * (n.x * n.y) +
+		glm::vec3(d.c[5]) * (n.y * n.z) +
+		glm::vec3(d.c[6]) * (3.0f * n.z * n.z - 1.0f) +
+		glm::vec3(d.c[7]) * (n.x * n.z) +
+		glm::vec3(d.c[8]) * (n.x * n.x - n.y * n.y);
+
+	return e * float(M_PI);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "Bitmap.h"
+
+/// Real L2 spherical harmonics of RGB radiance in the order Y00, Y1-1, Y10, Y11, Y2-2, Y2-1, Y20, Y21, Y22.
+/// Directions are GL cube map directions (y up); equirectangular maps use the orientation of
+/// convertEquirectangularMapToCubeMapFaces(), so both representations of an environment project alike.
+struct SphericalHarmonics9
+{
+	glm::vec3 c[9];
+};
+
+/// Projects an equirectangular 2D map or a cube map in one parallel pass, every texel weighted by its solid angle
+SphericalHarmonics9 projectEnvironmentSH9(const Bitmap& b);
+
+/// Irradiance E(n) of the projected environment (Ramamoorthi & Hanrahan), a Lambertian surface reflects albedo * E / PI
+glm::vec3 evaluateIrradianceSH9(const SphericalHarmonics9& sh, const glm::vec3& n);
+
+/// std140 layout of the IrradianceSH uniform block in GL03_duck.frag: the cosine lobe, the basis constants
+/// and 1 / PI are folded into the coefficients, so the shader only evaluates the polynomial in n
+struct IrradianceSH9UniformData
+{
+	glm::vec4 c[9];
+};
+
+IrradianceSH9UniformData getIrradianceSH9UniformData(const SphericalHarmonics9& sh);
@@ -0,0 +1,46 @@
+#pragma once
+
+/// x86 SIMD helpers. The build does not raise the baseline ISA, so AVX2 code paths are compiled
+/// per function with UTILS_SIMD_TARGET_AVX2 and only called after a hasAVX2F16C() check.
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#	define UTILS_SIMD_X86 1
+#	include <immintrin.h>
+#	if defined(_MSC_VER) && !defined(__clang__)
+#		include <intrin.h>
+		// MSVC accepts AVX2 intrinsics in any function
+#		define UTILS_SIMD_TARGET_AVX2
+#	else
+#		define UTILS_SIMD_TARGET_AVX2 __attribute__((target("avx2,f16c")))
+#	endif
+#endif
+
+/// AVX2 and F16C are present and the OS saves the YMM registers
+inline bool hasAVX2F16C()
+{
+#if defined(UTILS_SIMD_X86) && defined(_MSC_VER) && !defined(__clang__)
+	static const bool supported = []()
+	{
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+			return false;
+
+		__cpuid(info, 1);
+		const bool avx = (info[2] & (1 << 28)) != 0;
+		const bool osxsave = (info[2] & (1 << 27)) != 0;
+		const bool f16c = (info[2] & (1 << 29)) != 0;
+		if (!avx || !osxsave || !f16c || (_xgetbv(0) & 6) != 6)
+			return false;
+
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+	}();
+	return supported;
+#elif defined(UTILS_SIMD_X86)
+	static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c");
+	return supported;
+#else
+	return false;
+#endif
+}
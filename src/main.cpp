@@ -9,6 +9,7 @@
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
+#undef STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb/stb_image_write.h>
 
@@ -16,12 +17,27 @@
 #include "Utility/UtilsMath.h"
 #include "Bitmap.h"
 #include "Utility/UtilsCubemap.cpp"
+#include "Utility/ThreadPool.cpp"
+#include "Utility/GLTextureLoader.cpp"
+#include "Utility/UtilsBitmap.cpp"
+#include "Utility/GLTextureStreamer.cpp"
+#include "Utility/GLVirtualTexture.cpp"
+#include "Utility/GLMaterialSystem.cpp"
+#include "Utility/UtilsPixelFormat.cpp"
+#include "Utility/UtilsHDR.cpp"
+#include "Utility/UtilsSH.cpp"
+#include "Utility/GLEnvironmentBaker.cpp"
+#include "Utility/UtilsIBLCache.cpp"
 
 #include "Utility/debug.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include <chrono>
+#include <future>
+#include <memory>
 #include <vector>
 
 using glm::mat4;
@@ -37,8 +53,33 @@ struct PerFrameData
 	vec4 camera;
 };
 
-int main(void)
+int main(int argc, char** argv)
 {
+	// a missing environment is baked on a background thread unless
+	// --gpu-ibl: bake it with compute shaders at startup
+	// --progressive-ibl: bake it on the main thread a few milliseconds per frame
+	// --materials: draw the duck through GLMaterialSystem
+	// --virtual-texture: sample the duck's base color from a GLVirtualTexture
+	// --stream-textures: stream the mip levels of the duck's base color with its size on screen
+	bool gpuIBL = false;
+	bool progressiveIBL = false;
+	bool useMaterials = false;
+	bool useVirtualTexture = false;
+	bool useTextureStreaming = false;
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--gpu-ibl"))
+			gpuIBL = true;
+		else if (!strcmp(argv[i], "--progressive-ibl"))
+			progressiveIBL = true;
+		else if (!strcmp(argv[i], "--materials"))
+			useMaterials = true;
+		else if (!strcmp(argv[i], "--virtual-texture"))
+			useVirtualTexture = true;
+		else if (!strcmp(argv[i], "--stream-textures"))
+			useTextureStreaming = true;
+	}
+
 	//GLFW Error Callback via a simple Lambda
 	glfwSetErrorCallback(
 		[](int error, const char* description)
@@ -172,53 +213,198 @@ int main(void)
 
 
 	// texture
-	GLuint texture;
+	//Decoded on worker threads and streamed in by the loader's upload thread;
+	//a 1x1 white texture is bound until the upload fence has signaled
+	const char* kDuckTextureFileName = "../res/rubber_duck/textures/Duck_baseColor.png";
+	std::unique_ptr<GLAsyncTextureLoader> textureLoader(new GLAsyncTextureLoader(window));
+	const GLuint texture = textureLoader->loadTexture2D(kDuckTextureFileName);
+
+	GLuint fallbackTexture;
+	{
+		const uint8_t white[] = { 255, 255, 255 };
+		glCreateTextures(GL_TEXTURE_2D, 1, &fallbackTexture);
+		glTextureParameteri(fallbackTexture, GL_TEXTURE_MAX_LEVEL, 0);
+		glTextureStorage2D(fallbackTexture, 1, GL_RGB8, 1, 1);
+		glTextureSubImage2D(fallbackTexture, 0, 0, 0, 1, 1, GL_RGB, GL_UNSIGNED_BYTE, white);
+	}
+
+	// the material pools and the material SSBO are bound once, the draw selects the duck's material by its base instance
+	std::unique_ptr<GLMaterialSystem> materials;
+	std::unique_ptr<GLProgram> progModelMaterial;
+	uint32_t duckMaterial = 0;
+	if (useMaterials)
 	{
-		int w, h, comp;
-		const uint8_t* img = stbi_load("../res/rubber_duck/textures/Duck_baseColor.png", &w, &h, &comp, 3);
-
-		glCreateTextures(GL_TEXTURE_2D, 1, &texture);
-		glTextureParameteri(texture, GL_TEXTURE_MAX_LEVEL, 0);
-		glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTextureStorage2D(texture, 1, GL_RGB8, w, h);
-		glTextureSubImage2D(texture, 0, 0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE, img);
-		glBindTextures(0, 1, &texture);
-
-		stbi_image_free((void*)img);
+		materials.reset(new GLMaterialSystem());
+		MaterialDescription duck;
+		Bitmap albedo;
+		// an unreadable texture leaves a white material
+		if (loadBitmap(kDuckTextureFileName, albedo))
+			duck.albedoTexture = materials->addTexture(albedo);
+		duckMaterial = materials->addMaterial(duck);
+		materials->finalize();
+		materials->bind();
+
+		const GLShader shdMaterialVertex("../res/shaders/GL03_duck_material.vert");
+		const GLShader shdMaterialFragment("../res/shaders/GL03_duck_material.frag");
+		progModelMaterial.reset(new GLProgram(shdMaterialVertex, shdMaterialFragment));
+	}
+
+	// the page file is cut from the base color once and then streamed page by page
+	std::unique_ptr<GLVirtualTexture> virtualTexture;
+	std::unique_ptr<GLProgram> progModelVT;
+	std::unique_ptr<GLProgram> progVTFeedback;
+	if (useVirtualTexture)
+	{
+		const char* kDuckVirtualTextureFileName = "duck_basecolor.vtx";
+		if (FILE* f = fopen(kDuckVirtualTextureFileName, "rb"))
+		{
+			fclose(f);
+		}
+		else
+		{
+			Bitmap albedo;
+			if (loadBitmap(kDuckTextureFileName, albedo))
+				writeVirtualTextureFile(kDuckVirtualTextureFileName, albedo);
+		}
+
+		virtualTexture.reset(new GLVirtualTexture(kDuckVirtualTextureFileName));
+		// an unusable page file leaves the regular duck texture
+		if (virtualTexture->isValid())
+		{
+			const GLShader shdVTFragment("../res/shaders/GL03_duck_vt.frag");
+			const GLShader shdFeedbackFragment("../res/shaders/GL03_vt_feedback.frag");
+			progModelVT.reset(new GLProgram(shdModelVertex, shdVTFragment));
+			progVTFeedback.reset(new GLProgram(shdModelVertex, shdFeedbackFragment));
+		}
+		else
+		{
+			virtualTexture.reset();
+		}
+	}
+
+	// only the mip tail of the base color is resident up front, finer levels follow the footprint of the duck
+	const size_t kTextureStreamingBudget = 64 * 1024 * 1024;
+	std::unique_ptr<GLTextureStreamer> textureStreamer;
+	uint32_t streamedTexture = 0;
+	BoundingBox duckBounds;
+	if (useTextureStreaming)
+	{
+		Bitmap albedo;
+		if (loadBitmap(kDuckTextureFileName, albedo))
+		{
+			textureStreamer.reset(new GLTextureStreamer(kTextureStreamingBudget));
+			streamedTexture = textureStreamer->addTexture(albedo);
+
+			std::vector<vec3> positions;
+			for (const auto& v : vertices)
+				positions.push_back(v.pos);
+			duckBounds = BoundingBox(positions.data(), positions.size());
+		}
 	}
 
-	// cube map
-	GLuint cubemapTex;
+	// environment: GGX prefiltered cube map and SH9 irradiance, baked once per file content and then mapped from the cache
+	const char* kEnvironmentFileName = "../res/piazza_bologni_1k.hdr";
+	// CPU time per frame for re-baking the environment, a quarter of a 60 Hz frame
+	const double kIBLBakeBudgetMs = 4.0;
+	IBLBakeParams iblParams;
+	iblParams.baker = gpuIBL && GLEnvironmentBaker::isSupported() ? eIBLBaker_GPU : eIBLBaker_CPU;
+	IBLBakeCache iblCache("ibl_cache");
+	const uint64_t iblKey = IBLBakeCache::getKey(kEnvironmentFileName, iblParams);
+
+	std::shared_ptr<const IBLBake> ibl = iblCache.find(iblKey);
+	std::shared_future<std::shared_ptr<const IBLBake>> iblBake;
+	std::unique_ptr<ProgressiveIBLBaker> iblBaker;
+	GLuint cubemapTex = 0;
+
+	if (!ibl && iblParams.baker == eIBLBaker_GPU)
 	{
-		int w, h, comp;
-		const float* img = stbi_loadf("../res/piazza_bologni_1k.hdr", &w, &h, &comp, 3);
-		Bitmap in(w, h, comp, eBitmapFormat_Float, img);
-		Bitmap out = convertEquirectangularMapToVerticalCross(in);
-		stbi_image_free((void*)img);
-
-		stbi_write_hdr("screenshot.hdr", out.w_, out.h_, out.comp_, (const float*)out.data_.data());
-
-		Bitmap cubemap = convertVerticalCrossToCubeMapFaces(out);
-
-		glCreateTextures(GL_TEXTURE_CUBE_MAP, 1, &cubemapTex);
-		glTextureParameteri(cubemapTex, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTextureParameteri(cubemapTex, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTextureParameteri(cubemapTex, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-		glTextureParameteri(cubemapTex, GL_TEXTURE_BASE_LEVEL, 0);
-		glTextureParameteri(cubemapTex, GL_TEXTURE_MAX_LEVEL, 0);
-		glTextureParameteri(cubemapTex, GL_TEXTURE_MAX_LEVEL, 0);
-		glTextureParameteri(cubemapTex, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTextureParameteri(cubemapTex, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTextureStorage2D(cubemapTex, 1, GL_RGB32F, cubemap.w_, cubemap.h_);
-		const uint8_t* data = cubemap.data_.data();
-
-		for (unsigned i = 0; i != 6; ++i)
+		// a miss is baked by compute shaders right away and the levels are read back for the cache
+		BitmapArena arena;
+
+		Bitmap hdr;
+		// an unreadable file leaves the gray stand-in below
+		if (loadHDR(kEnvironmentFileName, hdr, eBitmapFormat_HalfFloat))
 		{
-			glTextureSubImage3D(cubemapTex, 0, 0, 0, i, cubemap.w_, cubemap.h_, 1, GL_RGB, GL_FLOAT, data);
-			data += cubemap.w_ * cubemap.h_ * cubemap.comp_ * Bitmap::getBytesPerComponent(cubemap.fmt_);
+			GLuint equirectTex;
+			GLenum internalFormat, format, type;
+			getGLTextureFormat(hdr, internalFormat, format, type);
+			glCreateTextures(GL_TEXTURE_2D, 1, &equirectTex);
+			glTextureStorage2D(equirectTex, 1, internalFormat, hdr.w_, hdr.h_);
+			glTextureSubImage2D(equirectTex, 0, 0, 0, hdr.w_, hdr.h_, format, type, hdr.data_.data());
+
+			const GLEnvironmentBaker baker;
+			const GLuint faces = baker.convertEquirectangularMapToCubeMap(equirectTex, iblParams.faceSize);
+			cubemapTex = baker.prefilterEnvironmentGGX(faces, iblParams.numSamples, iblParams.numLevels);
+
+			glDeleteTextures(1, &faces);
+			glDeleteTextures(1, &equirectTex);
+
+			std::shared_ptr<IBLBake> baked(new IBLBake());
+			baked->levels = readCubeMapTexture(cubemapTex);
+			baked->sh = projectEnvironmentSH9(hdr);
+			iblCache.storeAsync(iblKey, baked);
+			ibl = baked;
 		}
-		glBindTextures(1, 1, &cubemapTex);
+	}
+	else if (!ibl && progressiveIBL)
+	{
+		// a miss is baked on the CPU a few milliseconds per frame
+		Bitmap hdr;
+		if (loadHDR(kEnvironmentFileName, hdr))
+			iblBaker.reset(new ProgressiveIBLBaker(hdr, iblParams));
+	}
+	else if (!ibl)
+	{
+		// a miss is baked and stored on a background thread
+		iblBake = iblCache.bakeAsync(kEnvironmentFileName, iblKey, iblParams);
+	}
+
+	if (ibl && !cubemapTex)
+		cubemapTex = createCubeMapTexture(ibl->levels);
+
+	SphericalHarmonics9 iblSH = {};
+	if (ibl)
+		iblSH = ibl->sh;
+
+	if (!cubemapTex)
+	{
+		// a gray stand-in until the bake has finished, its SH keeps the diffuse light of the duck consistent
+		Bitmap gray(1, 1, 6, 3, eBitmapFormat_HalfFloat);
+		gray.type_ = eBitmapType_Cube;
+		for (int i = 0; i != 6; i++)
+			gray.setPixel(0, i, vec4(0.5f));
+		cubemapTex = createCubeMapTexture(std::vector<Bitmap>(1, gray));
+		iblSH = projectEnvironmentSH9(gray);
+	}
+	glBindTextures(1, 1, &cubemapTex);
+
+	// diffuse lighting needs only the 9 SH coefficients instead of an irradiance cube map
+	GLuint irradianceSHBuffer;
+	{
+		const IrradianceSH9UniformData irradianceSH = getIrradianceSH9UniformData(iblSH);
+		glCreateBuffers(1, &irradianceSHBuffer);
+		glNamedBufferStorage(irradianceSHBuffer, sizeof(irradianceSH), &irradianceSH, GL_DYNAMIC_STORAGE_BIT);
+		glBindBufferBase(GL_UNIFORM_BUFFER, 1, irradianceSHBuffer);
+	}
+	ibl.reset();
+
+	// split sum BRDF table, integrated once and then read from the cache file
+	GLuint brdfLUTTex;
+	{
+		const Bitmap lut = loadBRDFIntegrationLUT("brdf_lut.bin");
+
+		glCreateTextures(GL_TEXTURE_2D, 1, &brdfLUTTex);
+		glTextureParameteri(brdfLUTTex, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTextureParameteri(brdfLUTTex, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTextureParameteri(brdfLUTTex, GL_TEXTURE_MAX_LEVEL, 0);
+		glTextureParameteri(brdfLUTTex, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTextureParameteri(brdfLUTTex, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		GLenum internalFormat, format, type;
+		getGLTextureFormat(lut, internalFormat, format, type);
+		glTextureStorage2D(brdfLUTTex, 1, internalFormat, lut.w_, lut.h_);
+		glTextureSubImage2D(brdfLUTTex, 0, 0, 0, lut.w_, lut.h_, format, type, lut.data_.data());
+		// above the units of the virtual texture and the material pools
+		glBindTextureUnit(12, brdfLUTTex);
 	}
 
 	while (!glfwWindowShouldClose(window))
@@ -229,6 +415,33 @@ int main(void)
 		glfwGetFramebufferSize(window, &width, &height);
 		const float ratio = width / (float)height;
 
+		// the old environment stays bound until the new one is complete
+		std::shared_ptr<const IBLBake> baked;
+		if (iblBaker && iblBaker->update(kIBLBakeBudgetMs))
+		{
+			baked = iblBaker->getResult();
+			iblCache.storeAsync(iblKey, baked);
+			iblBaker.reset();
+		}
+		if (iblBake.valid() && iblBake.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+		{
+			baked = iblBake.get();
+			iblBake = std::shared_future<std::shared_ptr<const IBLBake>>();
+		}
+		if (baked)
+		{
+			glDeleteTextures(1, &cubemapTex);
+			cubemapTex = createCubeMapTexture(baked->levels);
+			glBindTextures(1, 1, &cubemapTex);
+
+			const IrradianceSH9UniformData irradianceSH = getIrradianceSH9UniformData(baked->sh);
+			glNamedBufferSubData(irradianceSHBuffer, 0, sizeof(irradianceSH), &irradianceSH);
+		}
+
+		textureLoader->update();
+		const GLuint modelTexture = textureLoader->isReady(texture) ? texture : fallbackTexture;
+		glBindTextures(0, 1, &modelTexture);
+
 		//Clear Screen
 		glViewport(0, 0, width, height);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -246,8 +459,37 @@ int main(void)
 				vec3(0.0f, 1.0f, 0.0f));
 			const PerFrameData perFrameData = {  m,  p * m, vec4(0.0f) };
 			glNamedBufferSubData(perFrameDataBuffer, 0, kUniformBufferSize, &perFrameData);
-			progModel.useProgram();
-			glDrawElements(GL_TRIANGLES, static_cast<unsigned>(indices.size()), GL_UNSIGNED_INT, nullptr);
+			if (textureStreamer)
+			{
+				// update() re-creates the texture whenever its resident levels change
+				textureStreamer->requestFootprint(streamedTexture, estimateScreenSize(duckBounds, perFrameData.MVP, width, height));
+				textureStreamer->update();
+				const GLuint streamed = textureStreamer->getTexture(streamedTexture);
+				glBindTextures(0, 1, &streamed);
+			}
+			if (virtualTexture)
+			{
+				// pages requested by the low-resolution feedback pass arrive a few frames later
+				virtualTexture->update();
+				virtualTexture->beginFeedbackPass(width, height);
+				progVTFeedback->useProgram();
+				glDrawElements(GL_TRIANGLES, static_cast<unsigned>(indices.size()), GL_UNSIGNED_INT, nullptr);
+				virtualTexture->endFeedbackPass();
+
+				virtualTexture->bind();
+				progModelVT->useProgram();
+				glDrawElements(GL_TRIANGLES, static_cast<unsigned>(indices.size()), GL_UNSIGNED_INT, nullptr);
+			}
+			else if (progModelMaterial)
+			{
+				progModelMaterial->useProgram();
+				glDrawElementsInstancedBaseInstance(GL_TRIANGLES, static_cast<unsigned>(indices.size()), GL_UNSIGNED_INT, nullptr, 1, duckMaterial);
+			}
+			else
+			{
+				progModel.useProgram();
+				glDrawElements(GL_TRIANGLES, static_cast<unsigned>(indices.size()), GL_UNSIGNED_INT, nullptr);
+			}
 		}
 		{
 			const mat4 m = glm::scale(mat4(1.0f), vec3(2.0f));
@@ -267,7 +509,18 @@ int main(void)
 	glDeleteBuffers(1, &dataIndices);
 	glDeleteBuffers(1, &dataVertices);
 	glDeleteBuffers(1, &perFrameDataBuffer);
+	glDeleteBuffers(1, &irradianceSHBuffer);
 	glDeleteVertexArrays(1, &vao);
+	glDeleteTextures(1, &fallbackTexture);
+	glDeleteTextures(1, &cubemapTex);
+	glDeleteTextures(1, &brdfLUTTex);
+	textureLoader.reset();
+	progModelMaterial.reset();
+	materials.reset();
+	progVTFeedback.reset();
+	progModelVT.reset();
+	virtualTexture.reset();
+	textureStreamer.reset();
 
 
 	glfwDestroyWindow(window);
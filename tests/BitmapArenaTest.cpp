@@ -0,0 +1,61 @@
+#include <stdio.h>
+
+#include "Bitmap.h"
+
+#if defined(__linux__)
+#	include <unistd.h>
+#endif
+
+#define CHECK(cond) \
+	do { if (!(cond)) { printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); return 1; } } while (0)
+
+/// resident set size in bytes, 0 where it cannot be queried
+size_t getResidentBytes()
+{
+#if defined(__linux__)
+	FILE* f = fopen("/proc/self/statm", "r");
+	if (!f)
+		return 0;
+	unsigned long pages = 0, resident = 0;
+	const int n = fscanf(f, "%lu %lu", &pages, &resident);
+	fclose(f);
+	return n == 2 ? (size_t)resident * (size_t)sysconf(_SC_PAGESIZE) : 0;
+#else
+	return 0;
+#endif
+}
+
+int main()
+{
+	const int kSize = 4096; // 64 MB RGBA8, big enough to get its own mapping
+
+	// blocks released while the arena is alive are recycled
+	{
+		BitmapArena arena;
+		{
+			Bitmap a(kSize, kSize, 4, eBitmapFormat_UnsignedByte);
+		}
+		CHECK(arena.getReservedBytes() >= (size_t)kSize * kSize * 4);
+		Bitmap b(kSize, kSize, 4, eBitmapFormat_UnsignedByte);
+		CHECK(arena.getReservedBytes() == arena.getPeakBytes());
+	}
+
+	// blocks released after the arena is gone are freed
+	Bitmap big;
+	Bitmap small;
+	{
+		BitmapArena arena;
+		big = Bitmap(kSize, kSize, 4, eBitmapFormat_UnsignedByte);
+		small = Bitmap(16, 16, 4, eBitmapFormat_UnsignedByte);
+		memset(big.data_.data(), 1, big.data_.size());
+	}
+	const size_t before = getResidentBytes();
+	big = Bitmap();
+	const size_t after = getResidentBytes();
+	if (before && after)
+		CHECK(after + (size_t)kSize * kSize * 4 / 2 <= before);
+	CHECK(small.data_.size() == 16 * 16 * 4);
+
+	printf("BitmapArenaTest passed\n");
+	return 0;
+}
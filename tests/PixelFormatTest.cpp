@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+// the scalar and AVX2 paths are not exported, so compile them in here
+#include "UtilsPixelFormat.cpp"
+
+#define CHECK(cond) \
+	do { if (!(cond)) { printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); return 1; } } while (0)
+
+/// index of the first differing element, or n
+template <typename T>
+size_t findMismatch(const std::vector<T>& a, const std::vector<T>& b)
+{
+	for (size_t i = 0; i != a.size(); i++)
+		if (memcmp(&a[i], &b[i], sizeof(T)))
+			return i;
+	return a.size();
+}
+
+/// bit patterns covering zeros, subnormals, normals, infinities and NaNs of both signs
+std::vector<float> getFloatPatterns(size_t count)
+{
+	std::vector<float> v(count);
+	for (size_t i = 0; i != count; i++)
+		v[i] = bitsToFloat((uint32_t)(i * 0x9E3779B1ull));
+
+	const uint32_t specials[] = { 0x00000000, 0x80000000, 0x00000001, 0x7F800000, 0xFF800000, 0x7FC00000, 0x7F800001, 0xFFBFFFFF, 0x477FF000, 0x477FEFFF, 0x3F800000 };
+	for (size_t i = 0; i != sizeof(specials) / sizeof(specials[0]); i++)
+		v[i] = bitsToFloat(specials[i]);
+
+	return v;
+}
+
+int main()
+{
+#if defined(UTILS_SIMD_X86)
+	if (!hasAVX2F16C())
+	{
+		printf("PixelFormatTest skipped: no AVX2/F16C\n");
+		return 0;
+	}
+
+	// every half
+	{
+		std::vector<uint16_t> src(65536);
+		for (size_t i = 0; i != src.size(); i++)
+			src[i] = (uint16_t)i;
+		std::vector<float> a(src.size()), b(src.size());
+		convertHalfToFloatScalar(src.data(), a.data(), src.size());
+		convertHalfToFloatAVX2(src.data(), b.data(), src.size());
+		CHECK(findMismatch(a, b) == a.size());
+	}
+
+	// every float
+	{
+		const size_t kChunkSize = 1 << 20;
+		std::vector<float> src(kChunkSize);
+		std::vector<uint16_t> a(kChunkSize), b(kChunkSize);
+		for (uint64_t base = 0; base != (1ull << 32); base += kChunkSize)
+		{
+			for (size_t i = 0; i != kChunkSize; i++)
+				src[i] = bitsToFloat((uint32_t)(base + i));
+			convertFloatToHalfScalar(src.data(), a.data(), kChunkSize);
+			convertFloatToHalfAVX2(src.data(), b.data(), kChunkSize);
+			CHECK(findMismatch(a, b) == a.size());
+		}
+	}
+
+	// every 8- and 16-bit unorm
+	{
+		std::vector<uint8_t> src8(256);
+		std::vector<uint16_t> src16(65536);
+		for (size_t i = 0; i != src16.size(); i++)
+		{
+			src16[i] = (uint16_t)i;
+			src8[i & 255] = (uint8_t)i;
+		}
+		std::vector<float> a(src16.size()), b(src16.size());
+		convertUnorm16ToFloatScalar(src16.data(), a.data(), src16.size());
+		convertUnorm16ToFloatAVX2(src16.data(), b.data(), src16.size());
+		CHECK(findMismatch(a, b) == a.size());
+		convertUnorm8ToFloatScalar(src8.data(), a.data(), src8.size());
+		convertUnorm8ToFloatAVX2(src8.data(), b.data(), src8.size());
+		CHECK(findMismatch(a, b) == a.size());
+	}
+
+	// every field value of the packed formats, the fields decode independently
+	{
+		std::vector<uint32_t> r11(2048), e5(32 * 512);
+		for (uint32_t i = 0; i != 2048; i++)
+			r11[i] = i | (((i * 7) & 0x7FF) << 11) | ((i & 0x3FF) << 22);
+		for (uint32_t i = 0; i != 32 * 512; i++)
+			e5[i] = (i & 0x1FF) | (((i * 7) & 0x1FF) << 9) | (((i * 13) & 0x1FF) << 18) | ((i >> 9) << 27);
+
+		std::vector<float> a(3 * e5.size()), b(3 * e5.size());
+		convertR11G11B10FToFloatScalar(r11.data(), a.data(), r11.size());
+		convertR11G11B10FToFloatAVX2(r11.data(), b.data(), r11.size());
+		CHECK(findMismatch(a, b) == a.size());
+		convertRGB9E5ToFloatScalar(e5.data(), a.data(), e5.size());
+		convertRGB9E5ToFloatAVX2(e5.data(), b.data(), e5.size());
+		CHECK(findMismatch(a, b) == a.size());
+	}
+
+	// every RGBE exponent with varied mantissas
+	{
+		std::vector<uint8_t> rgbe(4 * 65536);
+		for (size_t i = 0; i != 65536; i++)
+		{
+			rgbe[4 * i + 0] = (uint8_t)i;
+			rgbe[4 * i + 1] = (uint8_t)(i ^ 0x55);
+			rgbe[4 * i + 2] = (uint8_t)(255 - (i & 255));
+			rgbe[4 * i + 3] = (uint8_t)(i >> 8);
+		}
+		std::vector<float> a(3 * 65536), b(3 * 65536);
+		convertRGBEToFloatScalar(rgbe.data(), a.data(), 65536);
+		convertRGBEToFloatAVX2(rgbe.data(), b.data(), 65536);
+		CHECK(findMismatch(a, b) == a.size());
+	}
+
+	// encoders from float bit patterns
+	{
+		const size_t kCount = 3 << 20;
+		const std::vector<float> src = getFloatPatterns(kCount);
+
+		std::vector<uint8_t> a8(kCount), b8(kCount);
+		convertFloatToUnorm8Scalar(src.data(), a8.data(), kCount);
+		convertFloatToUnorm8AVX2(src.data(), b8.data(), kCount);
+		CHECK(findMismatch(a8, b8) == a8.size());
+
+		std::vector<uint16_t> a16(kCount), b16(kCount);
+		convertFloatToUnorm16Scalar(src.data(), a16.data(), kCount);
+		convertFloatToUnorm16AVX2(src.data(), b16.data(), kCount);
+		CHECK(findMismatch(a16, b16) == a16.size());
+
+		std::vector<uint32_t> a32(kCount / 3), b32(kCount / 3);
+		convertFloatToRGB9E5Scalar(src.data(), a32.data(), kCount / 3);
+		convertFloatToRGB9E5AVX2(src.data(), b32.data(), kCount / 3);
+		CHECK(findMismatch(a32, b32) == a32.size());
+		convertFloatToR11G11B10FScalar(src.data(), a32.data(), kCount / 3);
+		convertFloatToR11G11B10FAVX2(src.data(), b32.data(), kCount / 3);
+		CHECK(findMismatch(a32, b32) == a32.size());
+	}
+
+	printf("PixelFormatTest passed\n");
+#else
+	printf("PixelFormatTest skipped: not x86\n");
+#endif
+	return 0;
+}